@@ -1,3 +1,4 @@
+#include <mutex>
 #include "FireLog.h"
 #include "version.h"
 #include <iostream>
@@ -31,6 +32,7 @@ using namespace std;
 FILE *logFile = NULL;
 int logLevel = FIRELOG_WARN;
 static char lastMessage[5][LOGMAX+1];
+static std::mutex logLock;	// filter threads log concurrently
 
 
 int firelog_init(const char *path, int level) {
@@ -111,10 +113,11 @@ void firelog(const char *msg, int level) {
   timeval tp;
   gettimeofday(&tp, 0);
   time_t curtime = tp.tv_sec;
-  struct tm *pLocalNow = localtime(&curtime);
-  int now_hour = pLocalNow->tm_hour;
-  int now_min = pLocalNow->tm_min;
-  int now_sec = pLocalNow->tm_sec;
+  struct tm localNow;
+  localtime_r(&curtime, &localNow);
+  int now_hour = localNow.tm_hour;
+  int now_min = localNow.tm_min;
+  int now_sec = localNow.tm_sec;
   int now_ms = tp.tv_usec/1000;
 #endif
   int tid = 0;
@@ -131,6 +134,7 @@ void firelog(const char *msg, int level) {
     case FIRELOG_TRACE: levelStr = " T "; break;
   }
 
+  std::lock_guard<std::mutex> guard(logLock);
   if (logTID) {
     snprintf(lastMessage[level], LOGMAX, "%02d:%02d:%02d.%03d %d %s %s", 
         now_hour, now_min, now_sec, now_ms, tid, levelStr, msg);
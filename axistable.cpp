@@ -0,0 +1,137 @@
+#include <string.h>
+#include <iostream>
+#include <cfloat>
+#include <math.h>
+#include <errno.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+#include "jo_util.hpp"
+#include "jansson.h"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// AxisTable /////////////
+// Non-uniform tables are divided into buckets of equal width, each of
+// which records the first segment it overlaps. With two buckets per
+// segment, a lookup rarely scans more than one extra segment.
+
+AxisTable::AxisTable() : bucketScale(0), uniform(TRUE) {
+}
+
+int AxisTable::configure(const vector<float> &positionsIn, const vector<float> &offsetsIn) {
+    positions.clear();
+    offsets.clear();
+    buckets.clear();
+    bucketScale = 0;
+    uniform = TRUE;
+    if (positionsIn.size() != offsetsIn.size()) {
+        LOGERROR2("AxisTable::configure() positions:%ld offsets:%ld",
+                  (long) positionsIn.size(), (long) offsetsIn.size());
+        return -EINVAL;
+    }
+    int n = positionsIn.size();
+    for (int i = 1; i < n; i++) {
+        if (positionsIn[i] <= positionsIn[i-1]) {
+            LOGERROR2("AxisTable::configure() position[%d]:%g is not increasing", i, positionsIn[i]);
+            return -EINVAL;
+        }
+    }
+    positions.assign(positionsIn.begin(), positionsIn.end());
+    offsets.assign(offsetsIn.begin(), offsetsIn.end());
+    if (n < 2) {
+        return 0;
+    }
+
+    double span = positions[n-1] - positions[0];
+    double spacing = span / (n-1);
+    for (int i = 1; i < n && uniform; i++) {
+        double expected = positions[0] + i * spacing;
+        uniform = fabs(positions[i] - expected) <= spacing * 1e-6;
+    }
+    if (uniform) {
+        bucketScale = 1 / spacing;
+        return 0;
+    }
+
+    int nBuckets = 2 * (n-1);
+    bucketScale = nBuckets / span;
+    buckets.resize(nBuckets+1);
+    int segment = 0;
+    for (int b = 0; b <= nBuckets; b++) {
+        double start = positions[0] + b / bucketScale;
+        while (segment < n-2 && positions[segment+1] <= start) {
+            segment++;
+        }
+        buckets[b] = segment;
+    }
+    return 0;
+}
+
+////////////// AxisTableFilter /////////////
+
+AxisTableFilter::AxisTableFilter(IGFilter &next, json_t *pConfig) : GFilterBase(next) {
+    _name = "AxisTableFilter";
+	domain = GCoord(0,0,0);
+	if (pConfig) {
+		LOGINFO("AxisTableFilter(JSON)");
+		ASSERTZERO(configure(pConfig));
+	} else {
+		LOGINFO("AxisTableFilter()");
+	}
+}
+
+int AxisTableFilter::configure(json_t *pConfig) {
+	LOGINFO("AxisTableFilter::configure()");
+	const char *axes[3] = {"x", "y", "z"};
+	for (int a = 0; a < 3; a++) {
+		json_t *pAxis = json_object_get(pConfig, axes[a]);
+		if (!pAxis) {
+			continue;
+		}
+		vector<float> vPosition = jo_vectorf(pAxis, "position", vector<float>(), emptyMap);
+		vector<float> vOffset = jo_vectorf(pAxis, "offset", vector<float>(), emptyMap);
+		int rc = tables[a].configure(vPosition, vOffset);
+		if (rc) {
+			LOGERROR1("AxisTableFilter::configure() invalid table for axis %s", axes[a]);
+			return rc;
+		}
+		LOGINFO2("AxisTableFilter::configure() %s entries:%ld", axes[a], (long) tables[a].size());
+	}
+	json_t *pFormat = json_object_get(pConfig, "format");
+	if (pFormat && matcher.configureFormat(pFormat)) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int AxisTableFilter::writeln(const char *value) {
+	return writeSpan(value, strlen(value));
+}
+
+int AxisTableFilter::writeSpan(const char *text, size_t length) {
+	GBlock block(text, length);
+	return writeBlock(block);
+}
+
+int AxisTableFilter::writeBlock(GBlock &block) {
+	return writeBatch(&block, 1);
+}
+
+int AxisTableFilter::writeBatch(GBlock *blocks, size_t count) {
+	GCoord position = domain;
+	for (size_t i = 0; i < count; i++) {
+		if (!blocks[i].isMove()) {
+			LOGTRACE2("AxisTableFilter::writeBatch(%.*s) (no change)", (int) blocks[i].length, blocks[i].text);
+		}
+		transform(blocks[i], position);
+	}
+	domain = position;
+
+	return _next.writeBatch(blocks, count);
+}
+
+void AxisTableFilter::reset() {
+	domain = GCoord(0,0,0);
+	GFilterBase::reset();
+}
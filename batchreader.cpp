@@ -0,0 +1,195 @@
+#include <string.h>
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <set>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// BatchReader /////////////
+// Each thread takes files from the front of its own queue and steals from
+// the back of the others, so the files dealt last are stolen first.
+// Output is written to a temporary file in the output directory that
+// replaces the output file only when its input was filtered.
+
+typedef struct BatchQueue {
+    mutex lock;
+    deque<size_t> files;	// indexes of inputs
+} BatchQueue;
+
+typedef struct BatchWorker {
+    BufferedSink sink;
+    vector<IGFilterPtr> filters;
+    IGFilter *pChain;
+    long files;
+    long steals;
+    int rc;
+    BatchWorker() : sink(-1, 1<<16, FLUSH_THROUGHPUT), pChain(NULL), files(0), steals(0), rc(0) {
+    }
+} BatchWorker;
+
+typedef struct BatchPool {
+    const vector<string> &inputs;
+    const vector<string> &outputs;
+    vector<BatchQueue> queues;
+    BatchPool(const vector<string> &inputs, const vector<string> &outputs, size_t threads)
+        : inputs(inputs), outputs(outputs), queues(threads) {
+    }
+} BatchPool;
+
+static bool takeFile(BatchPool &pool, size_t t, size_t &file, bool &stolen) {
+    size_t n = pool.queues.size();
+    for (size_t k = 0; k < n; k++) {
+        BatchQueue &queue = pool.queues[(t + k) % n];
+        lock_guard<mutex> guard(queue.lock);
+        if (!queue.files.empty()) {
+            if (k == 0) {
+                file = queue.files.front();
+                queue.files.pop_front();
+            } else {
+                file = queue.files.back();
+                queue.files.pop_back();
+            }
+            stolen = k > 0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static int filterFile(BatchWorker &worker, const string &input, const string &output, size_t file) {
+    char suffix[40];
+    snprintf(suffix, sizeof(suffix), ".tmp%ld-%ld", (long) getpid(), (long) file);
+    string temp = output + suffix;
+    int fd = open(temp.c_str(), O_WRONLY|O_CREAT|O_EXCL, 0644);
+    if (fd < 0) {
+        LOGERROR1("BatchReader::readFiles() cannot write %s", temp.c_str());
+        return -errno;
+    }
+    worker.sink.setFd(fd);
+    worker.pChain->reset();
+    LineReader reader(*worker.pChain);
+    int rc = reader.readFile(input.c_str());
+    int rcFlush = worker.sink.setFd(-1);
+    rc = rc ? rc : rcFlush;
+    if (close(fd) && !rc) {
+        rc = -errno;
+    }
+    if (rc == 0 && rename(temp.c_str(), output.c_str())) {
+        LOGERROR1("BatchReader::readFiles() cannot replace %s", output.c_str());
+        rc = -errno;
+    }
+    if (rc) {
+        unlink(temp.c_str());
+    }
+    return rc;
+}
+
+/**
+ * Outputs must not be inputs and must differ from each other,
+ * since they are replaced by threads in any order
+ */
+static int checkOutputs(const vector<string> &inputs, const vector<string> &outputs) {
+    set<string> names;
+    set<pair<dev_t, ino_t> > inputFiles;
+    set<pair<dev_t, ino_t> > outputFiles;
+    struct stat st;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (stat(inputs[i].c_str(), &st) == 0) {
+            inputFiles.insert(make_pair(st.st_dev, st.st_ino));
+        }
+    }
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const char *output = outputs[i].c_str();
+        if (!names.insert(outputs[i]).second) {
+            LOGERROR1("BatchReader::readFiles() output %s is written twice", output);
+            return -EINVAL;
+        }
+        if (stat(output, &st) == 0) {
+            pair<dev_t, ino_t> id(st.st_dev, st.st_ino);
+            if (inputFiles.count(id)) {
+                LOGERROR1("BatchReader::readFiles() output %s is an input", output);
+                return -EINVAL;
+            }
+            if (!outputFiles.insert(id).second) {
+                LOGERROR1("BatchReader::readFiles() output %s is written twice", output);
+                return -EINVAL;
+            }
+        }
+    }
+    return 0;
+}
+
+static void filterFiles(BatchPool *pPool, BatchWorker *pWorker, size_t t) {
+    BatchWorker &worker = *pWorker;
+    size_t file;
+    bool stolen;
+    while (takeFile(*pPool, t, file, stolen)) {
+        int rc = filterFile(worker, pPool->inputs[file], pPool->outputs[file], file);
+        worker.rc = worker.rc ? worker.rc : rc;
+        worker.files++;
+        worker.steals += stolen ? 1 : 0;
+    }
+}
+
+BatchReader::BatchReader(IChainFactory &factory, size_t threads)
+    : factory(factory), threads(threads), files(0), steals(0) {
+    if (this->threads == 0) {
+        this->threads = max(thread::hardware_concurrency(), 1U);
+    }
+}
+
+int BatchReader::readFiles(const vector<string> &inputs, const vector<string> &outputs) {
+    if (inputs.size() != outputs.size()) {
+        LOGERROR2("BatchReader::readFiles() inputs:%ld outputs:%ld", (long) inputs.size(), (long) outputs.size());
+        return -EINVAL;
+    }
+    int rc = checkOutputs(inputs, outputs);
+    if (rc) {
+        return rc;
+    }
+    size_t poolSize = max(min(threads, inputs.size()), (size_t) 1);
+    BatchPool pool(inputs, outputs, poolSize);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        pool.queues[i % poolSize].files.push_back(i);
+    }
+
+    // configurations are shared, so chains are created by this thread
+    vector<BatchWorker> workers(poolSize);
+    for (size_t t = 0; t < poolSize; t++) {
+        workers[t].pChain = factory.createChain(workers[t].sink, workers[t].filters);
+        if (!workers[t].pChain) {
+            rc = -EINVAL;
+        }
+    }
+    if (rc == 0) {
+        vector<thread> threadPool;
+        for (size_t t = 0; t < poolSize; t++) {
+            threadPool.push_back(thread(filterFiles, &pool, &workers[t], t));
+        }
+        for (size_t t = 0; t < poolSize; t++) {
+            threadPool[t].join();
+        }
+    }
+    for (size_t t = 0; t < poolSize; t++) {
+        BatchWorker &worker = workers[t];
+        for (size_t i = worker.filters.size(); i-- > 0;) {
+            delete worker.filters[i];
+        }
+        rc = rc ? rc : worker.rc;
+        files += worker.files;
+        steals += worker.steals;
+    }
+    LOGINFO3("BatchReader::readFiles() files:%ld threads:%ld steals:%ld", files, (long) poolSize, steals);
+    return rc;
+}
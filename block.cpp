@@ -0,0 +1,141 @@
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// GBlock /////////////
+// The move prefix is parsed by GMoveMatcher, so its words are taken from
+// the matcher and only the rest of the line is scanned for words.
+
+static inline void addWord(GBlock &block, char letter, double value) {
+    if (block.wordCount < GBLOCK_WORDS) {
+        block.words[block.wordCount].letter = letter;
+        block.words[block.wordCount].value = value;
+        block.wordCount++;
+    }
+}
+
+void GBlock::parse(const char *text, size_t length) {
+    this->text = text;
+    this->length = length;
+    comment = NULL;
+    commentLength = 0;
+    modified = FALSE;
+    wordCount = 0;
+
+    moveLength = move.match(text, length);
+    if (moveLength) {
+        addWord(*this, 'G', atoi(move.code.c_str() + 1));
+        if (move.coord.x != HUGE_VAL) {
+            addWord(*this, 'X', move.coord.x);
+        }
+        if (move.coord.y != HUGE_VAL) {
+            addWord(*this, 'Y', move.coord.y);
+        }
+        if (move.coord.z != HUGE_VAL) {
+            addWord(*this, 'Z', move.coord.z);
+        }
+    }
+
+    const char *s = text + moveLength;
+    const char *end = text + length;
+    while (s < end) {
+        char c = *s;
+        if (c == ' ' || c == '\t') {
+            s++;
+        } else if (c == ';') {
+            if (!comment) {
+                comment = s;
+                commentLength = end - s;
+            }
+            break;
+        } else if (c == '(') {
+            const char *close = (const char *) memchr(s, ')', end - s);
+            const char *next = close ? close + 1 : end;
+            if (!comment) {
+                comment = s;
+                commentLength = next - s;
+            }
+            s = next;
+        } else if (('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z')) {
+            double value;
+            int chars = IGCodeMatcher::parseNumber(s+1, end-s-1, value);
+            if (!chars) {
+                break;	// not a word, e.g., the message of M117
+            }
+            addWord(*this, c & ~0x20, value);
+            s += 1 + chars;
+        } else {
+            break;
+        }
+    }
+}
+
+const GWord *GBlock::word(char letter) const {
+    for (int i = 0; i < wordCount; i++) {
+        if (words[i].letter == letter) {
+            return &words[i];
+        }
+    }
+    return NULL;
+}
+
+void GBlock::moveTo(GCoord position, const CoordFormat *formats) {
+    if (move.code.size() == 3) {
+        position = GCoord(0,0,0);	// G28
+    }
+    this->position = position;
+    move.coord = position;
+    for (int a = 0; a < 3; a++) {
+        move.formats[a] = formats[a];
+    }
+    const char letters[3] = { 'X', 'Y', 'Z' };
+    const double values[3] = { position.x, position.y, position.z };
+    for (int a = 0; a < 3; a++) {
+        int i = 0;
+        while (i < wordCount && words[i].letter != letters[a]) {
+            i++;
+        }
+        if (i < wordCount) {
+            words[i].value = values[a];
+        } else {
+            addWord(*this, letters[a], values[a]);
+        }
+    }
+    modified = TRUE;
+}
+
+int GBlock::format(char *buf, size_t bufSize) const {
+    if (!modified) {
+        size_t n = min(length, bufSize-1);
+        memcpy(buf, text, n);
+        buf[n] = 0;
+        return n;
+    }
+    return move.format(buf, bufSize, position, text+moveLength, length-moveLength);
+}
+
+////////////// IGFilter /////////////
+
+int IGFilter::writeBlock(GBlock &block) {
+    if (!block.modified) {
+        return writeSpan(block.text, block.length);
+    }
+    char buf[255];
+    int n = block.format(buf, sizeof(buf));
+    return writeSpan(buf, n);
+}
+
+int IGFilter::writeBatch(GBlock *blocks, size_t count) {
+    int rc = 0;
+    for (size_t i = 0; i < count; i++) {
+        int rcBlock = writeBlock(blocks[i]);
+        rc = rc ? rc : rcBlock;
+    }
+    return rc;
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <iostream>
+#include <math.h>
+#include <errno.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// InterpolationCache /////////////
+// Each key hashes to a set of CACHE_WAYS adjacent entries. A miss replaces
+// a stale entry of the set or else its least recently used entry. Entries
+// of an older generation are stale.
+
+InterpolationCache::InterpolationCache() 
+    : setMask(0), quantum(0.001), invQuantum(1000), generation(1), clock(0) {
+    resetStats();
+}
+
+int InterpolationCache::configure(size_t capacity, double quantumIn) {
+    if (!(quantumIn > 0) || !isfinite(quantumIn)) {
+        LOGERROR1("InterpolationCache::configure() invalid quantum:%g", quantumIn);
+        return -EINVAL;
+    }
+    if (capacity > CACHE_MAX_CAPACITY) {
+        LOGERROR2("InterpolationCache::configure() capacity:%lu exceeds %ld", (unsigned long) capacity, (long) CACHE_MAX_CAPACITY);
+        return -EINVAL;
+    }
+    quantum = quantumIn;
+    invQuantum = 1 / quantum;
+    entries.clear();
+    setMask = 0;
+    if (capacity > 0) {
+        size_t sets = 1;
+        while (sets * CACHE_WAYS < capacity) {
+            sets <<= 1;
+        }
+        CacheEntry stale;
+        stale.generation = 0;
+        stale.used = 0;
+        entries.assign(sets * CACHE_WAYS, stale);
+        setMask = sets - 1;
+    }
+    generation = 1;
+    resetStats();
+    LOGINFO2("InterpolationCache::configure() capacity:%ld quantum:%g", (long) entries.size(), quantum);
+    return 0;
+}
+
+void InterpolationCache::resetStats() {
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+}
+
+CacheEntry *InterpolationCache::set(const long long *key) {
+    unsigned long long h = (unsigned long long) key[0] * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long) key[1] * 0xC2B2AE3D27D4EB4FULL;
+    h ^= (unsigned long long) key[2] * 0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+    return &entries[(h & setMask) * CACHE_WAYS];
+}
+
+bool InterpolationCache::lookup(const GCoord &domain, GCoord &range) {
+    long long key[3];
+    quantize(domain, key);
+    CacheEntry *pSet = set(key);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        CacheEntry &entry = pSet[i];
+        if (entry.generation == generation &&
+                entry.key[0] == key[0] && entry.key[1] == key[1] && entry.key[2] == key[2]) {
+            entry.used = ++clock;
+            stats.hits++;
+            range = GCoord(
+                entry.range.x + (domain.x - entry.domain.x),
+                entry.range.y + (domain.y - entry.domain.y),
+                entry.range.z + (domain.z - entry.domain.z));
+            return TRUE;
+        }
+    }
+    stats.misses++;
+    return FALSE;
+}
+
+void InterpolationCache::insert(const GCoord &domain, const GCoord &range) {
+    long long key[3];
+    quantize(domain, key);
+    CacheEntry *pSet = set(key);
+    CacheEntry *pVictim = pSet;
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (pSet[i].generation != generation) {
+            pVictim = &pSet[i];
+            break;
+        }
+        if (pSet[i].used < pVictim->used) {
+            pVictim = &pSet[i];
+        }
+    }
+    if (pVictim->generation == generation) {
+        stats.evictions++;
+    }
+    memcpy(pVictim->key, key, sizeof(key));
+    pVictim->domain = domain;
+    pVictim->range = range;
+    pVictim->generation = generation;
+    pVictim->used = ++clock;
+}
@@ -0,0 +1,347 @@
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// ChunkReader /////////////
+// Chunks are filtered by the pool in any order but written in order by the
+// calling thread. Threads only take chunks within CHUNK_WINDOW chunks per
+// thread of the next chunk to be written, which bounds buffered output.
+
+#define CHUNK_WINDOW 2
+
+// Only the head of a chain needs a handoff: every move it writes has all
+// three axes, which replace the position of the filters after it.
+typedef struct ModalState {
+    GCoord position;	// last coordinate of each axis
+    bool moved;			// a move was seen
+} ModalState;
+
+// Lines filtered by a chunk chain, without newlines
+typedef class ChunkSink:public GCodeSink {
+    public:
+        vector<char> text;
+        vector<size_t> ends;
+        size_t used;
+        ChunkSink() : used(0) {
+        }
+        inline char *reserve(size_t length) {
+            if (used + length > text.size()) {
+                text.resize(max(text.size() * 2, used + length));
+            }
+            return &text[used];
+        }
+        inline void clear() {
+            used = 0;
+            ends.clear();
+        }
+        virtual int writeln(const char *value) {
+            return writeSpan(value, strlen(value));
+        }
+        virtual int writeSpan(const char *value, size_t length) {
+            memcpy(reserve(length), value, length);
+            used += length;
+            ends.push_back(used);
+            return 0;
+        }
+        virtual int writeBatch(GBlock *blocks, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                GBlock &block = blocks[i];
+                if (!block.modified) {
+                    memcpy(reserve(block.length), block.text, block.length);
+                    used += block.length;
+                } else {
+                    used += block.format(reserve(255), 255);
+                }
+                ends.push_back(used);
+            }
+            return 0;
+        }
+} ChunkSink;
+
+typedef struct ChunkJob {
+    const char *text;
+    size_t length;
+    ModalState last;	// modal words of the chunk, HUGE_VAL if absent
+    ModalState start;	// modal state before the chunk
+    ChunkSink out;
+    long lines;
+    int rc;
+    bool done;
+} ChunkJob;
+
+/**
+ * Find the last coordinate of each axis and the last move of a chunk
+ * by matching its lines from the end
+ */
+static void scanChunk(ChunkJob &job) {
+    ModalState &last = job.last;
+    last.position = GCoord(HUGE_VAL, HUGE_VAL, HUGE_VAL);
+    last.moved = FALSE;
+    GMoveMatcher matcher;
+    const char *text = job.text;
+    const char *lineEnd = text + job.length;
+    if (lineEnd > text && lineEnd[-1] == '\n') {
+        lineEnd--;
+    }
+    int axes = 0;
+    while (axes < 3) {
+        const char *s = lineEnd;
+        while (s > text && s[-1] != '\n') {
+            s--;
+        }
+        if (matcher.match(s, lineEnd - s)) {
+            last.moved = TRUE;
+            if (last.position.x == HUGE_VAL && matcher.coord.x != HUGE_VAL) {
+                last.position.x = matcher.coord.x;
+                axes++;
+            }
+            if (last.position.y == HUGE_VAL && matcher.coord.y != HUGE_VAL) {
+                last.position.y = matcher.coord.y;
+                axes++;
+            }
+            if (last.position.z == HUGE_VAL && matcher.coord.z != HUGE_VAL) {
+                last.position.z = matcher.coord.z;
+                axes++;
+            }
+        }
+        if (s == text) {
+            break;
+        }
+        lineEnd = s - 1;
+    }
+}
+
+static void scanChunks(vector<ChunkJob> *pJobs, atomic<size_t> *pNext) {
+    vector<ChunkJob> &jobs = *pJobs;
+    for (size_t i = (*pNext)++; i < jobs.size(); i = (*pNext)++) {
+        scanChunk(jobs[i]);
+    }
+}
+
+// Chains are created by the calling thread, since configurations
+// are shared, and reset() before each chunk
+typedef struct ChunkWorker {
+    ChunkSink sink;
+    vector<IGFilterPtr> filters;
+    IGFilter *pChain;
+} ChunkWorker;
+
+typedef struct ChunkPool {
+    vector<ChunkJob> &jobs;
+    size_t window;
+    size_t next;		// next chunk to filter
+    size_t written;		// next chunk to write
+    mutex lock;
+    condition_variable changed;
+    ChunkPool(vector<ChunkJob> &jobs, size_t window)
+        : jobs(jobs), window(window), next(0), written(0) {
+    }
+} ChunkPool;
+
+static void deleteChain(vector<IGFilterPtr> &filters) {
+    for (size_t i = filters.size(); i-- > 0;) {
+        delete filters[i];
+    }
+    filters.clear();
+}
+
+static void filterChunks(ChunkPool *pPool, ChunkWorker *pWorker) {
+    ChunkPool &pool = *pPool;
+    ChunkSink &sink = pWorker->sink;
+    IGFilter *pChain = pWorker->pChain;
+    for (;;) {
+        size_t i;
+        {
+            unique_lock<mutex> guard(pool.lock);
+            while (pool.next < pool.jobs.size() && pool.next >= pool.written + pool.window) {
+                pool.changed.wait(guard);
+            }
+            if (pool.next >= pool.jobs.size()) {
+                break;
+            }
+            i = pool.next++;
+        }
+        ChunkJob &job = pool.jobs[i];
+        int rc = -EINVAL;
+        if (pChain) {
+            pChain->reset();
+            rc = 0;
+            if (job.start.moved) {
+                GBlock prime("G1X0Y0Z0", 8);
+                prime.move.coord = job.start.position;
+                rc = pChain->writeBatch(&prime, 1);
+            }
+            sink.clear();
+            LineReader reader(*pChain);
+            int rcText = reader.readText(job.text, job.length);
+            rc = rc ? rc : rcText;
+            job.lines = reader.getLines();
+        }
+        {
+            lock_guard<mutex> guard(pool.lock);
+            swap(job.out.text, sink.text);
+            swap(job.out.ends, sink.ends);
+            job.out.used = sink.used;
+            sink.clear();
+            job.rc = rc;
+            job.done = TRUE;
+        }
+        pool.changed.notify_all();
+    }
+}
+
+ChunkReader::ChunkReader(IChainFactory &factory, IGFilter &sink, size_t threads, size_t chunkBytes)
+    : factory(factory), sink(sink), threads(threads), chunkBytes(max(chunkBytes, (size_t) 1)), lines(0) {
+    if (this->threads == 0) {
+        this->threads = max(thread::hardware_concurrency(), 1U);
+    }
+}
+
+int ChunkReader::readText(const char *text, size_t length) {
+    vector<ChunkJob> jobs;
+    const char *end = text + length;
+    for (const char *s = text; s < end;) {
+        const char *eol = s + min(chunkBytes, (size_t) (end - s)) - 1;
+        eol = (const char *) memchr(eol, '\n', end - eol);
+        const char *next = eol ? eol + 1 : end;
+        jobs.push_back(ChunkJob());
+        ChunkJob &job = jobs.back();
+        job.text = s;
+        job.length = next - s;
+        job.lines = 0;
+        job.rc = 0;
+        job.done = FALSE;
+        s = next;
+    }
+    if (jobs.empty()) {
+        return 0;
+    }
+    size_t poolSize = min(threads, jobs.size());
+
+    // first pass: modal state at the start of each chunk
+    {
+        atomic<size_t> next(0);
+        vector<thread> pool;
+        for (size_t t = 0; t < poolSize; t++) {
+            pool.push_back(thread(scanChunks, &jobs, &next));
+        }
+        for (size_t t = 0; t < poolSize; t++) {
+            pool[t].join();
+        }
+    }
+    ModalState state;
+    state.position = GCoord(0,0,0);
+    state.moved = FALSE;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].start = state;
+        const ModalState &last = jobs[i].last;
+        if (last.moved) {
+            state.position.x = last.position.x != HUGE_VAL ? last.position.x : state.position.x;
+            state.position.y = last.position.y != HUGE_VAL ? last.position.y : state.position.y;
+            state.position.z = last.position.z != HUGE_VAL ? last.position.z : state.position.z;
+            state.moved = TRUE;
+        }
+    }
+
+    // second pass: filter chunks on the pool and write them in order
+    vector<ChunkWorker> workers(poolSize);
+    for (size_t t = 0; t < poolSize; t++) {
+        workers[t].pChain = factory.createChain(workers[t].sink, workers[t].filters);
+    }
+    ChunkPool chunkPool(jobs, poolSize * CHUNK_WINDOW);
+    vector<thread> pool;
+    for (size_t t = 0; t < poolSize; t++) {
+        pool.push_back(thread(filterChunks, &chunkPool, &workers[t]));
+    }
+    int rc = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        ChunkJob &job = jobs[i];
+        {
+            unique_lock<mutex> guard(chunkPool.lock);
+            while (!job.done) {
+                chunkPool.changed.wait(guard);
+            }
+        }
+        const char *out = job.out.text.empty() ? NULL : &job.out.text[0];
+        size_t start = 0;
+        for (size_t j = 0; j < job.out.ends.size(); j++) {
+            int rcLine = sink.writeSpan(out + start, job.out.ends[j] - start);
+            rc = rc ? rc : rcLine;
+            start = job.out.ends[j];
+        }
+        rc = rc ? rc : job.rc;
+        lines += job.lines;
+        {
+            lock_guard<mutex> guard(chunkPool.lock);
+            vector<char>().swap(job.out.text);
+            vector<size_t>().swap(job.out.ends);
+            chunkPool.written = i + 1;
+        }
+        chunkPool.changed.notify_all();
+    }
+    for (size_t t = 0; t < poolSize; t++) {
+        pool[t].join();
+        deleteChain(workers[t].filters);
+    }
+    LOGINFO3("ChunkReader::readText() chunks:%ld threads:%ld lines:%ld", (long) jobs.size(), (long) poolSize, lines);
+    return rc;
+}
+
+int ChunkReader::readFile(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGERROR1("ChunkReader::readFile(%s) open failed", path);
+        return -errno;
+    }
+    size_t length = 0;
+    void *pData = NULL;
+#ifndef _MSC_VER
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        length = st.st_size;
+        pData = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pData == MAP_FAILED) {
+            pData = NULL;
+        }
+    }
+#endif
+    int rc;
+    if (pData) {
+        close(fd);
+        madvise(pData, length, MADV_WILLNEED);	// chunks are read out of order
+        rc = readText((const char *) pData, length);
+        munmap(pData, length);
+        sink.flush(INPUT_END);
+    } else {
+        // pipes and devices cannot be split, so one chain reads them
+        vector<IGFilterPtr> filters;
+        IGFilter *pChain = factory.createChain(sink, filters);
+        if (pChain) {
+            LineReader reader(*pChain);
+            rc = reader.readFd(fd);
+            lines += reader.getLines();
+        } else {
+            rc = -EINVAL;
+        }
+        deleteChain(filters);
+        close(fd);
+    }
+    LOGINFO2("ChunkReader::readFile(%s) lines:%ld", path, lines);
+    return rc;
+}
@@ -0,0 +1,131 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// CoordFormat /////////////
+// std::to_chars is locale independent and exact. Compilers without it
+// fall back to snprintf.
+
+#define FIXED_MAX_DIGITS 9
+
+static const double truncLimit = pow(10.0, -COORD_TRUNC_PLACES);
+
+static const unsigned long long powers10[FIXED_MAX_DIGITS+1] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+    1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+};
+
+static inline int writeUnsigned(char *buf, unsigned long long n) {
+    char digits[24];
+    int len = 0;
+    do {
+        digits[len++] = '0' + (char) (n % 10);
+        n /= 10;
+    } while (n);
+    for (int i = 0; i < len; i++) {
+        buf[i] = digits[len-1-i];
+    }
+    return len;
+}
+
+static int writeGeneral(char *buf, double value, int digits) {
+#ifdef __cpp_lib_to_chars
+    return std::to_chars(buf, buf+COORD_CHARS, value, std::chars_format::general, digits).ptr - buf;
+#else
+    return snprintf(buf, COORD_CHARS, "%.*g", digits, value);
+#endif
+}
+
+static int writeShortest(char *buf, double value) {
+    double magnitude = fabs(value);
+    if (magnitude < truncLimit) {
+        *buf = '0';
+        return 1;
+    }
+    if (!(magnitude < 1e15)) {
+        return writeGeneral(buf, value, 17);	// fixed notation would be too long
+    }
+#ifdef __cpp_lib_to_chars
+    return std::to_chars(buf, buf+COORD_CHARS, value, std::chars_format::fixed).ptr - buf;
+#else
+    int n = 0;
+    for (int digits = 15; digits <= 17; digits++) {
+        n = snprintf(buf, COORD_CHARS, "%.*g", digits, value);
+        if (strtod(buf, NULL) == value) {
+            break;
+        }
+    }
+    return n;
+#endif
+}
+
+static int writeFixed(char *buf, double value, int digits) {
+    double scaled = fabs(value) * powers10[digits] + 0.5;
+    if (!(scaled < 1e15)) {
+        return writeShortest(buf, value);	// too large for exact integer digits
+    }
+    unsigned long long n = (unsigned long long) scaled;
+    if (n == 0) {
+        *buf = '0';
+        return 1;
+    }
+    char *s = buf;
+    if (value < 0) {
+        *s++ = '-';
+    }
+    s += writeUnsigned(s, n / powers10[digits]);
+    unsigned long long fraction = n % powers10[digits];
+    if (fraction) {
+        int places = digits;
+        for (; fraction % 10 == 0; fraction /= 10) {
+            places--;
+        }
+        *s++ = '.';
+        char *end = s + places;
+        for (char *d = end; d > s; fraction /= 10) {
+            *--d = '0' + (char) (fraction % 10);
+        }
+        s = end;
+    }
+    return s - buf;
+}
+
+int CoordFormat::parse(const char *spec) {
+    if (strcmp("general", spec) == 0) {
+        notation = NOTATION_GENERAL;
+        digits = 6;
+    } else if (strcmp("shortest", spec) == 0) {
+        notation = NOTATION_SHORTEST;
+        digits = 0;
+    } else if (strncmp("fixed", spec, 5) == 0 && spec[5] >= '0' && spec[5] <= '9' && spec[6] == 0) {
+        notation = NOTATION_FIXED;
+        digits = spec[5] - '0';
+    } else {
+        LOGERROR1("CoordFormat::parse(%s) expected general, shortest or fixedN", spec);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int CoordFormat::write(char *buf, double value) const {
+    switch (notation) {
+    case NOTATION_SHORTEST:
+        return writeShortest(buf, value);
+    case NOTATION_FIXED:
+        return writeFixed(buf, value, digits);
+    default:
+        return writeGeneral(buf, value, digits);
+    }
+}
@@ -0,0 +1,447 @@
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0	// SO_NOSIGPIPE is set on the socket instead
+#endif
+
+////////////// GFilterDaemon /////////////
+// Every client thread blocks in accept() on the listening socket, which
+// hands each connection to one of them. stop() shuts the socket down,
+// which wakes them all, and shuts down the connection of each job. Jobs
+// are published in lock-free slots, since stop() may be called from a
+// signal handler: stop() holds a slot while it shuts its connection down,
+// and the client thread waits for the slot before closing the connection.
+
+#define JOB_STOPPING -2	/* slot held by stop() */
+
+struct gfilter::DaemonState {
+    atomic<int> stopping;
+    atomic<int> *jobFds;	// connection of each client thread, or -1
+    long idleMs;
+    mutex lock;			// guards stats
+    DaemonStats stats;
+    DaemonState(size_t clients) : stopping(0), jobFds(new atomic<int>[clients]), idleMs(DAEMON_IDLE_MS) {
+        for (size_t t = 0; t < clients; t++) {
+            jobFds[t] = -1;
+        }
+    }
+    ~DaemonState() {
+        delete[] jobFds;
+    }
+};
+
+typedef struct DaemonWorker {
+    BufferedSink sink;
+    vector<IGFilterPtr> filters;
+    IGFilter *pChain;
+    int rc;
+    DaemonWorker() : sink(-1), pChain(NULL), rc(0) {
+    }
+} DaemonWorker;
+
+static double millis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int socketAddress(const char *path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOGERROR1("GFilterDaemon socket path is too long: %s", path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+    return 0;
+}
+
+/**
+ * Peers may hang up at any time, which must not raise SIGPIPE
+ */
+static void noSigPipe(int fd) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+/**
+ * Output ends with a NUL and the status of the job, which clients remove
+ */
+static void sendStatus(int fd, int rc) {
+    char status[32];
+    int length = snprintf(status, sizeof(status), "%c" DAEMON_STATUS "%d\n", 0, rc);
+    send(fd, status, length, MSG_NOSIGNAL);	// the client may be gone
+}
+
+static int serveJob(DaemonState &state, DaemonWorker &worker, int fd) {
+    // reads and writes that wait longer than idleMs fail the job
+    int timeout = state.idleMs > 0 ? (int) state.idleMs : -1;
+    if (timeout > 0) {
+        struct timeval idle = { (time_t) (timeout / 1000), (suseconds_t) (timeout % 1000 * 1000) };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+    }
+
+    // the job starts with its first byte, not with the connection
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout)) < 0 && errno == EINTR) {
+    }
+    double start = millis();
+    worker.sink.setFd(fd);
+    worker.pChain->reset();
+    LineReader reader(*worker.pChain);
+    int rc = ready == 0 ? -ETIMEDOUT : reader.readFd(fd);
+    double firstWrite = worker.sink.getFirstWrite();
+    int rcFlush = worker.sink.setFd(-1);
+    rc = rc ? rc : rcFlush;
+    if (rc == -EAGAIN || rc == -EWOULDBLOCK) {
+        rc = -ETIMEDOUT;
+    }
+    if (rc == 0 && state.stopping) {
+        rc = -ECANCELED;	// input may have been cut short by stop()
+    }
+    sendStatus(fd, rc);
+
+    lock_guard<mutex> guard(state.lock);
+    DaemonStats &stats = state.stats;
+    stats.jobs++;
+    stats.lines += reader.getLines();
+    if (rc) {
+        stats.errors++;
+        LOGERROR3("GFilterDaemon job:%ld lines:%ld failed rc:%d", stats.jobs, reader.getLines(), rc);
+    } else if (firstWrite) {
+        double latency = firstWrite - start;
+        stats.latencyJobs++;
+        stats.latencySum += latency;
+        stats.latencyMax = max(stats.latencyMax, latency);
+        LOGINFO3("GFilterDaemon job:%ld lines:%ld latency:%.3fms", stats.jobs, reader.getLines(), latency);
+    } else {
+        LOGINFO2("GFilterDaemon job:%ld lines:%ld", stats.jobs, reader.getLines());
+    }
+    return rc;
+}
+
+static void serveJobs(DaemonState *pState, DaemonWorker *pWorker, int listenFd, size_t t) {
+    DaemonState &state = *pState;
+    atomic<int> &jobFd = state.jobFds[t];
+    while (!state.stopping) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (state.stopping) {
+                break;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOGERROR1("GFilterDaemon::serve() accept failed errno:%d", errno);
+            pWorker->rc = -errno;
+            break;
+        }
+        int expected = -1;
+        while (!jobFd.compare_exchange_weak(expected, fd)) {
+            expected = -1;
+            this_thread::yield();
+        }
+        if (state.stopping) {
+            shutdown(fd, SHUT_RDWR);	// accepted while stop() looked at the slot
+        }
+        noSigPipe(fd);
+        serveJob(state, *pWorker, fd);	// a failed job only fails its client
+        expected = fd;
+        while (!jobFd.compare_exchange_weak(expected, -1)) {
+            expected = fd;
+            this_thread::yield();
+        }
+        close(fd);
+    }
+}
+
+GFilterDaemon::GFilterDaemon(IChainFactory &factory, const char *path, size_t clients)
+    : factory(factory), path(path), clients(max(clients, (size_t) 1)), listenFd(-1),
+      bufferSize(1<<16), policy(FLUSH_INTERACTIVE), latencyMs(50), idleMs(DAEMON_IDLE_MS) {
+    pState = new DaemonState(this->clients);
+}
+
+GFilterDaemon::~GFilterDaemon() {
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+    const DaemonStats &stats = pState->stats;
+    LOGINFO4("~GFilterDaemon() jobs:%ld errors:%ld lines:%ld meanLatency:%.3fms",
+             stats.jobs, stats.errors, stats.lines, stats.meanLatency());
+    delete pState;
+}
+
+int GFilterDaemon::listen() {
+    struct sockaddr_un addr;
+    int rc = socketAddress(path.c_str(), addr);
+    if (rc) {
+        return rc;
+    }
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOGERROR1("GFilterDaemon::listen(%s) path is not a socket", path.c_str());
+            return -EADDRINUSE;
+        }
+        // only a socket that refuses connections was left by an earlier daemon
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe < 0) {
+            LOGERROR1("GFilterDaemon::listen(%s) socket failed", path.c_str());
+            return -errno;
+        }
+        int err = connect(probe, (struct sockaddr *) &addr, sizeof(addr)) ? errno : 0;
+        close(probe);
+        if (err == 0) {
+            LOGERROR1("GFilterDaemon::listen(%s) another daemon is listening", path.c_str());
+            return -EADDRINUSE;
+        }
+        if (err != ECONNREFUSED) {
+            LOGERROR2("GFilterDaemon::listen(%s) connect failed errno:%d", path.c_str(), err);
+            return -err;
+        }
+        unlink(path.c_str());
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOGERROR1("GFilterDaemon::listen(%s) socket failed", path.c_str());
+        return -errno;
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || ::listen(fd, SOMAXCONN)) {
+        rc = -errno;
+        LOGERROR1("GFilterDaemon::listen(%s) bind failed", path.c_str());
+        close(fd);
+        return rc;
+    }
+    listenFd = fd;
+    LOGINFO2("GFilterDaemon::listen(%s) clients:%ld", path.c_str(), (long) clients);
+    return 0;
+}
+
+int GFilterDaemon::serve() {
+    if (listenFd < 0) {
+        LOGERROR("GFilterDaemon::serve() not listening");
+        return -EBADF;
+    }
+    pState->idleMs = idleMs;
+
+    // configurations are shared, so chains are created by this thread
+    vector<DaemonWorker> workers(clients);
+    int rc = 0;
+    for (size_t t = 0; t < clients; t++) {
+        workers[t].sink.setBufferSize(bufferSize);
+        workers[t].sink.setPolicy(policy);
+        workers[t].sink.setLatency(latencyMs);
+        workers[t].sink.setSendFlags(MSG_NOSIGNAL);
+        workers[t].pChain = factory.createChain(workers[t].sink, workers[t].filters);
+        if (!workers[t].pChain) {
+            rc = -EINVAL;
+        }
+    }
+    if (rc == 0) {
+        vector<thread> pool;
+        for (size_t t = 0; t < clients; t++) {
+            pool.push_back(thread(serveJobs, pState, &workers[t], listenFd, t));
+        }
+        for (size_t t = 0; t < clients; t++) {
+            pool[t].join();
+        }
+    }
+    for (size_t t = 0; t < clients; t++) {
+        DaemonWorker &worker = workers[t];
+        for (size_t i = worker.filters.size(); i-- > 0;) {
+            delete worker.filters[i];
+        }
+        rc = rc ? rc : worker.rc;
+    }
+    return rc;
+}
+
+void GFilterDaemon::stop() {
+    pState->stopping = 1;
+    if (listenFd >= 0) {
+        shutdown(listenFd, SHUT_RDWR);
+    }
+    for (size_t t = 0; t < clients; t++) {
+        atomic<int> &jobFd = pState->jobFds[t];
+        int fd = jobFd.exchange(JOB_STOPPING);
+        if (fd == JOB_STOPPING) {
+            continue;	// held by another stop()
+        }
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        jobFd = fd;
+    }
+}
+
+DaemonStats GFilterDaemon::getStats() {
+    lock_guard<mutex> guard(pState->lock);
+    return pState->stats;
+}
+
+////////////// daemonClient /////////////
+// Input is sent by a thread of its own while output is read, since the
+// daemon writes output before the job has been read to its end. The
+// status that ends the output is kept from outFd.
+
+typedef struct ClientInput {
+    int inFd;
+    int fd;
+    long bytes;
+    double firstSend;
+    int rc;
+} ClientInput;
+
+static int writeFully(int fd, const char *text, size_t length, bool socket=FALSE) {
+    while (length > 0) {
+        ssize_t n = socket ? send(fd, text, length, MSG_NOSIGNAL) : write(fd, text, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        text += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static void sendInput(ClientInput *pInput) {
+    ClientInput &input = *pInput;
+    vector<char> buf(1<<16);
+    for (;;) {
+        ssize_t n = read(input.inFd, &buf[0], buf.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            LOGERROR1("daemonClient() read failed fd:%d", input.inFd);
+            input.rc = -errno;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (input.firstSend == 0) {
+            input.firstSend = millis();
+        }
+        input.rc = writeFully(input.fd, &buf[0], n, TRUE);
+        if (input.rc) {
+            LOGERROR("daemonClient() send failed");
+            break;
+        }
+        input.bytes += n;
+    }
+    shutdown(input.fd, SHUT_WR);	// end of job
+}
+
+static int jobStatus(const char *path, bool ended, const string &status) {
+    int rc;
+    if (!ended) {
+        LOGERROR1("daemonClient(%s) job ended without status", path);
+        return -ECONNRESET;
+    }
+    if (sscanf(status.c_str(), DAEMON_STATUS "%d", &rc) != 1) {
+        LOGERROR1("daemonClient(%s) job status is invalid", path);
+        return -EPROTO;
+    }
+    if (rc) {
+        LOGERROR2("daemonClient(%s) job failed rc:%d", path, rc);
+    }
+    return rc;
+}
+
+int gfilter::daemonClient(const char *path, int inFd, int outFd) {
+    struct sockaddr_un addr;
+    int rc = socketAddress(path, addr);
+    if (rc) {
+        return rc;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        rc = -errno;
+        LOGERROR1("daemonClient(%s) connect failed", path);
+        close(fd);
+        return rc;
+    }
+    noSigPipe(fd);	// the daemon may hang up before all input is sent
+    ClientInput input = { inFd, fd, 0, 0, 0 };
+    thread sender(sendInput, &input);
+    vector<char> buf(1<<16);
+    long bytes = 0;
+    double firstReceive = 0;
+    bool ended = FALSE;
+    string status;
+    for (;;) {
+        ssize_t n = read(fd, &buf[0], buf.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            LOGERROR1("daemonClient(%s) receive failed", path);
+            rc = -errno;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (firstReceive == 0) {
+            firstReceive = millis();
+        }
+        size_t output = ended ? 0 : n;
+        const char *end = ended ? NULL : (const char *) memchr(&buf[0], 0, n);
+        if (end) {
+            ended = TRUE;
+            output = end - &buf[0];
+            status.append(end + 1, n - output - 1);
+        } else if (ended) {
+            status.append(&buf[0], n);
+        }
+        rc = writeFully(outFd, &buf[0], output);
+        if (rc) {
+            LOGERROR1("daemonClient() write failed fd:%d", outFd);
+            break;
+        }
+        bytes += output;
+    }
+    if (rc == 0) {
+        rc = jobStatus(path, ended, status);
+    }
+    if (rc) {
+        shutdown(fd, SHUT_RDWR);	// stop the sender
+    }
+    sender.join();
+    close(fd);
+    rc = rc ? rc : input.rc;
+    LOGINFO4("daemonClient(%s) sent:%ld received:%ld latency:%.3fms", path, input.bytes, bytes,
+             firstReceive && input.firstSend ? firstReceive - input.firstSend : 0.0);
+    return rc;
+}
@@ -0,0 +1,495 @@
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// DelaunayMesh /////////////
+// Bowyer-Watson insertion into an enclosing super-tetrahedron. Every
+// tetrahedron is kept positively oriented and face i is opposite vertex i.
+
+#define BARYCENTRIC_EPSILON 1e-9 /* tolerance for points on tetrahedron faces */
+#define LOCATE_MAX_TIES 64 /* tetrahedra sharing the located point */
+
+typedef struct BuildTet {
+    int v[4];
+    int n[4];
+    bool alive;
+} BuildTet;
+
+static inline double orient3d(const GCoord &a, const GCoord &b, const GCoord &c, const GCoord &d) {
+    double adx = a.x - d.x, ady = a.y - d.y, adz = a.z - d.z;
+    double bdx = b.x - d.x, bdy = b.y - d.y, bdz = b.z - d.z;
+    double cdx = c.x - d.x, cdy = c.y - d.y, cdz = c.z - d.z;
+    return adx * (bdy * cdz - bdz * cdy)
+           + bdx * (cdy * adz - cdz * ady)
+           + cdx * (ady * bdz - adz * bdy);
+}
+
+// positive if e lies inside the circumsphere of positively oriented abcd
+static inline double insphere(const GCoord &a, const GCoord &b, const GCoord &c, const GCoord &d, const GCoord &e) {
+    double aex = a.x - e.x, aey = a.y - e.y, aez = a.z - e.z;
+    double bex = b.x - e.x, bey = b.y - e.y, bez = b.z - e.z;
+    double cex = c.x - e.x, cey = c.y - e.y, cez = c.z - e.z;
+    double dex = d.x - e.x, dey = d.y - e.y, dez = d.z - e.z;
+
+    double ab = aex * bey - bex * aey;
+    double bc = bex * cey - cex * bey;
+    double cd = cex * dey - dex * cey;
+    double da = dex * aey - aex * dey;
+    double ac = aex * cey - cex * aey;
+    double bd = bex * dey - dex * bey;
+
+    double abc = aez * bc - bez * ac + cez * ab;
+    double bcd = bez * cd - cez * bd + dez * bc;
+    double cda = cez * da + dez * ac + aez * cd;
+    double dab = dez * ab + aez * bd + bez * da;
+
+    double alift = aex * aex + aey * aey + aez * aez;
+    double blift = bex * bex + bey * bey + bez * bez;
+    double clift = cex * cex + cey * cey + cez * cez;
+    double dlift = dex * dex + dey * dey + dez * dez;
+
+    return (dlift * abc - clift * dab) + (blift * cda - alift * bcd);
+}
+
+typedef struct CavityFace {
+    int tet;	// cavity tetrahedron
+    int face;	// face index in cavity tetrahedron
+} CavityFace;
+
+typedef struct FaceLink {
+    int a, b;	// edge shared by two new tetrahedra
+    int tet;
+    int face;
+} FaceLink;
+
+typedef class DelaunayBuilder {
+    public:
+        vector<GCoord> &coords;
+        vector<BuildTet> tets;
+        vector<int> cavity;
+        vector<int> mark;	// insertion generation that put a tet in the cavity
+        vector<CavityFace> boundary;
+        vector<FaceLink> links;
+        int last;
+
+        DelaunayBuilder(vector<GCoord> &c) : coords(c), last(0) {}
+
+        inline double orient(const BuildTet &t) {
+            return orient3d(coords[t.v[0]], coords[t.v[1]], coords[t.v[2]], coords[t.v[3]]);
+        }
+
+        inline double orientFace(const BuildTet &t, int face, int ip) {
+            const GCoord *c[4];
+            for (int i = 0; i < 4; i++) {
+                c[i] = &coords[i == face ? ip : t.v[i]];
+            }
+            return orient3d(*c[0], *c[1], *c[2], *c[3]);
+        }
+
+        int addTet(int a, int b, int c, int d) {
+            BuildTet t = { {a,b,c,d}, {-1,-1,-1,-1}, TRUE };
+            tets.push_back(t);
+            mark.push_back(-1);
+            return tets.size() - 1;
+        }
+
+        // find a tetrahedron that contains point ip by walking from last
+        int locate(int ip) {
+            int t = last;
+            if (t < 0 || t >= tets.size() || !tets[t].alive) {
+                t = tets.size() - 1;
+                while (t > 0 && !tets[t].alive) {
+                    t--;
+                }
+            }
+            for (int steps = 0; steps < tets.size(); steps++) {
+                int next = -1;
+                for (int f = 0; f < 4; f++) {
+                    if (tets[t].n[f] >= 0 && orientFace(tets[t], f, ip) < 0) {
+                        next = tets[t].n[f];
+                        break;
+                    }
+                }
+                if (next < 0) {
+                    return t;
+                }
+                t = next;
+            }
+            LOGDEBUG1("DelaunayMesh locate(%d) walk failed", ip);
+            for (t = 0; t < tets.size(); t++) {
+                if (tets[t].alive) {
+                    bool inside = TRUE;
+                    for (int f = 0; inside && f < 4; f++) {
+                        inside = orientFace(tets[t], f, ip) >= 0;
+                    }
+                    if (inside) {
+                        return t;
+                    }
+                }
+            }
+            return -1;
+        }
+
+        bool insert(int ip) {
+            int t0 = locate(ip);
+            if (t0 < 0) {
+                return FALSE;
+            }
+            const GCoord &p = coords[ip];
+
+            // cavity of tetrahedra whose circumsphere contains p
+            cavity.clear();
+            cavity.push_back(t0);
+            mark[t0] = ip;
+            for (int i = 0; i < cavity.size(); i++) {
+                BuildTet &t = tets[cavity[i]];
+                for (int f = 0; f < 4; f++) {
+                    int tn = t.n[f];
+                    if (tn >= 0 && mark[tn] != ip) {
+                        BuildTet &n = tets[tn];
+                        if (insphere(coords[n.v[0]], coords[n.v[1]], coords[n.v[2]], coords[n.v[3]], p) > 0) {
+                            mark[tn] = ip;
+                            cavity.push_back(tn);
+                        }
+                    }
+                }
+            }
+
+            // Round-off can leave boundary faces that p cannot see.
+            // Grow the cavity across them until it is star-shaped from p.
+            bool repaired;
+            do {
+                repaired = FALSE;
+                boundary.clear();
+                for (int i = 0; i < cavity.size(); i++) {
+                    BuildTet &t = tets[cavity[i]];
+                    for (int f = 0; f < 4; f++) {
+                        int tn = t.n[f];
+                        if (tn >= 0 && mark[tn] == ip) {
+                            continue;
+                        }
+                        if (orientFace(t, f, ip) <= 0) {
+                            if (tn < 0) {
+                                return FALSE;
+                            }
+                            mark[tn] = ip;
+                            cavity.push_back(tn);
+                            repaired = TRUE;
+                            break;
+                        }
+                        CavityFace cf = { cavity[i], f };
+                        boundary.push_back(cf);
+                    }
+                    if (repaired) {
+                        break;
+                    }
+                }
+            } while (repaired);
+
+            // replace the cavity with a fan of tetrahedra from p
+            links.clear();
+            int firstNew = tets.size();
+            for (int i = 0; i < boundary.size(); i++) {
+                int tc = boundary[i].tet;
+                int f = boundary[i].face;
+                int v[4];
+                memcpy(v, tets[tc].v, sizeof v);
+                v[f] = ip;
+                int tn = tets[tc].n[f];
+                int tNew = addTet(v[0], v[1], v[2], v[3]);
+                tets[tNew].n[f] = tn;
+                if (tn >= 0) {
+                    for (int j = 0; j < 4; j++) {
+                        if (tets[tn].n[j] == tc) {
+                            tets[tn].n[j] = tNew;
+                        }
+                    }
+                }
+                // the other three faces contain p and are shared with new tetrahedra
+                for (int j = 0; j < 4; j++) {
+                    if (j == f) {
+                        continue;
+                    }
+                    int a = -1, b = -1;
+                    for (int k = 0; k < 4; k++) {
+                        if (k != f && k != j) {
+                            if (a < 0) {
+                                a = v[k];
+                            } else {
+                                b = v[k];
+                            }
+                        }
+                    }
+                    if (a > b) {
+                        swap(a, b);
+                    }
+                    bool linked = FALSE;
+                    for (int k = 0; k < links.size(); k++) {
+                        if (links[k].a == a && links[k].b == b) {
+                            tets[tNew].n[j] = links[k].tet;
+                            tets[links[k].tet].n[links[k].face] = tNew;
+                            links[k] = links.back();
+                            links.pop_back();
+                            linked = TRUE;
+                            break;
+                        }
+                    }
+                    if (!linked) {
+                        FaceLink link = { a, b, tNew, j };
+                        links.push_back(link);
+                    }
+                }
+            }
+            for (int i = 0; i < cavity.size(); i++) {
+                tets[cavity[i]].alive = FALSE;
+            }
+            last = firstNew;
+            return TRUE;
+        }
+} DelaunayBuilder;
+
+// Morton code of a point scaled into the 21-bit grid of the bounding box
+static inline unsigned long long mortonCode(const GCoord &c, const GCoord &cmin, double scale) {
+    unsigned long long code = 0;
+    unsigned long long ix = (unsigned long long) ((c.x - cmin.x) * scale);
+    unsigned long long iy = (unsigned long long) ((c.y - cmin.y) * scale);
+    unsigned long long iz = (unsigned long long) ((c.z - cmin.z) * scale);
+    for (int bit = 20; bit >= 0; bit--) {
+        code = (code << 3) | (((ix >> bit) & 1) << 2) | (((iy >> bit) & 1) << 1) | ((iz >> bit) & 1);
+    }
+    return code;
+}
+
+typedef struct MortonOrder {
+    const vector<unsigned long long> &codes;
+    MortonOrder(const vector<unsigned long long> &c) : codes(c) {}
+    inline bool operator()(int lhs, int rhs) const {
+        return codes[lhs] < codes[rhs] || (codes[lhs] == codes[rhs] && lhs < rhs);
+    }
+} MortonOrder;
+
+// Solve the barycentric and affine transforms of tetrahedron t
+static bool tetTransforms(DelaunayTet &t, const vector<MappedPoint> &points) {
+    const GCoord &d3 = points[t.v[3]].domain;
+    Mat3x3 T(
+        points[t.v[0]].domain.x-d3.x, points[t.v[1]].domain.x-d3.x, points[t.v[2]].domain.x-d3.x,
+        points[t.v[0]].domain.y-d3.y, points[t.v[1]].domain.y-d3.y, points[t.v[2]].domain.y-d3.y,
+        points[t.v[0]].domain.z-d3.z, points[t.v[1]].domain.z-d3.z, points[t.v[2]].domain.z-d3.z);
+    double det = T.det3x3();
+    if (det == 0) {
+        return FALSE;
+    }
+    double Tinv[3][3];
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            Tinv[y][x] = T.det2x2(x,y) / det;
+            if ((x + y) % 2) {
+                Tinv[y][x] = -Tinv[y][x];
+            }
+        }
+    }
+    double d3v[3] = {d3.x, d3.y, d3.z};
+    for (int y = 0; y < 3; y++) {
+        double offset = 0;
+        for (int x = 0; x < 3; x++) {
+            t.bary[y][x] = Tinv[y][x];
+            offset += Tinv[y][x] * d3v[x];
+        }
+        t.bary[y][3] = -offset;
+    }
+
+    // range = r3 + [r0-r3 r1-r3 r2-r3] * bary * [domain;1]
+    const GCoord &r3 = points[t.v[3]].range;
+    double r3v[3] = {r3.x, r3.y, r3.z};
+    for (int y = 0; y < 3; y++) {
+        double dr[3];
+        for (int k = 0; k < 3; k++) {
+            const GCoord &rk = points[t.v[k]].range;
+            double rkv[3] = {rk.x, rk.y, rk.z};
+            dr[k] = rkv[y] - r3v[y];
+        }
+        for (int x = 0; x < 4; x++) {
+            t.affine[y][x] = dr[0]*t.bary[0][x] + dr[1]*t.bary[1][x] + dr[2]*t.bary[2][x];
+        }
+        t.affine[y][3] += r3v[y];
+    }
+    return TRUE;
+}
+
+int DelaunayMesh::build(const vector<MappedPoint> &points) {
+    tets.clear();
+    vertexTets.assign(points.size(), -1);
+    int nPoints = points.size();
+    if (nPoints < 4) {
+        return 0;
+    }
+
+    vector<GCoord> coords;
+    GCoord cmin(DBL_MAX,DBL_MAX,DBL_MAX);
+    GCoord cmax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (int i = 0; i < nPoints; i++) {
+        const GCoord &c = points[i].domain;
+        coords.push_back(GCoord(c.x, c.y, c.z));
+        cmin.x = min(cmin.x, c.x);
+        cmin.y = min(cmin.y, c.y);
+        cmin.z = min(cmin.z, c.z);
+        cmax.x = max(cmax.x, c.x);
+        cmax.y = max(cmax.y, c.y);
+        cmax.z = max(cmax.z, c.z);
+    }
+
+    // super-tetrahedron enclosing the bounding box with a wide margin
+    GCoord center = 0.5*(cmin + cmax);
+    double extent = max(max(cmax.x-cmin.x, cmax.y-cmin.y), max(cmax.z-cmin.z, 1.0));
+    double s = 100 * extent;
+    coords.push_back(center + GCoord(s, s, s));
+    coords.push_back(center + GCoord(s, -s, -s));
+    coords.push_back(center + GCoord(-s, s, -s));
+    coords.push_back(center + GCoord(-s, -s, s));
+
+    DelaunayBuilder builder(coords);
+    int v0 = nPoints, v1 = nPoints+1, v2 = nPoints+2, v3 = nPoints+3;
+    int tSuper = builder.addTet(v0, v1, v2, v3);
+    if (builder.orient(builder.tets[tSuper]) < 0) {
+        swap(builder.tets[tSuper].v[0], builder.tets[tSuper].v[1]);
+    }
+
+    // Insert in biased randomized rounds, each in Morton order, so that
+    // cavities stay small and walks stay short.
+    double scale = ((1 << 21) - 1) / extent;
+    vector<unsigned long long> codes;
+    vector<int> order;
+    unsigned int seed = 1;
+    for (int i = 0; i < nPoints; i++) {
+        codes.push_back(mortonCode(coords[i], cmin, scale));
+        order.push_back(i);
+    }
+    for (int i = nPoints; --i > 0; ) {
+        seed = seed * 1103515245 + 12345;
+        swap(order[i], order[(seed >> 8) % (i + 1)]);
+    }
+    for (int end = nPoints, begin = nPoints/2; end > 0; end = begin, begin /= 2) {
+        if (end <= 64) {
+            begin = 0;
+        }
+        sort(order.begin()+begin, order.begin()+end, MortonOrder(codes));
+    }
+    int skipped = 0;
+    for (int i = 0; i < nPoints; i++) {
+        if (!builder.insert(order[i])) {
+            skipped++;
+        }
+    }
+    if (skipped) {
+        LOGWARN1("DelaunayMesh::build() skipped %d points", skipped);
+    }
+
+    // keep tetrahedra without super-tetrahedron vertices
+    vector<int> remap(builder.tets.size(), -1);
+    for (int i = 0; i < builder.tets.size(); i++) {
+        BuildTet &bt = builder.tets[i];
+        if (bt.alive && bt.v[0] < nPoints && bt.v[1] < nPoints && bt.v[2] < nPoints && bt.v[3] < nPoints) {
+            DelaunayTet t;
+            memcpy(t.v, bt.v, sizeof t.v);
+            if (tetTransforms(t, points)) {
+                remap[i] = tets.size();
+                tets.push_back(t);
+            }
+        }
+    }
+    int iTet = 0;
+    for (int i = 0; i < builder.tets.size(); i++) {
+        if (remap[i] >= 0) {
+            DelaunayTet &t = tets[iTet++];
+            for (int f = 0; f < 4; f++) {
+                int tn = builder.tets[i].n[f];
+                t.n[f] = tn >= 0 ? remap[tn] : -1;
+                vertexTets[t.v[f]] = remap[i];
+            }
+        }
+    }
+
+    LOGINFO2("DelaunayMesh::build() points:%d tetrahedra:%d", nPoints, (int) tets.size());
+    return tets.size();
+}
+
+static inline void tetBary(const DelaunayTet &tet, const GCoord &domain, double *b) {
+    for (int i = 0; i < 3; i++) {
+        b[i] = tet.bary[i][0]*domain.x + tet.bary[i][1]*domain.y + tet.bary[i][2]*domain.z + tet.bary[i][3];
+    }
+    b[3] = 1 - (b[0] + b[1] + b[2]);
+}
+
+/**
+ * Return the lowest index of the tetrahedra that contain domain and are
+ * connected to tetrahedron t across faces through domain, so that a domain on
+ * a shared face, edge or vertex maps the same way whatever tetrahedron the walk found
+ */
+static int lowestTet(const vector<DelaunayTet> &tets, const GCoord &domain, int t) {
+    int found[LOCATE_MAX_TIES];
+    int nFound = 0;
+    found[nFound++] = t;
+    int lowest = t;
+    for (int i = 0; i < nFound; i++) {
+        const DelaunayTet &tet = tets[found[i]];
+        double b[4];
+        tetBary(tet, domain, b);
+        for (int face = 0; face < 4; face++) {
+            int tn = tet.n[face];
+            if (tn < 0 || b[face] > BARYCENTRIC_EPSILON || nFound == LOCATE_MAX_TIES ||
+                find(found, found + nFound, tn) != found + nFound) {
+                continue;
+            }
+            double bn[4];
+            tetBary(tets[tn], domain, bn);
+            if (*min_element(bn, bn + 4) >= -BARYCENTRIC_EPSILON) {
+                found[nFound++] = tn;
+                lowest = min(lowest, tn);
+            }
+        }
+    }
+    return lowest;
+}
+
+int DelaunayMesh::locate(const GCoord &domain, int hint) const {
+    if (tets.size() == 0) {
+        return -1;
+    }
+    int t = (hint >= 0 && hint < tets.size()) ? hint : 0;
+    for (int steps = 0; steps < tets.size(); steps++) {
+        const DelaunayTet &tet = tets[t];
+        double b[4];
+        tetBary(tet, domain, b);
+        int face = 0;
+        for (int i = 1; i < 4; i++) {
+            if (b[i] < b[face]) {
+                face = i;
+            }
+        }
+        if (b[face] >= -BARYCENTRIC_EPSILON) {
+            return lowestTet(tets, domain, t);
+        }
+        if (tet.n[face] < 0) {
+            return -1; // outside convex hull
+        }
+        t = tet.n[face];
+    }
+
+    LOGDEBUG1("DelaunayMesh::locate(%s) walk failed", domain.toString().c_str());
+    return -1;
+}
+
+GCoord DelaunayMesh::map(int tet, const GCoord &domain) const {
+    const double (*a)[4] = tets[tet].affine;
+    return GCoord(
+        a[0][0]*domain.x + a[0][1]*domain.y + a[0][2]*domain.z + a[0][3],
+        a[1][0]*domain.x + a[1][1]*domain.y + a[1][2]*domain.z + a[1][3],
+        a[2][0]*domain.x + a[2][1]*domain.y + a[2][2]*domain.z + a[2][3]);
+}
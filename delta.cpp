@@ -16,14 +16,22 @@ DeltaFilter::DeltaFilter(IGFilter &next) : GFilterBase(next) {
 }
 
 int DeltaFilter::writeln(const char *value) {
-   int chars = matcher.match(value);
+   return writeSpan(value, strlen(value));
+}
 
-   if (chars) {
-	   _next.writeln("DELTAG0G1-goes-here");
-   } else {
-	   _next.writeln(value);
-   }
+int DeltaFilter::writeSpan(const char *text, size_t length) {
+   GBlock block(text, length);
+   return writeBlock(block);
+}
 
-   return 0;
+int DeltaFilter::writeBlock(GBlock &block) {
+   return writeBatch(&block, 1);
 }
 
+int DeltaFilter::writeBatch(GBlock *blocks, size_t count) {
+   for (size_t i = 0; i < count; i++) {
+	   transform(blocks[i]);
+   }
+
+   return _next.writeBatch(blocks, count);
+}
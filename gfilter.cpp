@@ -1,10 +1,16 @@
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 #include "FireLog.h"
 #include "gfilter.hpp"
+#include "jo_util.hpp"
 #include "version.h"
 #include "jansson.h"
 #include <string>
@@ -20,6 +26,34 @@ OStreamSink::writeln (const char *value) {
     return 0;
 };
 
+int
+OStreamSink::writeSpan (const char *text, size_t length) {
+    pos->write (text, length);
+    (*pos) << endl;
+    return 0;
+};
+
+int
+OStreamSink::writeBatch (GBlock *blocks, size_t count) {
+    char buf[255];
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i].modified) {
+            int n = blocks[i].format (buf, sizeof (buf));
+            pos->write (buf, n);
+        } else {
+            pos->write (blocks[i].text, blocks[i].length);
+        }
+        pos->put ('\n');
+    }
+    return 0;
+};
+
+int
+OStreamSink::flush (InputEvent event) {
+    pos->flush ();
+    return 0;
+};
+
 //////////////////// StringSink  ////////////////
 int
 StringSink::writeln (const char *value) {
@@ -27,10 +61,50 @@ StringSink::writeln (const char *value) {
     return 0;
 };
 
+int
+StringSink::writeSpan (const char *text, size_t length) {
+	strings.push_back(string(text, length));
+    return 0;
+};
+
+int
+StringSink::writeBatch (GBlock *blocks, size_t count) {
+    char buf[255];
+	strings.reserve(strings.size() + count);
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i].modified) {
+            int n = blocks[i].format (buf, sizeof (buf));
+            strings.push_back(string(buf, n));
+        } else {
+            strings.push_back(string(blocks[i].text, blocks[i].length));
+        }
+    }
+    return 0;
+};
+
 ////////////////// main ////////////////////////
-static OStreamSink osf (cout);
-static IGFilter * pHead = &osf;
+static BufferedSink bsf (1);
+static IGFilter * pHead = &bsf;
 static vector<IGFilterPtr> filters;
+static const char *inputPath = NULL;
+static bool threaded = false;
+static long chunkThreads = -1;	// --parallel THREADS
+static long jobThreads = -1;	// --jobs THREADS
+static const char *outputDir = NULL;
+static vector<string> inputPaths;
+static const char *daemonPath = NULL;	// --daemon SOCKET_PATH
+static const char *clientPath = NULL;	// --client SOCKET_PATH
+static long daemonClients = DAEMON_CLIENTS;
+static long daemonIdleMs = DAEMON_IDLE_MS;	// --idle-ms MS
+static GFilterDaemon *pDaemon = NULL;
+
+typedef struct FilterSpec {
+    const char *option;		// --point-offset, --axis-table or --delta
+    const char *configPath;	// or NULL
+    json_t *pConfig;		// parsed once for all chains
+    CalibrationModelPtr model;	// --point-offset calibration shared by all chains
+} FilterSpec;
+static vector<FilterSpec> filterSpecs;
 
 static void
 help () {
@@ -40,7 +114,145 @@ help () {
     cout << "https://github.com/firepick1/gfilter/wiki" << endl;
     cout << endl;
 	cout << "USAGE:" << endl;
-	cout << "gfilter --point-offset" << endl;
+	cout << "gfilter --point-offset [CONFIG_JSON]" << endl;
+	cout << "gfilter --axis-table CONFIG_JSON" << endl;
+	cout << "gfilter --bake-lattice CONFIG_JSON LATTICE_FILE" << endl;
+	cout << "gfilter --flush throughput|interactive|line --flush-ms MS --buffer BYTES" << endl;
+	cout << "gfilter --threads ...filters" << endl;
+	cout << "gfilter --parallel THREADS -i GCODE_FILE ...filters" << endl;
+	cout << "gfilter --jobs THREADS ...filters GCODE_FILE... -o OUTPUT_DIR" << endl;
+	cout << "gfilter --daemon SOCKET_PATH --clients CLIENTS --idle-ms MS ...filters" << endl;
+	cout << "gfilter --client SOCKET_PATH" << endl;
+	cout << "GCode is read from stdin or from the file given by -i GCODE_FILE" << endl;
+	cout << "Output is written when input is idle or after 50ms (--flush interactive)" << endl;
+}
+
+static json_t *
+loadConfig (const char *path) {
+    json_error_t jerr;
+    json_t *pConfig = json_load_file (path, 0, &jerr);
+    if (!pConfig) {
+        LOGERROR3 ("%s@%d %s", path, jerr.line, jerr.text);
+    }
+    return pConfig;
+}
+
+/**
+ * Bake the point mapping of the configuration into a lattice file.
+ * The configuration "lattice" object provides the resolution and quantum.
+ */
+static int
+bakeLattice (const char *configPath, const char *latticePath) {
+    json_t *pConfig = loadConfig (configPath);
+    if (!pConfig) {
+        return -EINVAL;
+    }
+    json_t *pLattice = json_object_get (pConfig, "lattice");
+    double resolution = jo_double (pLattice, "resolution", 1);
+    double quantum = jo_double (pLattice, "quantum", 0.001);
+    json_object_del (pConfig, "lattice");
+
+    StringSink sink;
+    MappedPointFilter pof (sink);
+    int rc = pof.configure (pConfig);
+    if (rc == 0) {
+        rc = pof.bakeLattice (resolution, quantum);
+    }
+    if (rc == 0) {
+        rc = pof.getLattice ().save (latticePath);
+    }
+    json_decref (pConfig);
+    return rc;
+}
+
+/**
+ * Create the filter of a command line option that writes to next
+ * @return NULL if the configuration is invalid
+ */
+static IGFilterPtr
+createFilter (const FilterSpec &spec, IGFilter &next) {
+    json_t *pConfig = spec.pConfig;
+    IGFilterPtr pFilter;
+    int rc = 0;
+    if (strcmp ("--point-offset", spec.option) == 0) {
+		LOGINFO("Create MappedPointFilter");
+        if (spec.model) {
+            pFilter = new MappedPointFilter (next, spec.model, pConfig);
+        } else {
+            MappedPointFilterPtr pXYZ = new MappedPointFilter (next);
+            rc = pConfig ? pXYZ->configure (pConfig) : 0;
+            pFilter = pXYZ;
+        }
+    } else if (strcmp ("--axis-table", spec.option) == 0) {
+		LOGINFO("Create AxisTableFilter");
+        AxisTableFilterPtr pAxis = new AxisTableFilter (next);
+        rc = pAxis->configure (pConfig);
+        pFilter = pAxis;
+    } else {
+		LOGINFO("Create DeltaFilter");
+        pFilter = new DeltaFilter (next);
+    }
+    if (rc) {
+        LOGERROR2 ("invalid %s configuration: '%s'", spec.option, spec.configPath);
+        delete pFilter;
+        return NULL;
+    }
+    return pFilter;
+}
+
+/**
+ * Filter chains of the command line options for each ChunkReader or BatchReader thread
+ */
+typedef class ArgsChainFactory:public IChainFactory {
+    public:
+        virtual IGFilter *createChain (IGFilter &next, vector<IGFilterPtr> &chain) {
+            IGFilter *pNext = &next;
+            for (size_t i = 0; i < filterSpecs.size (); i++) {
+                IGFilterPtr pFilter = createFilter (filterSpecs[i], *pNext);
+                if (!pFilter) {
+                    return NULL;
+                }
+                chain.push_back (pFilter);
+                pNext = pFilter;
+            }
+            return pNext;
+        }
+} ArgsChainFactory;
+
+/**
+ * With --threads, run the filter after the next filter and the sink on threads of their own
+ */
+static IGFilter &
+nextStage () {
+    if (threaded) {
+        ThreadStagePtr pStage = new ThreadStage (*pHead);
+        pHead = pStage;
+        filters.push_back (pStage);
+    }
+    return *pHead;
+}
+
+static bool
+addFilter (FilterSpec spec) {
+    spec.pConfig = NULL;
+    if (spec.configPath) {
+        spec.pConfig = loadConfig (spec.configPath);
+        if (!spec.pConfig) {
+            LOGERROR2 ("invalid %s configuration: '%s'", spec.option, spec.configPath);
+            return false;
+        }
+    }
+    IGFilterPtr pFilter = createFilter (spec, nextStage ());
+    if (!pFilter) {
+        return false;
+    }
+    if (strcmp ("--point-offset", spec.option) == 0) {
+        spec.model = ((MappedPointFilterPtr) pFilter)->getModel ();
+    }
+    pHead = pFilter;
+    filters.push_back (pFilter);
+    filterSpecs.push_back (spec);
+    return true;
 }
 
 static bool
@@ -51,22 +263,121 @@ parseArgs (int argc, char *argv[], int &jsonIndent) {
         return true;
     }
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp ("--threads", argv[i]) == 0) {
+            threaded = true;	// applies to filters given before it too
+        }
+    }
+
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == 0) {
             // empty argument
+        } else if (strcmp ("--threads", argv[i]) == 0) {
+            // see above
         } else if (strcmp ("-h", argv[i]) == 0 || strcmp ("--help", argv[i]) == 0) {
             help ();
             exit (0);
+        } else if (strcmp ("-i", argv[i]) == 0 || strcmp ("--input", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                LOGERROR ("expected -i GCODE_FILE");
+                return false;
+            }
+            inputPath = argv[++i];
+        } else if (strcmp ("--flush", argv[i]) == 0) {
+            const char *policy = i + 1 < argc ? argv[++i] : "";
+            if (strcmp ("throughput", policy) == 0) {
+                bsf.setPolicy (FLUSH_THROUGHPUT);
+            } else if (strcmp ("interactive", policy) == 0) {
+                bsf.setPolicy (FLUSH_INTERACTIVE);
+            } else if (strcmp ("line", policy) == 0) {
+                bsf.setPolicy (FLUSH_LINE);
+            } else {
+                LOGERROR1 ("expected --flush throughput|interactive|line: '%s'", policy);
+                return false;
+            }
+        } else if (strcmp ("--flush-ms", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) < 0) {
+                LOGERROR ("expected --flush-ms MS");
+                return false;
+            }
+            bsf.setLatency (atol (argv[++i]));
+        } else if (strcmp ("--buffer", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) <= 0) {
+                LOGERROR ("expected --buffer BYTES");
+                return false;
+            }
+            bsf.setBufferSize (atol (argv[++i]));
+        } else if (strcmp ("--parallel", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) < 0) {
+                LOGERROR ("expected --parallel THREADS");
+                return false;
+            }
+            chunkThreads = atol (argv[++i]);
+        } else if (strcmp ("--jobs", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) < 0) {
+                LOGERROR ("expected --jobs THREADS");
+                return false;
+            }
+            jobThreads = atol (argv[++i]);
+        } else if (strcmp ("--daemon", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                LOGERROR ("expected --daemon SOCKET_PATH");
+                return false;
+            }
+            daemonPath = argv[++i];
+        } else if (strcmp ("--clients", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) <= 0) {
+                LOGERROR ("expected --clients CLIENTS");
+                return false;
+            }
+            daemonClients = atol (argv[++i]);
+        } else if (strcmp ("--idle-ms", argv[i]) == 0) {
+            if (i + 1 >= argc || atol (argv[i+1]) < 0) {
+                LOGERROR ("expected --idle-ms MS");
+                return false;
+            }
+            daemonIdleMs = atol (argv[++i]);
+        } else if (strcmp ("--client", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                LOGERROR ("expected --client SOCKET_PATH");
+                return false;
+            }
+            clientPath = argv[++i];
+        } else if (strcmp ("-o", argv[i]) == 0 || strcmp ("--output", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                LOGERROR ("expected -o OUTPUT_DIR");
+                return false;
+            }
+            outputDir = argv[++i];
         } else if (strcmp ("--point-offset", argv[i]) == 0) {
-			LOGINFO("Create MappedPointFilter");
-            MappedPointFilterPtr pXYZ = new MappedPointFilter (*pHead);
-            pHead = pXYZ;
-            filters.push_back (pXYZ);
+            FilterSpec spec = { argv[i], NULL, NULL };
+            if (i + 1 < argc && argv[i+1][0] != '-') {
+                spec.configPath = argv[++i];
+            }
+            if (!addFilter (spec)) {
+                return false;
+            }
+        } else if (strcmp ("--axis-table", argv[i]) == 0) {
+            if (i + 1 >= argc) {
+                LOGERROR ("expected --axis-table CONFIG_JSON");
+                return false;
+            }
+            FilterSpec spec = { argv[i], argv[i+1], NULL };
+            i++;
+            if (!addFilter (spec)) {
+                return false;
+            }
+        } else if (strcmp ("--bake-lattice", argv[i]) == 0) {
+            if (i + 2 >= argc) {
+                LOGERROR ("expected --bake-lattice CONFIG_JSON LATTICE_FILE");
+                return false;
+            }
+            exit (bakeLattice (argv[i+1], argv[i+2]) ? -1 : 0);
         } else if (strcmp ("--delta", argv[i]) == 0) {
-			LOGINFO("Create DeltaFilter");
-            DeltaFilterPtr pDelta = new DeltaFilter (*pHead);
-            pHead = pDelta;
-            filters.push_back (pDelta);
+            FilterSpec spec = { argv[i], NULL, NULL };
+            if (!addFilter (spec)) {
+                return false;
+            }
         } else if (strcmp ("--warn", argv[i]) == 0) {
             firelog_level (FIRELOG_WARN);
         } else if (strcmp ("--error", argv[i]) == 0) {
@@ -77,14 +388,62 @@ parseArgs (int argc, char *argv[], int &jsonIndent) {
             firelog_level (FIRELOG_DEBUG);
         } else if (strcmp ("--trace", argv[i]) == 0) {
             firelog_level (FIRELOG_TRACE);
+        } else if (argv[i][0] != '-') {
+            inputPaths.push_back (argv[i]);
         } else {
             LOGERROR1 ("unknown gcode argument: '%s'", argv[i]);
             return false;
         }
     }
+    if (jobThreads >= 0 && (!outputDir || inputPaths.empty ())) {
+        LOGERROR ("expected --jobs THREADS GCODE_FILE... -o OUTPUT_DIR");
+        return false;
+    }
+    if (jobThreads < 0 && !inputPaths.empty ()) {
+        LOGERROR1 ("unknown gcode argument: '%s'", inputPaths[0].c_str ());
+        return false;
+    }
+    if (chunkThreads >= 0 && !inputPath) {
+        LOGERROR ("expected --parallel THREADS -i GCODE_FILE");
+        return false;
+    }
+    for (size_t i = 0; chunkThreads >= 0 && i < filterSpecs.size (); i++) {
+        if (filterSpecs[i].pConfig && json_object_get (filterSpecs[i].pConfig, "cache")) {
+            LOGERROR2 ("%s \"cache\" is not supported with --parallel: '%s'", 
+                filterSpecs[i].option, filterSpecs[i].configPath);
+            return false;
+        }
+    }
     return true;
 }
 
+static void
+stopDaemon (int signum) {
+    if (pDaemon) {
+        pDaemon->stop ();
+    }
+}
+
+/**
+ * Send the input to the daemon at clientPath and write its output to stdout
+ */
+static int
+runClient () {
+    int inFd = 0;
+    if (inputPath) {
+        inFd = open (inputPath, O_RDONLY);
+        if (inFd < 0) {
+            LOGERROR1 ("cannot read %s", inputPath);
+            return -errno;
+        }
+    }
+    int rc = daemonClient (clientPath, inFd, 1);
+    if (inputPath) {
+        close (inFd);
+    }
+    return rc;
+}
+
 int
 main (int argc, char *argv[]) {
     int jsonIndent = 2;
@@ -95,16 +454,52 @@ main (int argc, char *argv[]) {
         exit (-1);
     }
 
+    if (clientPath) {
+        return runClient () ? -1 : 0;	// output is only that of the daemon
+    }
+
     cout << pHead->name () << endl;
 
-    for (string line; getline (cin, line);) {
-        pHead->writeln (line.c_str ());
+    int rc;
+    if (daemonPath) {
+        ArgsChainFactory factory;
+        GFilterDaemon daemon (factory, daemonPath, daemonClients);
+        daemon.setSinkOptions (bsf);
+        daemon.setIdleTimeout (daemonIdleMs);
+        pDaemon = &daemon;
+        signal (SIGINT, stopDaemon);
+        signal (SIGTERM, stopDaemon);
+        rc = daemon.listen ();
+        rc = rc ? rc : daemon.serve ();
+        pDaemon = NULL;
+    } else if (jobThreads >= 0) {
+        vector<string> outputPaths;
+        for (size_t i = 0; i < inputPaths.size (); i++) {
+            size_t slash = inputPaths[i].find_last_of ('/');
+            string name = slash == string::npos ? inputPaths[i] : inputPaths[i].substr (slash + 1);
+            outputPaths.push_back (string (outputDir) + "/" + name);
+        }
+        ArgsChainFactory factory;
+        BatchReader reader (factory, jobThreads);
+        rc = reader.readFiles (inputPaths, outputPaths);
+    } else if (chunkThreads >= 0 && inputPath) {
+        ArgsChainFactory factory;
+        ChunkReader reader (factory, bsf, chunkThreads);
+        rc = reader.readFile (inputPath);
+    } else {
+        LineReader reader (*pHead);
+        rc = inputPath ? reader.readFile (inputPath) : reader.readFd (0);
     }
 
-    for (int i = 0; i < filters.size (); i++) {
+    for (int i = filters.size (); i-- > 0;) {
         delete
         filters[i];
     }
+    for (size_t i = 0; i < filterSpecs.size (); i++) {
+        if (filterSpecs[i].pConfig) {
+            json_decref (filterSpecs[i].pConfig);
+        }
+    }
 
-    return 0;
+    return rc ? -1 : 0;
 }
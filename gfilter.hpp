@@ -5,9 +5,11 @@
 #include <vector>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <math.h>
 #include "FireUtils.hpp"
 #include "jansson.h"
+#include "simd.hpp"
 
 using namespace std;
 
@@ -115,6 +117,7 @@ typedef struct GCoord {
 		if (-limit < z && z < limit) {
 			z = 0;
 		}
+		return *this;
 	}
     inline bool friend operator<(const GCoord& lhs, const GCoord &rhs) {
         int cmp = lhs.norm2 - rhs.norm2;
@@ -162,6 +165,355 @@ typedef struct MappedPoint {
 	}
 } MappedPoint, *MappedPointPtr;
 
+typedef struct KdHit {
+    int index;		// ordinal of point in PointStore
+    double dist2;	// square of distance to query point
+    inline bool friend operator<(const KdHit& lhs, const KdHit &rhs) {
+        return lhs.dist2 < rhs.dist2 || (lhs.dist2 == rhs.dist2 && lhs.index < rhs.index);
+    }
+} KdHit;
+
+typedef enum PointPrecision {
+    PRECISION_DOUBLE,	// 48 bytes per point
+    PRECISION_FLOAT,	// 24 bytes per point
+} PointPrecision;
+
+/**
+ * Contiguous store of mapped point coordinates with separate arrays for
+ * each domain and range axis, so that searches stream through memory.
+ * Coordinates are kept in double or float precision.
+ */
+typedef class PointStore {
+    private:
+        PointPrecision precision;
+        size_t count;
+        vector<double> doubles[6];	// domain x,y,z then range x,y,z
+        vector<float> floats[6];
+        void distances(const GCoord &c, int base, int count, double *dist2) const;
+
+    public:
+        PointStore();
+        void build(const map<GCoord, MappedPoint> &mapping);
+        void clear();
+        inline size_t size() const {
+            return count;
+        }
+        inline PointPrecision getPrecision() const {
+            return precision;
+        }
+
+        /**
+         * Convert the points to value precision, which is also used by
+         * the next build(). Points converted to float keep float precision
+         * when converted back.
+         */
+        void setPrecision(PointPrecision value);
+
+        /**
+         * Return coordinate of point i, where axis 0-2 are domain x,y,z
+         * and axis 3-5 are range x,y,z
+         */
+        inline double coord(int axis, int i) const {
+            return precision == PRECISION_FLOAT ? floats[axis][i] : doubles[axis][i];
+        }
+        inline double distance2(int i, const GCoord &c) const {
+            double dx = coord(0, i) - c.x;
+            double dy = coord(1, i) - c.y;
+            double dz = coord(2, i) - c.z;
+            return dx*dx + dy*dy + dz*dz;
+        }
+        inline GCoord domain(int i) const {
+            return GCoord(coord(0, i), coord(1, i), coord(2, i));
+        }
+        inline GCoord range(int i) const {
+            return GCoord(coord(3, i), coord(4, i), coord(5, i));
+        }
+        inline MappedPoint at(int i) const {
+            MappedPoint point;
+            point.domain = domain(i);
+            point.range = range(i);
+            return point;
+        }
+        vector<MappedPoint> points() const;
+
+        /**
+         * Scan for the k nearest points closer than sqrt(maxDist2)
+         * @return number of hits stored in ascending order of distance
+         */
+        int nearest(const GCoord &c, int k, double maxDist2, KdHit *hits) const;
+
+        /**
+         * Scan for all points closer than sqrt(maxDist2) in ascending order of distance
+         */
+        void radius(const GCoord &c, double maxDist2, vector<KdHit> &hits) const;
+
+        size_t bytes() const;
+
+        /**
+         * Return the approximate memory used by a map of count mapped points
+         */
+        static size_t mapBytes(size_t count);
+} PointStore;
+
+/**
+ * Balanced 3-d tree of point coordinates for nearest neighbor
+ * and radius queries. Hits are ordered by distance, with ties broken
+ * by point ordinal so that results are repeatable.
+ */
+typedef class KdTree {
+    private:
+        const PointStore *pStore;	// point coordinates by ordinal
+        vector<int> nodes;		// point ordinals in implicit tree order
+        vector<char> axes;		// split axis of each node
+        void build(int lo, int hi);
+        void nearest(int lo, int hi, const GCoord &c, int k, double maxDist2, KdHit *hits, int &n) const;
+        void radius(int lo, int hi, const GCoord &c, double maxDist2, vector<KdHit> &hits) const;
+
+    public:
+        KdTree();
+
+        /**
+         * Index the domain coordinates of store, which must outlive the tree
+         */
+        void build(const PointStore &store);
+        void clear();
+        inline size_t size() const {
+            return nodes.size();
+        }
+
+        /**
+         * Find the k nearest points closer than sqrt(maxDist2)
+         * @return number of hits stored in ascending order of distance
+         */
+        int nearest(const GCoord &c, int k, double maxDist2, KdHit *hits) const;
+
+        /**
+         * Find all points closer than sqrt(maxDist2) in ascending order of distance
+         */
+        void radius(const GCoord &c, double maxDist2, vector<KdHit> &hits) const;
+} KdTree;
+
+typedef struct DelaunayTet {
+    int v[4];			// vertex ordinals
+    int n[4];			// neighbor opposite each vertex or -1 on convex hull
+    double bary[3][4];	// domain => first three barycentric coordinates
+    double affine[3][4];	// domain => range
+} DelaunayTet;
+
+/**
+ * Delaunay tetrahedralization of mapped domain points. Each tetrahedron
+ * stores its domain to range affine transform, so interpolation is
+ * point location followed by one 3x4 matrix product.
+ */
+typedef class DelaunayMesh {
+    private:
+        vector<DelaunayTet> tets;
+        vector<int> vertexTets;	// a tetrahedron incident to each vertex or -1
+
+    public:
+        /**
+         * Tetrahedralize the domain of points
+         * @return number of tetrahedra
+         */
+        int build(const vector<MappedPoint> &points);
+        inline size_t size() const {
+            return tets.size();
+        }
+        inline const DelaunayTet &at(int tet) const {
+            return tets[tet];
+        }
+        inline int vertexTet(int vertex) const {
+            return vertex >= 0 && vertex < vertexTets.size() ? vertexTets[vertex] : -1;
+        }
+
+        /**
+         * Walk from the hint tetrahedron to the one containing domain. A domain
+         * shared by several tetrahedra gets the lowest index of them, whatever the hint.
+         * @return tetrahedron index or -1 if domain is outside the convex hull
+         */
+        int locate(const GCoord &domain, int hint=-1) const;
+
+        /**
+         * Apply the affine transform of a tetrahedron to domain
+         */
+        GCoord map(int tet, const GCoord &domain) const;
+} DelaunayMesh;
+
+typedef struct LayerTriangle {
+    int v[3];			// vertex index in MeshLayer ordinals
+    int n[3];			// neighbor opposite each vertex or -1 on convex hull
+    double bary[2][3];	// domain xy => first two barycentric coordinates
+    double affine[3][3];	// domain xy => range
+} LayerTriangle;
+
+typedef struct MeshLayer {
+    double z;					// domain z of all layer points
+    vector<int> ordinals;		// mapped point ordinals of layer vertices
+    vector<LayerTriangle> triangles;
+} MeshLayer;
+
+/**
+ * Mapped points that lie on a few planes of constant domain z are
+ * triangulated per plane. Interpolation locates xy in the two planes
+ * that bracket z and blends their affine transforms linearly in z.
+ */
+typedef class LayeredMesh {
+    private:
+        vector<MeshLayer> layers;
+
+    public:
+        /**
+         * Triangulate each plane of points
+         * @return number of planes or 0 if points are not on 2..maxLayers planes
+         */
+        int build(const vector<MappedPoint> &points, int maxLayers=16);
+        inline size_t size() const {
+            return layers.size();
+        }
+        inline const MeshLayer &at(int layer) const {
+            return layers[layer];
+        }
+
+        /**
+         * Walk from the hint triangle to the one containing domain xy. A domain
+         * shared by several triangles gets the lowest index of them, whatever the hint.
+         * @return triangle index or -1 if outside the convex hull of the layer
+         */
+        int locate(int layer, const GCoord &domain, int hint=-1) const;
+
+        /**
+         * Interpolate range of domain, updating the triangle hint of each layer used.
+         * Beyond the outer layers, the correction of the nearest one holds.
+         * @return FALSE if domain is outside a bracketing layer
+         */
+        bool interpolate(const GCoord &domain, GCoord &range, int *hints) const;
+} LayeredMesh;
+
+#define LATTICE_MAGIC "GFLT"
+#define LATTICE_VERSION 1
+
+/**
+ * Header of a baked correction lattice file, followed by
+ * nx*ny*nz*3 native int16 range offsets in x-fastest order
+ */
+typedef struct LatticeHeader {
+    char magic[4];		// LATTICE_MAGIC
+    int version;		// LATTICE_VERSION
+    int nx, ny, nz;		// nodes per axis
+    int reserved;
+    double origin[3];	// domain of node (0,0,0)
+    double spacing[3];	// domain distance between nodes
+    double quantum;		// range offset per count
+    double bias[3];		// range offset at zero count
+} LatticeHeader;
+
+class MappedPointFilter;
+
+/**
+ * Regular grid of quantized range offsets (range-domain) over a domain box
+ * with constant time trilinear lookup. Lattices can be saved to a file
+ * that is memory mapped on load.
+ */
+typedef class CorrectionLattice {
+    private:
+        LatticeHeader header;
+        vector<short> cells;	// baked offsets
+        const short *data;		// baked offsets or mapped file data
+        void *pMap;
+        size_t mapLength;
+        double invSpacing[3];
+        void unload();
+        CorrectionLattice& operator=(const CorrectionLattice &that);
+
+    public:
+        CorrectionLattice();
+
+        /**
+         * Copy the offsets of that, including those of a mapped file
+         */
+        CorrectionLattice(const CorrectionLattice &that);
+        ~CorrectionLattice();
+
+        /**
+         * Sample source interpolation on nodes spaced resolution apart
+         * over the box from domainMin to domainMax
+         * @param quantum range offset per count, enlarged as needed to fit int16
+         */
+        int bake(MappedPointFilter &source, GCoord domainMin, GCoord domainMax, 
+                 double resolution, double quantum=0.001);
+        int save(const char *path) const;
+        int load(const char *path);
+        inline bool isValid() const {
+            return data != NULL;
+        }
+        inline const LatticeHeader &getHeader() const {
+            return header;
+        }
+        size_t bytes() const;
+
+        /**
+         * Interpolate range of domain
+         * @return FALSE if domain is outside the lattice
+         */
+        bool interpolate(const GCoord &domain, GCoord &range) const;
+} CorrectionLattice;
+
+typedef struct OctreeNode {
+    int child;	// index of first of eight children or -1 for leaf
+    int values;	// index of leaf corner offsets or -1
+} OctreeNode;
+
+/**
+ * Adaptive octree of range offsets (range-domain) over a domain box.
+ * Leaves store the offsets of their eight corners for trilinear
+ * interpolation and are split where that interpolation misses the
+ * source interpolation by more than a tolerance.
+ */
+typedef class CorrectionOctree {
+    private:
+        GCoord boxMin;
+        GCoord boxMax;
+        vector<OctreeNode> nodes;
+        vector<float> values;	// 8 corners x 3 axes per leaf
+        int depth;
+        double maxError;
+
+    public:
+        CorrectionOctree();
+
+        /**
+         * Refine cells with the largest error first until every cell interpolates
+         * source within tolerance or the next split would exceed the byte budget
+         * @param maxDepth limit on cell subdivision
+         */
+        int build(MappedPointFilter &source, GCoord domainMin, GCoord domainMax,
+                  double tolerance, size_t budget, int maxDepth=12);
+        void clear();
+        inline bool isValid() const {
+            return nodes.size() > 0;
+        }
+        inline size_t nodeCount() const {
+            return nodes.size();
+        }
+        size_t leafCount() const;
+        inline int getDepth() const {
+            return depth;
+        }
+        /**
+         * Return the largest sampled interpolation error of any leaf
+         */
+        inline double getMaxError() const {
+            return maxError;
+        }
+        size_t bytes() const;
+
+        /**
+         * Interpolate range of domain
+         * @return FALSE if domain is outside the octree
+         */
+        bool interpolate(const GCoord &domain, GCoord &range) const;
+} CorrectionOctree;
+
 typedef class IGCodeMatcher {
     public:
         /**
@@ -169,24 +521,219 @@ typedef class IGCodeMatcher {
          * be parsed as a number
          */
         static int matchNumber (const char *text);
+        static int matchNumber (const char *text, size_t length);
+
+        /**
+         * Parse the signed decimal number with optional leading blanks at the start
+         * of the length chars at text in one pass. The result is exactly
+         * rounded and does not depend on the locale.
+         * @return chars parsed or zero if there is no number
+         */
+        static int parseNumber (const char *text, size_t length, double &value);
 
         /**
          * Return the length of the longest text prefix that matches
          * whatever the implementation class is looking for
          */
         virtual int match(const char *text) = 0;
+
+        /**
+         * Return the length of the longest matching prefix of the
+         * length chars at text, which need not be NUL terminated
+         */
+        virtual int match(const char *text, size_t length) = 0;
 } IGCodeMatcher;
 
+typedef enum CoordNotation {
+    NOTATION_GENERAL,	// printf("%g") with 6 significant digits
+    NOTATION_SHORTEST,	// fewest digits that read back as the same double
+    NOTATION_FIXED,		// round to digits decimals, without trailing zeros
+} CoordNotation;
+
+#define COORD_CHARS 40 /* longest formatted coordinate */
+#define COORD_TRUNC_PLACES 5 /* GCoord::trunc() places of NOTATION_SHORTEST */
+
+/**
+ * Locale independent number formatting for output coordinates
+ */
+typedef struct CoordFormat {
+    CoordNotation notation;
+    int digits;	// significant digits of NOTATION_GENERAL or decimals of NOTATION_FIXED
+
+    inline CoordFormat(CoordNotation notation=NOTATION_GENERAL, int digits=6)
+        : notation(notation), digits(digits) {
+    }
+
+    /**
+     * Set format from "general", "shortest" or "fixedN" (e.g., "fixed3")
+     * @return 0 or -EINVAL
+     */
+    int parse(const char *spec);
+
+    /**
+     * Write value to buf, which must hold COORD_CHARS chars.
+     * No NUL is written. General notation keeps "-0" as %g does,
+     * while shortest and fixed notation write it as "0".
+     * @return length of text written
+     */
+    int write(char *buf, double value) const;
+} CoordFormat;
+
+/**
+ * Inline buffer for a short GCode word such as "G1" or "g28"
+ */
+typedef struct GCodeWord {
+    char text[8];
+    size_t length;
+    inline GCodeWord() : length(0) {
+        text[0] = 0;
+    }
+    inline void clear() {
+        length = 0;
+        text[0] = 0;
+    }
+    inline bool empty() const {
+        return length == 0;
+    }
+    inline size_t size() const {
+        return length;
+    }
+    inline void append(const char *s, size_t n) {
+        for (; n > 0 && length < sizeof(text)-1; n--) {
+            text[length++] = *s++;
+        }
+        text[length] = 0;
+    }
+    inline const char *c_str() const {
+        return text;
+    }
+    inline bool operator==(const char *s) const {
+        return strcmp(text, s) == 0;
+    }
+} GCodeWord;
+
 typedef class GMoveMatcher:public IGCodeMatcher {
     public:
-        string code;
+        GCodeWord code;
         GCoord coord;
         virtual int match(const char *text);
+        virtual int match(const char *text, size_t length);
+
+        /**
+         * Return the modal position after the last matched move
+         * @param position before the move
+         */
+        inline GCoord position(GCoord position) const {
+            if (coord.x != HUGE_VAL) {
+                position.x = coord.x;
+            }
+            if (coord.y != HUGE_VAL) {
+                position.y = coord.y;
+            }
+            if (coord.z != HUGE_VAL) {
+                position.z = coord.z;
+            }
+            return position;
+        }
+
+        /**
+         * Write the last matched move to buf with the given position
+         * followed by restLength chars of rest of line. G28 always moves to the origin.
+         * @return length of text written
+         */
+        int format(char *buf, size_t bufSize, GCoord position, const char *rest, size_t restLength) const;
+
+        /**
+         * Coordinate formats of X, Y and Z for format()
+         */
+        CoordFormat formats[3];
+
+        /**
+         * Configure formats from a format string for all axes
+         * or from a {"x":FORMAT,"y":FORMAT,"z":FORMAT} object
+         * @return 0 or -EINVAL
+         */
+        int configureFormat(json_t *pFormat);
 } GMoveMatcher;
 
+#define GBLOCK_WORDS 16 /* words kept per GBlock */
+
+typedef struct GWord {
+    char letter;	// upper case
+    double value;
+} GWord;
+
+/**
+ * GCode line parsed once at the head of the filter chain. Filters read and
+ * change the block, and sinks write the original text unless a filter
+ * has modified the block.
+ */
+typedef class GBlock {
+    public:
+        const char *text;		// line without newline, not NUL terminated
+        size_t length;
+        GMoveMatcher move;		// G0, G1 or G28 move at the start of the line
+        size_t moveLength;		// chars of text matched by move, or zero
+        GWord words[GBLOCK_WORDS];	// words before the first ';' comment
+        int wordCount;
+        const char *comment;	// first ';' or '(' comment, or NULL
+        size_t commentLength;
+        GCoord position;		// position written for a modified move
+        bool modified;
+
+        inline GBlock () : text (""), length (0), moveLength (0), wordCount (0),
+            comment (NULL), commentLength (0), modified (FALSE) {
+        }
+        inline GBlock (const char *text, size_t length) {
+            parse (text, length);
+        }
+
+        /**
+         * Parse the length chars at text, which must outlive the block
+         */
+        void parse (const char *text, size_t length);
+
+        inline bool isMove () const {
+            return moveLength > 0;
+        }
+
+        /**
+         * Point the block at a copy of its text
+         */
+        inline void rebase (const char *copy) {
+            if (comment) {
+                comment = copy + (comment - text);
+            }
+            text = copy;
+        }
+
+        /**
+         * Return the word with the given upper case letter, or NULL
+         */
+        const GWord *word (char letter) const;
+
+        /**
+         * Move to position instead, written with the given axis formats.
+         * G28 always moves to the origin.
+         */
+        void moveTo (GCoord position, const CoordFormat *formats);
+
+        /**
+         * Write the text of the block to buf
+         * @return length of text written
+         */
+        int format (char *buf, size_t bufSize) const;
+} GBlock;
+
+typedef enum InputEvent {
+    INPUT_IDLE,	// no more input is available yet
+    INPUT_END,	// all input has been written
+} InputEvent;
+
 typedef class IGFilter {
     protected:
         const char *_name;
+        string _span;	// NUL terminated copy for writeSpan()
 
     public:
         const char *name () {
@@ -194,8 +741,48 @@ typedef class IGFilter {
         };
         IGFilter ():_name ("IGFilter") {
         };
+        virtual ~IGFilter () {
+        };
 
         virtual int writeln (const char *value) = 0;
+
+        /**
+         * Write the line of length chars at text, which need not be NUL terminated.
+         * Filters that override writeSpan() pass unchanged lines on by reference.
+         * By default, writeln() is given a NUL terminated copy.
+         */
+        virtual int writeSpan (const char *text, size_t length) {
+            _span.assign (text, length);
+            return writeln (_span.c_str ());
+        };
+
+        /**
+         * Write a parsed line. Filters that override writeBlock() change the
+         * block and pass it on. By default, writeSpan() is given the text of the block.
+         */
+        virtual int writeBlock (GBlock &block);
+
+        /**
+         * Write count parsed lines in order. Filters that override writeBatch()
+         * keep their state in locals for the whole batch and pass it on as one batch.
+         * By default, writeBlock() is called for each block.
+         */
+        virtual int writeBatch (GBlock *blocks, size_t count);
+
+        /**
+         * Tell the chain that input is idle or has ended, so that
+         * buffered output can be written
+         */
+        virtual int flush (InputEvent event=INPUT_END) {
+            return 0;
+        };
+
+        /**
+         * Forget the modal state of the lines written so far,
+         * so that the next line starts a new stream
+         */
+        virtual void reset () {
+        };
 } IGFilter, *IGFilterPtr;
 
 typedef class GFilterBase:public IGFilter {
@@ -210,6 +797,12 @@ typedef class GFilterBase:public IGFilter {
             _next.writeln (value);
             return 0;
         };
+        virtual int flush (InputEvent event=INPUT_END) {
+            return _next.flush (event);
+        };
+        virtual void reset () {
+            _next.reset ();
+        };
 } GFilterBase;
 
 /**
@@ -222,6 +815,8 @@ typedef class StringSink:public GCodeSink {
     public:
         vector<string> strings;
         virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBatch (GBlock *blocks, size_t count);
 		string operator[](int index){ return strings[index]; }
 } StringSink;
 
@@ -238,36 +833,808 @@ typedef class OStreamSink:public GCodeSink {
         };
 
         virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+        virtual int flush (InputEvent event=INPUT_END);
 } OStreamSink;
 
-typedef class DeltaFilter:public GFilterBase {
+typedef enum FlushPolicy {
+    FLUSH_THROUGHPUT,	// write when the buffer is full or input ends
+    FLUSH_INTERACTIVE,	// also write when input is idle or output is older than latency
+    FLUSH_LINE,			// write every line
+} FlushPolicy;
+
+/**
+ * Sink that buffers lines for a file descriptor and writes them in large blocks
+ */
+typedef class BufferedSink:public GCodeSink {
     private:
-        GMoveMatcher matcher;
+        int fd;
+        vector<char> buffer;
+        size_t used;
+        FlushPolicy policy;
+        long latencyMs;
+        double firstTime;	// when the oldest buffered line was written, in ms
+        double firstWrite;	// when output was first written to fd, in ms
+        long writes;
+        int sendFlags;
+        int writeAll (const char *text, size_t length, const char *text2=NULL, size_t length2=0);
+        int append (const char *text, size_t length);
+        int applyPolicy ();
 
+    public:
+        BufferedSink (int fd, size_t bufferSize=1<<16, FlushPolicy policy=FLUSH_INTERACTIVE);
+        ~BufferedSink ();
+        virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+        virtual int flush (InputEvent event=INPUT_END);
+        void setBufferSize (size_t bytes);
+
+        /**
+         * Write buffered output and write to fd from now on
+         */
+        int setFd (int fd);
+        inline size_t getBufferSize () const {
+            return buffer.size ();
+        }
+        inline void setPolicy (FlushPolicy value) {
+            policy = value;
+        }
+        inline FlushPolicy getPolicy () const {
+            return policy;
+        }
+
+        /**
+         * Interactive output is written when its oldest line is older than ms
+         */
+        inline void setLatency (long ms) {
+            latencyMs = ms;
+        }
+        inline long getLatency () const {
+            return latencyMs;
+        }
+
+        /**
+         * Write to a socket fd with sendmsg() and flags such as MSG_NOSIGNAL,
+         * or with writev() for 0
+         */
+        inline void setSendFlags (int flags) {
+            sendFlags = flags;
+        }
+
+        /**
+         * Return the number of write system calls
+         */
+        inline long getWrites () const {
+            return writes;
+        }
+
+        /**
+         * Return when output was first written to fd since setFd(), in
+         * CLOCK_MONOTONIC ms, or 0 if nothing was written
+         */
+        inline double getFirstWrite () const {
+            return firstWrite;
+        }
+} BufferedSink;
+
+/**
+ * Splits input into lines for a filter chain. Each line is given to
+ * writeSpan() without its newline, as getline() would return it.
+ */
+#define LINE_BATCH 4096 /* lines per writeBatch() of LineReader */
+
+typedef class LineReader {
+    private:
+        IGFilter &filter;
+        size_t blockSize;
+        long lines;
+        vector<GBlock> batch;
+        int writeLines(const char *text, size_t length, bool final, size_t &consumed);
+
+    public:
+        LineReader (IGFilter &filter, size_t blockSize=1<<20);
+
+        /**
+         * Memory map the file at path and write its lines straight from the mapped pages
+         * @return 0, -errno or the first error of the filter
+         */
+        int readFile (const char *path);
+
+        /**
+         * read() fd to its end in blocks and write their lines, stopping at
+         * the first error of the filter
+         * @return 0, -errno or the first error of the filter
+         */
+        int readFd (int fd);
+
+        /**
+         * Write the lines of length chars at text without flushing.
+         * The last line need not end with a newline.
+         */
+        int readText (const char *text, size_t length);
+        inline long getLines () const {
+            return lines;
+        }
+} LineReader;
+
+typedef struct StageStats {
+    long batches;		// batches queued
+    long lines;			// lines queued
+    long fullWaits;		// batches that waited for a free slot
+    long emptyWaits;	// batches the stage thread waited for
+    size_t maxDepth;	// most batches queued at once
+    double depthSum;	// batches queued, summed over batches
+    inline StageStats() : batches(0), lines(0), fullWaits(0), emptyWaits(0), maxDepth(0), depthSum(0) {
+    }
+    inline double meanDepth() const {
+        return batches ? depthSum / batches : 0;
+    }
+} StageStats;
+
+struct StageRing;
+
+/**
+ * Passes batches to the next filter on a thread of its own through a bounded
+ * single producer, single consumer ring. Lines keep their order and the
+ * writer waits while the ring is full. Line text is copied, so callers may
+ * reuse it after writeBatch() returns. flush(INPUT_END) returns after the
+ * next filter has written every queued line.
+ */
+typedef class ThreadStage:public GFilterBase {
+    private:
+        StageRing *pRing;
+        StageStats stats;
+        int push(GBlock *blocks, size_t count, int event);
+
+    public:
+        ThreadStage (IGFilter & next, size_t slots=8);
+        ~ThreadStage ();
+        virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBlock (GBlock &block);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+        virtual int flush (InputEvent event=INPUT_END);
+        virtual void reset ();
+
+        /**
+         * Return queue statistics, which are current after flush(INPUT_END)
+         */
+        const StageStats &getStats ();
+} ThreadStage, *ThreadStagePtr;
+
+/**
+ * Builds the filter chain of each ChunkReader thread
+ */
+typedef class IChainFactory {
+    public:
+        virtual ~IChainFactory () {
+        };
+
+        /**
+         * Create a filter chain that writes to next
+         * @param filters receives the filters created, for the caller to delete
+         * @return head of the chain or NULL if it could not be configured
+         */
+        virtual IGFilter *createChain (IGFilter &next, vector<IGFilterPtr> &filters) = 0;
+} IChainFactory;
+
+#define CHUNK_BYTES (1<<22) /* text per ChunkReader chunk */
+
+/**
+ * Filters one large file on several threads. The text is split into chunks at
+ * line boundaries and each thread filters whole chunks with a chain of its own.
+ * A first pass scans each chunk backwards for its last move words, which gives
+ * the modal position at the start of every chunk. Before a chunk is filtered,
+ * the chain is reset() and given a move to that position, whose output is discarded,
+ * so the chain is in the same state as after the lines before the chunk. Chunk
+ * output is written to the sink in order and matches a single chain byte for byte
+ * as long as filter output only depends on the modal position. Mesh interpolation
+ * qualifies, since point location does not depend on the previous move, but the
+ * "cache" of MappedPointFilter does not, because it answers from nearby earlier
+ * moves. gfilter therefore rejects "cache" with --parallel.
+ */
+typedef class ChunkReader {
+    private:
+        IChainFactory &factory;
+        IGFilter &sink;
+        size_t threads;
+        size_t chunkBytes;
+        long lines;
+
+    public:
+        /**
+         * @param threads zero for one per processor
+         */
+        ChunkReader (IChainFactory &factory, IGFilter &sink, size_t threads=0, size_t chunkBytes=CHUNK_BYTES);
+
+        /**
+         * Memory map the file at path and filter it in chunks
+         * @return 0 or -errno
+         */
+        int readFile (const char *path);
+
+        /**
+         * Filter length chars of text in chunks without flushing the sink
+         */
+        int readText (const char *text, size_t length);
+        inline size_t getThreads () const {
+            return threads;
+        }
+        inline long getLines () const {
+            return lines;
+        }
+} ChunkReader;
+
+/**
+ * Filters many files on a pool of threads. Each thread has a chain of its own,
+ * created before any file is read, that is reset() between files. Files are
+ * dealt to the threads in turn and a thread that runs out of files takes the
+ * last file of another thread.
+ */
+typedef class BatchReader {
+    private:
+        IChainFactory &factory;
+        size_t threads;
+        long files;
+        long steals;
+
+    public:
+        /**
+         * @param threads zero for one per processor
+         */
+        BatchReader (IChainFactory &factory, size_t threads=0);
+
+        /**
+         * Filter each input file into the output file of the same index.
+         * An output file is only replaced once its input has been filtered.
+         * @return 0, -EINVAL if an output is an input or repeats another output, or the first error
+         */
+        int readFiles (const vector<string> &inputs, const vector<string> &outputs);
+        inline size_t getThreads () const {
+            return threads;
+        }
+        inline long getFiles () const {
+            return files;
+        }
+
+        /**
+         * Return how many files were taken from other threads
+         */
+        inline long getSteals () const {
+            return steals;
+        }
+} BatchReader;
+
+#define DAEMON_CLIENTS 8 /* jobs a GFilterDaemon serves at once */
+#define DAEMON_IDLE_MS 30000 /* ms a GFilterDaemon job may wait to read or write */
+#define DAEMON_STATUS "rc:" /* follows the NUL that ends the output of a job */
+
+typedef struct DaemonStats {
+    long jobs;
+    long errors;		// jobs that failed
+    long lines;
+    long latencyJobs;	// jobs that wrote output
+    double latencySum;	// ms from the first byte in to the first byte out, summed over latencyJobs
+    double latencyMax;
+    inline DaemonStats() : jobs(0), errors(0), lines(0), latencyJobs(0), latencySum(0), latencyMax(0) {
+    }
+    inline double meanLatency() const {
+        return latencyJobs ? latencySum / latencyJobs : 0;
+    }
+} DaemonStats;
+
+struct DaemonState;
+
+/**
+ * Filters jobs sent to a Unix domain socket. Each connection is one job: the
+ * client writes GCode and shuts down its side of the socket for writing, and
+ * the filtered GCode is written back while it is filtered, as it would be by
+ * an interactive BufferedSink. The output ends with a NUL and the status of
+ * the job, DAEMON_STATUS followed by 0 or -errno and a newline. A job fails
+ * when it waits longer than the idle timeout to read input or to write
+ * output. Each of the client threads has a chain of its
+ * own, created before any job is accepted and reset() between jobs, so
+ * configurations are loaded and indexed once for all jobs.
+ */
+typedef class GFilterDaemon {
+    private:
+        IChainFactory &factory;
+        string path;
+        size_t clients;
+        int listenFd;
+        DaemonState *pState;
+        size_t bufferSize;
+        FlushPolicy policy;
+        long latencyMs;
+        long idleMs;
+
+    public:
+        /**
+         * @param clients jobs served at once
+         */
+        GFilterDaemon (IChainFactory &factory, const char *path, size_t clients=DAEMON_CLIENTS);
+        ~GFilterDaemon ();
+
+        /**
+         * Bind the socket, replacing a socket left at path by an earlier daemon
+         * that no longer accepts connections
+         * @return 0, -EADDRINUSE if path is not such a socket, or -errno
+         */
+        int listen ();
+
+        /**
+         * Serve jobs until stop()
+         * @return 0 or -errno
+         */
+        int serve ();
+
+        /**
+         * Stop accepting jobs and shut down the connections of current jobs,
+         * which fail. serve() returns once their client threads are done.
+         * Can be called from a signal handler.
+         */
+        void stop ();
+        DaemonStats getStats ();
+
+        /**
+         * Write job output with the buffer size, flush policy and latency of
+         * options instead of those of an interactive BufferedSink
+         */
+        inline void setSinkOptions (const BufferedSink &options) {
+            bufferSize = options.getBufferSize ();
+            policy = options.getPolicy ();
+            latencyMs = options.getLatency ();
+        }
+
+        /**
+         * Fail jobs that wait longer than ms to read or write, or never for 0.
+         * Takes effect at the next serve().
+         */
+        inline void setIdleTimeout (long ms) {
+            idleMs = ms;
+        }
+        inline long getIdleTimeout () const {
+            return idleMs;
+        }
+} GFilterDaemon;
+
+/**
+ * Send the GCode read from inFd to the GFilterDaemon at path and write the
+ * filtered GCode to outFd
+ * @return 0, -errno, or the status of a job that failed
+ */
+int daemonClient (const char *path, int inFd, int outFd);
+
+typedef class DeltaFilter:public GFilterBase {
     public:
         DeltaFilter (IGFilter & next);
         virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBlock (GBlock &block);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+
+        /**
+         * Replace the move of block without passing it on
+         */
+        inline void transform(GBlock &block) {
+            if (block.isMove()) {
+                block.parse("DELTAG0G1-goes-here", 19);
+            }
+        }
 } DeltaFilter, *DeltaFilterPtr;
 
+/**
+ * Piecewise linear table of offsets by position along one axis,
+ * with constant offsets beyond the end positions
+ */
+typedef class AxisTable {
+    private:
+        vector<double> positions;
+        vector<double> offsets;
+        vector<int> buckets;	// first segment of each bucket
+        double bucketScale;		// buckets per unit position
+        bool uniform;
+
+    public:
+        AxisTable();
+        int configure(const vector<float> &positions, const vector<float> &offsets);
+        inline size_t size() const {
+            return positions.size();
+        }
+
+        /**
+         * Return the offset at position in constant time
+         */
+        inline double offset(double position) const {
+            int n = positions.size();
+            if (n == 0) {
+                return 0;
+            }
+            if (position <= positions[0]) {
+                return offsets[0];
+            }
+            if (position >= positions[n-1]) {
+                return offsets[n-1];
+            }
+            double f = (position - positions[0]) * bucketScale;
+            int i = (int) f;
+            if (uniform) {
+                i = i < n-2 ? i : n-2;
+                f = f < n-1 ? f : n-1;
+                return offsets[i] + (f - i) * (offsets[i+1] - offsets[i]);
+            }
+            for (i = buckets[i]; positions[i+1] < position; i++) {
+            }
+            double t = (position - positions[i]) / (positions[i+1] - positions[i]);
+            return offsets[i] + t * (offsets[i+1] - offsets[i]);
+        }
+} AxisTable;
+
+/**
+ * Independent per-axis error compensation, e.g., for leadscrew pitch error
+ */
+typedef class AxisTableFilter:public GFilterBase {
+    private:
+		GCoord domain;	// current input domain position 
+        GMoveMatcher matcher;
+        AxisTable tables[3];
+
+    public:
+        AxisTableFilter (IGFilter & next, json_t* config=NULL);
+		int configure(json_t *config);
+        virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBlock (GBlock &block);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+        virtual void reset ();
+        inline GCoord interpolate(const GCoord &domainXYZ) const {
+            return GCoord(
+                domainXYZ.x + tables[0].offset(domainXYZ.x),
+                domainXYZ.y + tables[1].offset(domainXYZ.y),
+                domainXYZ.z + tables[2].offset(domainXYZ.z));
+        }
+
+        /**
+         * Correct the move of block from the modal position without passing it on.
+         * Batches keep the position in a local and store it once with setPosition().
+         */
+        inline void transform(GBlock &block, GCoord &position) {
+            if (block.isMove()) {
+                position = block.move.position(position);
+                block.moveTo(interpolate(position), matcher.formats);
+            }
+        }
+        inline GCoord getPosition() const {
+            return domain;
+        }
+        inline void setPosition(const GCoord &position) {
+            domain = position;
+        }
+        AxisTable &getTable(int axis) {
+            return tables[axis];
+        }
+} AxisTableFilter, *AxisTableFilterPtr;
+
+typedef enum NeighborhoodMode {
+    NEIGHBORHOOD_SCAN,		// examine every mapped point
+    NEIGHBORHOOD_KDTREE,	// query KdTree index of mapped points
+} NeighborhoodMode;
+
+typedef enum InterpolationMode {
+    INTERPOLATE_NEIGHBORHOOD,	// barycentric interpolation of nearest four points
+    INTERPOLATE_DELAUNAY,		// affine transform of enclosing Delaunay tetrahedron
+    INTERPOLATE_LAYERED,		// blend of enclosing triangles in planes of constant z
+} InterpolationMode;
+
+typedef enum CorrectionField {
+    FIELD_NONE,		// interpolate mapped points
+    FIELD_LATTICE,	// interpolate CorrectionLattice
+    FIELD_OCTREE,	// interpolate CorrectionOctree
+} CorrectionField;
+
+typedef struct CacheStats {
+    long hits;
+    long misses;
+    long evictions;
+    inline double hitRate() const {
+        return hits + misses ? hits / (double) (hits + misses) : 0;
+    }
+} CacheStats;
+
+typedef struct CacheEntry {
+    long long key[3];	// quantized domain
+    GCoord domain;
+    GCoord range;
+    unsigned int generation;
+    unsigned long used;	// stamp of last use
+} CacheEntry;
+
+#define CACHE_WAYS 4 /* entries per set */
+#define CACHE_MAX_CAPACITY (1<<24) /* entries */
+
+/**
+ * Bounded set associative cache of interpolated ranges keyed on the domain
+ * quantized to a grid. A domain that shares the key of a cached domain is
+ * answered by translating the cached range. Clearing is constant time.
+ */
+typedef class InterpolationCache {
+    private:
+        vector<CacheEntry> entries;
+        size_t setMask;
+        double quantum;
+        double invQuantum;
+        unsigned int generation;
+        unsigned long clock;
+        CacheStats stats;
+        inline void quantize(const GCoord &domain, long long *key) const {
+            key[0] = (long long) floor(domain.x * invQuantum + 0.5);
+            key[1] = (long long) floor(domain.y * invQuantum + 0.5);
+            key[2] = (long long) floor(domain.z * invQuantum + 0.5);
+        }
+        CacheEntry *set(const long long *key);
+
+    public:
+        InterpolationCache();
+
+        /**
+         * @param capacity number of entries, rounded up to a power of two. Zero disables the cache.
+         * @param quantum domain grid spacing
+         */
+        int configure(size_t capacity, double quantum=0.001);
+        inline bool isEnabled() const {
+            return entries.size() > 0;
+        }
+        inline size_t capacity() const {
+            return entries.size();
+        }
+        inline double getQuantum() const {
+            return quantum;
+        }
+        bool lookup(const GCoord &domain, GCoord &range);
+        void insert(const GCoord &domain, const GCoord &range);
+
+        /**
+         * Discard all cached ranges
+         */
+        inline void clear() {
+            generation++;
+        }
+        inline const CacheStats &getStats() const {
+            return stats;
+        }
+        void resetStats();
+} InterpolationCache;
+
+/**
+ * Counts searches that reused the neighborhood, tetrahedron or triangles
+ * found by the previous search. An interpolation outside the Delaunay or
+ * layered mesh also searches the neighborhood.
+ */
+typedef struct CoherenceStats {
+    long hits;
+    long misses;
+    inline double hitRate() const {
+        return hits + misses ? hits / (double) (hits + misses) : 0;
+    }
+} CoherenceStats;
+
+/**
+ * Mapped points with their indexes and baked correction field. A model is
+ * built by a MappedPointFilter and is no longer changed once it is shared
+ * (see MappedPointFilter::getModel()), so any number of filters can interpolate
+ * with it at once without locks. Filters keep their stream state to themselves.
+ */
+typedef struct CalibrationModel {
+    double domainRadius;
+    map<GCoord, MappedPoint> mapping;	// points being edited, released by buildIndex()
+    NeighborhoodMode neighborhoodMode;
+    PointStore store;	// mapping values indexed by KdTree ordinal
+    KdTree index;
+    bool indexDirty;
+    InterpolationMode interpolation;
+    DelaunayMesh mesh;
+    LayeredMesh layers;
+    CorrectionLattice lattice;
+    CorrectionOctree octree;
+    CorrectionField field;	// baked correction field used by interpolate()
+
+    CalibrationModel();
+
+    /**
+     * Copy that with an index of its own
+     */
+    CalibrationModel(const CalibrationModel &that);
+
+    /**
+     * Copy the points of the store back into mapping to edit them
+     */
+    void stage();
+
+    /**
+     * Move the points of mapping into the store and index them
+     */
+    void buildIndex();
+    inline size_t size() const {
+        return mapping.empty() ? store.size() : mapping.size();
+    }
+    int domainBounds(GCoord &domainMin, GCoord &domainMax) const;
+} CalibrationModel;
+
+typedef shared_ptr<const CalibrationModel> CalibrationModelPtr;
+
 typedef class MappedPointFilter:public GFilterBase {
     private:
 		GCoord domain;	// current input domain position 
-        double domainRadius;
         GMoveMatcher matcher;
-        map<GCoord, MappedPoint> mapping; // TODO: use PCL octtree or something
+        shared_ptr<CalibrationModel> model;
+        bool modelShared;	// model is immutable and copied on write
+        vector<int> layerHints;	// last triangle located in each layer
+        vector<int> layerHintsPrev;
+        int meshHint;	// last tetrahedron located
+        int cacheIndex[5];	// ordinals of the last kd-tree neighborhood and next nearest
+        int cacheCount;
+        GCoord cacheDomain;
+        double cacheSlack;	// distance from cacheDomain that keeps the four nearest
+        CoherenceStats coherence;
+        InterpolationCache cache;
+        void init();
+        int configureStream(json_t *config);
+        void editModel(const char *method);
+        GCoord interpolatePoint(GCoord domainXYZ);
+        void buildIndex();
+        vector<MappedPoint> scanNeighborhood(GCoord domainXYZ, double radius);
+        vector<MappedPoint> indexNeighborhood(GCoord domainXYZ, double radius, int maxPoints=0);
+        int nearestNeighborhood(GCoord domainXYZ, MappedPoint *neighborhood);
+        int coherentNeighbors(GCoord domainXYZ, KdHit *hits);
 
     public:
         MappedPointFilter (IGFilter & next, json_t* config=NULL);
+
+        /**
+         * Interpolate with a shared model. Only the "format" and "cache"
+         * of config apply. Changing the model edits a private copy of it.
+         */
+        MappedPointFilter (IGFilter & next, CalibrationModelPtr model, json_t* config=NULL);
+        ~MappedPointFilter();
 		int configure(json_t *config);
         virtual int writeln (const char *value);
+        virtual int writeSpan (const char *text, size_t length);
+        virtual int writeBlock (GBlock &block);
+        virtual int writeBatch (GBlock *blocks, size_t count);
+        virtual void reset ();
         GCoord interpolate(GCoord domainXYZ);
+
+        /**
+         * Correct the move of block from the modal position without passing it on.
+         * Batches keep the position in a local and store it once with setPosition().
+         */
+        inline void transform(GBlock &block, GCoord &position) {
+            if (block.isMove()) {
+                position = block.move.position(position);
+                block.moveTo(interpolate(position), matcher.formats);
+            }
+        }
+        inline GCoord getPosition() const {
+            return domain;
+        }
+        inline void setPosition(const GCoord &position) {
+            domain = position;
+        }
+
+        /**
+         * Interpolate count domain points given as coordinate arrays into range arrays.
+         * Barycentric interpolation of point neighborhoods uses SIMD kernels
+         * (see simdLevel()), and other interpolation modes interpolate each point.
+         * Ranges match interpolate() to within 1e-9.
+         */
+        void interpolate(const double *xs, const double *ys, const double *zs,
+                         double *rangeXs, double *rangeYs, double *rangeZs, size_t count);
+        void interpolate(const GCoord *domains, GCoord *ranges, size_t count);
+
+        /**
+         * Return the model with its indexes built. The model is shared from
+         * then on, and the methods that change it first copy it so that
+         * the returned model stays as it is.
+         */
+        CalibrationModelPtr getModel();
+        inline bool isModelShared() const {
+            return modelShared;
+        }
+
+        /**
+         * Return mapped points closer than radius to domainXYZ.
+         * The first four points are the closest, in order of distance.
+         */
         vector<MappedPoint> domainNeighborhood(GCoord domainXYZ, double radius);
         void mapPoint(GCoord domain, GCoord range);
         double getDomainRadius() {
-            return domainRadius;
+            return model->domainRadius;
+        }
+        void setDomainRadius(double value);
+        NeighborhoodMode getNeighborhoodMode() {
+            return model->neighborhoodMode;
+        }
+        void setNeighborhoodMode(NeighborhoodMode value);
+        PointPrecision getPrecision() {
+            return model->store.getPrecision();
+        }
+        void setPrecision(PointPrecision value);
+        const PointStore &getStore() {
+            if (model->indexDirty) {
+                buildIndex();
+            }
+            return model->store;
+        }
+        InterpolationMode getInterpolation() {
+            return model->interpolation;
+        }
+        void setInterpolation(InterpolationMode value);
+
+        /**
+         * Remember up to capacity interpolated ranges by domain quantized to quantum
+         * @param capacity zero disables the cache
+         */
+        int configureCache(size_t capacity, double quantum=0.001) {
+            return cache.configure(capacity, quantum);
+        }
+        InterpolationCache &getCache() {
+            return cache;
+        }
+
+        /**
+         * Bake the current interpolation of the mapped points into a lattice
+         * over their bounding box and use the lattice for interpolation.
+         * @param resolution domain distance between lattice nodes
+         * @param quantum range offset resolution
+         */
+        int bakeLattice(double resolution, double quantum=0.001);
+
+        /**
+         * Interpolate with the baked lattice file at path
+         */
+        int loadLattice(const char *path);
+        const CorrectionLattice &getLattice() {
+            return model->lattice;
+        }
+
+        /**
+         * Bake the current interpolation of the mapped points into an adaptive
+         * octree over their bounding box and use the octree for interpolation.
+         * @param tolerance largest acceptable range error of a cell
+         * @param budget largest acceptable octree size in bytes
+         */
+        int bakeOctree(double tolerance, size_t budget, int maxDepth=12);
+        const CorrectionOctree &getOctree() {
+            return model->octree;
+        }
+        CorrectionField getField() {
+            return model->field;
+        }
+        const DelaunayMesh &getMesh() {
+            if (model->indexDirty) {
+                buildIndex();
+            }
+            return model->mesh;
+        }
+        const LayeredMesh &getLayers() {
+            if (model->indexDirty) {
+                buildIndex();
+            }
+            return model->layers;
+        }
+
+        /**
+         * Return how often interpolate() reused the previous neighborhood,
+         * tetrahedron or triangles instead of searching
+         */
+        const CoherenceStats &getCoherence() {
+            return coherence;
         }
-        void setDomainRadius(double value) {
-            domainRadius = value;
+        void resetCoherence() {
+            coherence.hits = 0;
+            coherence.misses = 0;
         }
 } MappedPointFilter, *MappedPointFilterPtr;
 
@@ -0,0 +1,158 @@
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// KdTree /////////////
+// The tree is stored implicitly: the node of [lo,hi) is at (lo+hi)/2,
+// with the left subtree in [lo,mid) and the right subtree in [mid+1,hi).
+
+static inline double axisValue(const GCoord &c, int axis) {
+    return axis == 0 ? c.x : (axis == 1 ? c.y : c.z);
+}
+
+typedef struct KdAxisLess {
+    const PointStore &store;
+    int axis;
+    KdAxisLess(const PointStore &s, int a) : store(s), axis(a) {}
+    inline bool operator()(int lhs, int rhs) const {
+        double l = store.coord(axis, lhs);
+        double r = store.coord(axis, rhs);
+        return l < r || (l == r && lhs < rhs);
+    }
+} KdAxisLess;
+
+KdTree::KdTree() : pStore(NULL) {
+}
+
+void KdTree::clear() {
+    pStore = NULL;
+    nodes.clear();
+    axes.clear();
+}
+
+void KdTree::build(const PointStore &store) {
+    pStore = &store;
+    int n = store.size();
+    nodes.resize(n);
+    axes.resize(n);
+    for (int i = 0; i < n; i++) {
+        nodes[i] = i;
+    }
+    build(0, n);
+    LOGDEBUG1("KdTree::build() points:%d", n);
+}
+
+void KdTree::build(int lo, int hi) {
+    if (hi - lo <= 0) {
+        return;
+    }
+
+    // split on the axis of greatest extent
+    GCoord cmin(DBL_MAX,DBL_MAX,DBL_MAX);
+    GCoord cmax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (int i = lo; i < hi; i++) {
+        GCoord c = pStore->domain(nodes[i]);
+        cmin.x = min(cmin.x, c.x);
+        cmin.y = min(cmin.y, c.y);
+        cmin.z = min(cmin.z, c.z);
+        cmax.x = max(cmax.x, c.x);
+        cmax.y = max(cmax.y, c.y);
+        cmax.z = max(cmax.z, c.z);
+    }
+    int axis = 0;
+    double extent = cmax.x - cmin.x;
+    if (cmax.y - cmin.y > extent) {
+        axis = 1;
+        extent = cmax.y - cmin.y;
+    }
+    if (cmax.z - cmin.z > extent) {
+        axis = 2;
+    }
+
+    int mid = (lo + hi) / 2;
+    nth_element(nodes.begin()+lo, nodes.begin()+mid, nodes.begin()+hi, KdAxisLess(*pStore, axis));
+    axes[mid] = axis;
+    build(lo, mid);
+    build(mid+1, hi);
+}
+
+int KdTree::nearest(const GCoord &c, int k, double maxDist2, KdHit *hits) const {
+    int n = 0;
+    if (k <= 0) {
+        return 0;
+    }
+    // hits[k-1] is a sentinel until k hits are found
+    for (int i = 0; i < k; i++) {
+        hits[i].index = INT_MAX;
+        hits[i].dist2 = maxDist2;
+    }
+    nearest(0, nodes.size(), c, k, maxDist2, hits, n);
+    return n;
+}
+
+void KdTree::nearest(int lo, int hi, const GCoord &c, int k, double maxDist2, KdHit *hits, int &n) const {
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int iPoint = nodes[mid];
+        double dist2 = pStore->distance2(iPoint, c);
+        KdHit hit = { iPoint, dist2 };
+        if (dist2 < maxDist2 && hit < hits[k-1]) {
+            // insertion sort into hits, dropping the farthest
+            int i = n < k ? n++ : k-1;
+            for (; i > 0 && hit < hits[i-1]; i--) {
+                hits[i] = hits[i-1];
+            }
+            hits[i] = hit;
+        }
+
+        int axis = axes[mid];
+        double delta = axisValue(c, axis) - pStore->coord(axis, iPoint);
+        int nearLo = delta < 0 ? lo : mid+1;
+        int nearHi = delta < 0 ? mid : hi;
+        int farLo = delta < 0 ? mid+1 : lo;
+        int farHi = delta < 0 ? hi : mid;
+        nearest(nearLo, nearHi, c, k, maxDist2, hits, n);
+        if (delta*delta > hits[k-1].dist2) {
+            return;
+        }
+        lo = farLo;
+        hi = farHi;
+    }
+}
+
+void KdTree::radius(const GCoord &c, double maxDist2, vector<KdHit> &hits) const {
+    hits.clear();
+    radius(0, nodes.size(), c, maxDist2, hits);
+    sort(hits.begin(), hits.end());
+}
+
+void KdTree::radius(int lo, int hi, const GCoord &c, double maxDist2, vector<KdHit> &hits) const {
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int iPoint = nodes[mid];
+        double dist2 = pStore->distance2(iPoint, c);
+        if (dist2 < maxDist2) {
+            KdHit hit = { iPoint, dist2 };
+            hits.push_back(hit);
+        }
+
+        int axis = axes[mid];
+        double delta = axisValue(c, axis) - pStore->coord(axis, iPoint);
+        if (delta*delta < maxDist2) {
+            radius(lo, mid, c, maxDist2, hits);
+            lo = mid+1;
+        } else if (delta < 0) {
+            hi = mid;
+        } else {
+            lo = mid+1;
+        }
+    }
+}
@@ -0,0 +1,248 @@
+#include <string.h>
+#include <iostream>
+#include <cfloat>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+#define LATTICE_MAX_NODES (1<<26) /* 384MB of offsets */
+
+////////////// CorrectionLattice /////////////
+
+CorrectionLattice::CorrectionLattice() : data(NULL), pMap(NULL), mapLength(0) {
+    memset(&header, 0, sizeof(header));
+}
+
+CorrectionLattice::CorrectionLattice(const CorrectionLattice &that) 
+    : header(that.header), data(NULL), pMap(NULL), mapLength(0) {
+    if (that.data) {
+        cells.assign(that.data, that.data + (size_t) header.nx * header.ny * header.nz * 3);
+        data = &cells[0];
+    }
+    for (int a = 0; a < 3; a++) {
+        invSpacing[a] = that.invSpacing[a];
+    }
+}
+
+CorrectionLattice::~CorrectionLattice() {
+    unload();
+}
+
+void CorrectionLattice::unload() {
+#ifndef _MSC_VER
+    if (pMap) {
+        munmap(pMap, mapLength);
+    }
+#endif
+    pMap = NULL;
+    mapLength = 0;
+    data = NULL;
+    cells.clear();
+}
+
+size_t CorrectionLattice::bytes() const {
+    return data ? sizeof(header) + (size_t) header.nx * header.ny * header.nz * 3 * sizeof(short) : 0;
+}
+
+int CorrectionLattice::bake(MappedPointFilter &source, GCoord domainMin, GCoord domainMax,
+                            double resolution, double quantum) {
+    unload();
+    if (resolution <= 0) {
+        LOGERROR1("CorrectionLattice::bake() invalid resolution:%g", resolution);
+        return -EINVAL;
+    }
+
+    double minv[3] = {domainMin.x, domainMin.y, domainMin.z};
+    double maxv[3] = {domainMax.x, domainMax.y, domainMax.z};
+    int n[3];
+    for (int i = 0; i < 3; i++) {
+        n[i] = 1 + (int) ceil((maxv[i] - minv[i]) / resolution);
+        n[i] = max(n[i], 2);
+        header.origin[i] = minv[i];
+        header.spacing[i] = resolution;
+    }
+    if ((double) n[0] * n[1] * n[2] > LATTICE_MAX_NODES) {
+        LOGERROR4("CorrectionLattice::bake() %dx%dx%d nodes exceeds limit of %d", n[0], n[1], n[2], LATTICE_MAX_NODES);
+        return -ENOMEM;
+    }
+    memcpy(header.magic, LATTICE_MAGIC, sizeof(header.magic));
+    header.version = LATTICE_VERSION;
+    header.nx = n[0];
+    header.ny = n[1];
+    header.nz = n[2];
+
+    size_t nodes = (size_t) n[0] * n[1] * n[2];
+    vector<double> offsets(nodes * 3);
+    double omin[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    double omax[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+    size_t iNode = 0;
+    for (int k = 0; k < n[2]; k++) {
+        for (int j = 0; j < n[1]; j++) {
+            for (int i = 0; i < n[0]; i++, iNode++) {
+                GCoord domain(minv[0] + i*resolution, minv[1] + j*resolution, minv[2] + k*resolution);
+                GCoord range = source.interpolate(domain);
+                double *o = &offsets[iNode*3];
+                o[0] = range.x - domain.x;
+                o[1] = range.y - domain.y;
+                o[2] = range.z - domain.z;
+                for (int a = 0; a < 3; a++) {
+                    omin[a] = min(omin[a], o[a]);
+                    omax[a] = max(omax[a], o[a]);
+                }
+            }
+        }
+    }
+
+    // center each axis on bias and widen quantum until offsets fit in int16
+    header.quantum = quantum;
+    for (int a = 0; a < 3; a++) {
+        header.bias[a] = (omin[a] + omax[a]) / 2;
+        double halfSpan = (omax[a] - omin[a]) / 2;
+        if (halfSpan / header.quantum > 32000) {
+            header.quantum = halfSpan / 32000;
+        }
+    }
+    if (header.quantum != quantum) {
+        LOGWARN2("CorrectionLattice::bake() quantum:%g enlarged to %g", quantum, header.quantum);
+    }
+
+    cells.resize(nodes * 3);
+    for (size_t i = 0; i < nodes * 3; i++) {
+        cells[i] = (short) floor((offsets[i] - header.bias[i%3]) / header.quantum + 0.5);
+    }
+    data = &cells[0];
+    for (int a = 0; a < 3; a++) {
+        invSpacing[a] = 1 / header.spacing[a];
+    }
+
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%dx%dx%d", n[0], n[1], n[2]);
+    LOGINFO3("CorrectionLattice::bake() nodes:%s quantum:%g bytes:%ld", buf, header.quantum, (long) bytes());
+    return 0;
+}
+
+int CorrectionLattice::save(const char *path) const {
+    if (!data) {
+        LOGERROR1("CorrectionLattice::save(%s) no lattice", path);
+        return -EINVAL;
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        LOGERROR1("CorrectionLattice::save(%s) fopen failed", path);
+        return -errno;
+    }
+    size_t count = (size_t) header.nx * header.ny * header.nz * 3;
+    int rc = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(data, sizeof(short), count, file) != count) {
+        LOGERROR1("CorrectionLattice::save(%s) fwrite failed", path);
+        rc = -EIO;
+    }
+    if (fclose(file)) {
+        rc = -EIO;
+    }
+    LOGINFO2("CorrectionLattice::save(%s) %ldB", path, (long) bytes());
+    return rc;
+}
+
+int CorrectionLattice::load(const char *path) {
+    unload();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGERROR1("CorrectionLattice::load(%s) open failed", path);
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < sizeof(LatticeHeader)) {
+        LOGERROR1("CorrectionLattice::load(%s) not a lattice file", path);
+        close(fd);
+        return -EINVAL;
+    }
+    size_t length = st.st_size;
+#ifdef _MSC_VER
+    cells.resize((length - sizeof(LatticeHeader)) / sizeof(short));
+    read(fd, &header, sizeof(header));
+    read(fd, &cells[0], cells.size() * sizeof(short));
+    close(fd);
+    data = &cells[0];
+#else
+    void *pData = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pData == MAP_FAILED) {
+        LOGERROR1("CorrectionLattice::load(%s) mmap failed", path);
+        return -errno;
+    }
+    madvise(pData, length, MADV_WILLNEED);
+    pMap = pData;
+    mapLength = length;
+    memcpy(&header, pData, sizeof(header));
+    data = (const short *) ((char *) pData + sizeof(LatticeHeader));
+#endif
+
+    size_t count = (size_t) header.nx * header.ny * header.nz * 3;
+    bool finite = isfinite(header.quantum) && header.quantum > 0;
+    for (int a = 0; a < 3; a++) {
+        finite = finite && isfinite(header.origin[a]) && isfinite(header.bias[a]) &&
+            isfinite(header.spacing[a]) && header.spacing[a] > 0;
+    }
+    if (memcmp(header.magic, LATTICE_MAGIC, sizeof(header.magic)) || header.version != LATTICE_VERSION ||
+            header.nx < 2 || header.ny < 2 || header.nz < 2 || !finite ||
+            length != sizeof(LatticeHeader) + count * sizeof(short)) {
+        LOGERROR1("CorrectionLattice::load(%s) invalid lattice file", path);
+        unload();
+        return -EINVAL;
+    }
+    for (int a = 0; a < 3; a++) {
+        invSpacing[a] = 1 / header.spacing[a];
+    }
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%dx%dx%d", header.nx, header.ny, header.nz);
+    LOGINFO3("CorrectionLattice::load(%s) nodes:%s bytes:%ld", path, buf, (long) length);
+    return 0;
+}
+
+bool CorrectionLattice::interpolate(const GCoord &domain, GCoord &range) const {
+    if (!data) {
+        return FALSE;
+    }
+    double fx = (domain.x - header.origin[0]) * invSpacing[0];
+    double fy = (domain.y - header.origin[1]) * invSpacing[1];
+    double fz = (domain.z - header.origin[2]) * invSpacing[2];
+    if (!(0 <= fx && fx <= header.nx-1 && 0 <= fy && fy <= header.ny-1 && 0 <= fz && fz <= header.nz-1)) {
+        return FALSE;
+    }
+    int i = min((int) fx, header.nx-2);
+    int j = min((int) fy, header.ny-2);
+    int k = min((int) fz, header.nz-2);
+    double tx = fx - i;
+    double ty = fy - j;
+    double tz = fz - k;
+
+    size_t dy = (size_t) header.nx * 3;
+    size_t dz = dy * header.ny;
+    const short *c000 = data + (k * dz + j * dy + i * 3);
+    const short *c010 = c000 + dy;
+    const short *c001 = c000 + dz;
+    const short *c011 = c001 + dy;
+    double offset[3];
+    for (int a = 0; a < 3; a++) {
+        double x00 = c000[a] + tx * (c000[a+3] - c000[a]);
+        double x10 = c010[a] + tx * (c010[a+3] - c010[a]);
+        double x01 = c001[a] + tx * (c001[a+3] - c001[a]);
+        double x11 = c011[a] + tx * (c011[a+3] - c011[a]);
+        double y0 = x00 + ty * (x10 - x00);
+        double y1 = x01 + ty * (x11 - x01);
+        offset[a] = header.bias[a] + header.quantum * (y0 + tz * (y1 - y0));
+    }
+    range = GCoord(domain.x + offset[0], domain.y + offset[1], domain.z + offset[2]);
+    return TRUE;
+}
@@ -0,0 +1,418 @@
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// LayeredMesh /////////////
+// Each layer is a 2D Delaunay triangulation built by Bowyer-Watson insertion
+// into a super-triangle. Triangles are counterclockwise and edge i is
+// opposite vertex i.
+
+#define BARYCENTRIC_EPSILON 1e-9 /* tolerance for points on triangle edges */
+#define LOCATE_MAX_TIES 32 /* triangles sharing the located point */
+
+typedef struct BuildTri {
+    int v[3];
+    int n[3];
+    bool alive;
+} BuildTri;
+
+static inline double orient2d(const GCoord &a, const GCoord &b, const GCoord &c) {
+    return (a.x - c.x) * (b.y - c.y) - (a.y - c.y) * (b.x - c.x);
+}
+
+// positive if d lies inside the circumcircle of counterclockwise abc
+static inline double incircle(const GCoord &a, const GCoord &b, const GCoord &c, const GCoord &d) {
+    double adx = a.x - d.x, ady = a.y - d.y;
+    double bdx = b.x - d.x, bdy = b.y - d.y;
+    double cdx = c.x - d.x, cdy = c.y - d.y;
+    double alift = adx * adx + ady * ady;
+    double blift = bdx * bdx + bdy * bdy;
+    double clift = cdx * cdx + cdy * cdy;
+    return alift * (bdx * cdy - cdx * bdy)
+           + blift * (cdx * ady - adx * cdy)
+           + clift * (adx * bdy - bdx * ady);
+}
+
+typedef struct EdgeLink {
+    int a;		// vertex shared with p by two new triangles
+    int tri;
+    int edge;
+} EdgeLink;
+
+typedef class LayerBuilder {
+    public:
+        vector<GCoord> &coords;
+        vector<BuildTri> tris;
+        vector<int> cavity;
+        vector<int> mark;
+        vector<int> boundary;	// tri*3 + edge
+        vector<EdgeLink> links;
+        int last;
+
+        LayerBuilder(vector<GCoord> &c) : coords(c), last(0) {}
+
+        inline double orientEdge(const BuildTri &t, int edge, int ip) {
+            const GCoord *c[3];
+            for (int i = 0; i < 3; i++) {
+                c[i] = &coords[i == edge ? ip : t.v[i]];
+            }
+            return orient2d(*c[0], *c[1], *c[2]);
+        }
+
+        int addTri(int a, int b, int c) {
+            BuildTri t = { {a,b,c}, {-1,-1,-1}, TRUE };
+            tris.push_back(t);
+            mark.push_back(-1);
+            return tris.size() - 1;
+        }
+
+        int locate(int ip) {
+            int t = last;
+            for (int steps = 0; steps < tris.size(); steps++) {
+                int next = -1;
+                for (int e = 0; e < 3; e++) {
+                    if (tris[t].n[e] >= 0 && orientEdge(tris[t], e, ip) < 0) {
+                        next = tris[t].n[e];
+                        break;
+                    }
+                }
+                if (next < 0) {
+                    return t;
+                }
+                t = next;
+            }
+            for (t = 0; t < tris.size(); t++) {
+                if (tris[t].alive && orientEdge(tris[t], 0, ip) >= 0 &&
+                        orientEdge(tris[t], 1, ip) >= 0 && orientEdge(tris[t], 2, ip) >= 0) {
+                    return t;
+                }
+            }
+            return -1;
+        }
+
+        bool insert(int ip) {
+            int t0 = locate(ip);
+            if (t0 < 0) {
+                return FALSE;
+            }
+            const GCoord &p = coords[ip];
+            cavity.clear();
+            cavity.push_back(t0);
+            mark[t0] = ip;
+            for (int i = 0; i < cavity.size(); i++) {
+                for (int e = 0; e < 3; e++) {
+                    int tn = tris[cavity[i]].n[e];
+                    if (tn >= 0 && mark[tn] != ip) {
+                        BuildTri &n = tris[tn];
+                        if (incircle(coords[n.v[0]], coords[n.v[1]], coords[n.v[2]], p) > 0) {
+                            mark[tn] = ip;
+                            cavity.push_back(tn);
+                        }
+                    }
+                }
+            }
+
+            // grow the cavity until it is star-shaped from p
+            bool repaired;
+            do {
+                repaired = FALSE;
+                boundary.clear();
+                for (int i = 0; !repaired && i < cavity.size(); i++) {
+                    for (int e = 0; e < 3; e++) {
+                        int tn = tris[cavity[i]].n[e];
+                        if (tn >= 0 && mark[tn] == ip) {
+                            continue;
+                        }
+                        if (orientEdge(tris[cavity[i]], e, ip) <= 0) {
+                            if (tn < 0) {
+                                return FALSE;
+                            }
+                            mark[tn] = ip;
+                            cavity.push_back(tn);
+                            repaired = TRUE;
+                            break;
+                        }
+                        boundary.push_back(cavity[i]*3 + e);
+                    }
+                }
+            } while (repaired);
+
+            links.clear();
+            int firstNew = tris.size();
+            for (int i = 0; i < boundary.size(); i++) {
+                int tc = boundary[i] / 3;
+                int e = boundary[i] % 3;
+                int v[3];
+                memcpy(v, tris[tc].v, sizeof v);
+                v[e] = ip;
+                int tn = tris[tc].n[e];
+                int tNew = addTri(v[0], v[1], v[2]);
+                tris[tNew].n[e] = tn;
+                if (tn >= 0) {
+                    for (int j = 0; j < 3; j++) {
+                        if (tris[tn].n[j] == tc) {
+                            tris[tn].n[j] = tNew;
+                        }
+                    }
+                }
+                // edges (p, v[j]) are opposite vertex (j+1)%3 or (j+2)%3
+                for (int j = 0; j < 3; j++) {
+                    if (j == e) {
+                        continue;
+                    }
+                    int a = v[3 - e - j];
+                    bool linked = FALSE;
+                    for (int k = 0; k < links.size(); k++) {
+                        if (links[k].a == a) {
+                            tris[tNew].n[j] = links[k].tri;
+                            tris[links[k].tri].n[links[k].edge] = tNew;
+                            links[k] = links.back();
+                            links.pop_back();
+                            linked = TRUE;
+                            break;
+                        }
+                    }
+                    if (!linked) {
+                        EdgeLink link = { a, tNew, j };
+                        links.push_back(link);
+                    }
+                }
+            }
+            for (int i = 0; i < cavity.size(); i++) {
+                tris[cavity[i]].alive = FALSE;
+            }
+            last = firstNew;
+            return TRUE;
+        }
+} LayerBuilder;
+
+// Solve the barycentric and affine transforms of triangle t
+static bool triTransforms(LayerTriangle &t, const vector<MappedPoint> &points, const vector<int> &ordinals) {
+    const MappedPoint &p0 = points[ordinals[t.v[0]]];
+    const MappedPoint &p1 = points[ordinals[t.v[1]]];
+    const MappedPoint &p2 = points[ordinals[t.v[2]]];
+    double a = p0.domain.x - p2.domain.x, b = p1.domain.x - p2.domain.x;
+    double c = p0.domain.y - p2.domain.y, d = p1.domain.y - p2.domain.y;
+    double det = a*d - b*c;
+    if (det == 0) {
+        return FALSE;
+    }
+    double inv[2][2] = { { d/det, -b/det }, { -c/det, a/det } };
+    for (int y = 0; y < 2; y++) {
+        t.bary[y][0] = inv[y][0];
+        t.bary[y][1] = inv[y][1];
+        t.bary[y][2] = -(inv[y][0]*p2.domain.x + inv[y][1]*p2.domain.y);
+    }
+    double r0[3] = {p0.range.x, p0.range.y, p0.range.z};
+    double r1[3] = {p1.range.x, p1.range.y, p1.range.z};
+    double r2[3] = {p2.range.x, p2.range.y, p2.range.z};
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            t.affine[y][x] = (r0[y]-r2[y])*t.bary[0][x] + (r1[y]-r2[y])*t.bary[1][x];
+        }
+        t.affine[y][2] += r2[y];
+    }
+    return TRUE;
+}
+
+// Triangulate the xy domain of the given points
+static bool buildLayer(MeshLayer &layer, const vector<MappedPoint> &points) {
+    int nPoints = layer.ordinals.size();
+    vector<GCoord> coords;
+    GCoord cmin(DBL_MAX,DBL_MAX,0);
+    GCoord cmax(-DBL_MAX,-DBL_MAX,0);
+    for (int i = 0; i < nPoints; i++) {
+        const GCoord &c = points[layer.ordinals[i]].domain;
+        coords.push_back(GCoord(c.x, c.y, 0));
+        cmin.x = min(cmin.x, c.x);
+        cmin.y = min(cmin.y, c.y);
+        cmax.x = max(cmax.x, c.x);
+        cmax.y = max(cmax.y, c.y);
+    }
+    double s = 100 * max(max(cmax.x - cmin.x, cmax.y - cmin.y), 1.0);
+    GCoord center = 0.5*(cmin + cmax);
+    coords.push_back(center + GCoord(-s, -s, 0));
+    coords.push_back(center + GCoord(s, -s, 0));
+    coords.push_back(center + GCoord(0, s, 0));
+
+    LayerBuilder builder(coords);
+    builder.addTri(nPoints, nPoints+1, nPoints+2);
+    vector<int> order;
+    for (int i = 0; i < nPoints; i++) {
+        order.push_back(i);
+    }
+    unsigned int seed = 1;
+    for (int i = nPoints; --i > 0; ) {
+        seed = seed * 1103515245 + 12345;
+        swap(order[i], order[(seed >> 8) % (i + 1)]);
+    }
+    for (int i = 0; i < nPoints; i++) {
+        if (!builder.insert(order[i])) {
+            LOGWARN2("LayeredMesh::build() z:%g skipped point %d", layer.z, order[i]);
+        }
+    }
+
+    layer.triangles.clear();
+    vector<int> remap(builder.tris.size(), -1);
+    for (int i = 0; i < builder.tris.size(); i++) {
+        BuildTri &bt = builder.tris[i];
+        if (bt.alive && bt.v[0] < nPoints && bt.v[1] < nPoints && bt.v[2] < nPoints) {
+            LayerTriangle t;
+            memcpy(t.v, bt.v, sizeof t.v);
+            if (triTransforms(t, points, layer.ordinals)) {
+                remap[i] = layer.triangles.size();
+                layer.triangles.push_back(t);
+            }
+        }
+    }
+    int iTri = 0;
+    for (int i = 0; i < builder.tris.size(); i++) {
+        if (remap[i] >= 0) {
+            LayerTriangle &t = layer.triangles[iTri++];
+            for (int e = 0; e < 3; e++) {
+                int tn = builder.tris[i].n[e];
+                t.n[e] = tn >= 0 ? remap[tn] : -1;
+            }
+        }
+    }
+    return layer.triangles.size() > 0;
+}
+
+int LayeredMesh::build(const vector<MappedPoint> &points, int maxLayers) {
+    layers.clear();
+    vector<double> zs;
+    for (int i = 0; i < points.size(); i++) {
+        zs.push_back(points[i].domain.z);
+    }
+    sort(zs.begin(), zs.end());
+    zs.erase(unique(zs.begin(), zs.end()), zs.end());
+    if (zs.size() < 2 || zs.size() > maxLayers) {
+        LOGDEBUG1("LayeredMesh::build() %d planes are not layered", (int) zs.size());
+        return 0;
+    }
+
+    layers.resize(zs.size());
+    for (int i = 0; i < zs.size(); i++) {
+        layers[i].z = zs[i];
+    }
+    for (int i = 0; i < points.size(); i++) {
+        int iLayer = lower_bound(zs.begin(), zs.end(), points[i].domain.z) - zs.begin();
+        layers[iLayer].ordinals.push_back(i);
+    }
+    for (int i = 0; i < layers.size(); i++) {
+        if (layers[i].ordinals.size() < 3 || !buildLayer(layers[i], points)) {
+            LOGDEBUG1("LayeredMesh::build() z:%g cannot be triangulated", layers[i].z);
+            layers.clear();
+            return 0;
+        }
+    }
+
+    LOGINFO2("LayeredMesh::build() points:%d layers:%d", (int) points.size(), (int) layers.size());
+    return layers.size();
+}
+
+static inline void triangleBary(const LayerTriangle &tri, const GCoord &domain, double *b) {
+    b[0] = tri.bary[0][0]*domain.x + tri.bary[0][1]*domain.y + tri.bary[0][2];
+    b[1] = tri.bary[1][0]*domain.x + tri.bary[1][1]*domain.y + tri.bary[1][2];
+    b[2] = 1 - (b[0] + b[1]);
+}
+
+/**
+ * Return the lowest index of the triangles that contain domain and are
+ * connected to triangle t across edges through domain, so that a domain on
+ * a shared edge or vertex maps the same way whatever triangle the walk found
+ */
+static int lowestTriangle(const vector<LayerTriangle> &tris, const GCoord &domain, int t) {
+    int found[LOCATE_MAX_TIES];
+    int nFound = 0;
+    found[nFound++] = t;
+    int lowest = t;
+    for (int i = 0; i < nFound; i++) {
+        const LayerTriangle &tri = tris[found[i]];
+        double b[3];
+        triangleBary(tri, domain, b);
+        for (int edge = 0; edge < 3; edge++) {
+            int tn = tri.n[edge];
+            if (tn < 0 || b[edge] > BARYCENTRIC_EPSILON || nFound == LOCATE_MAX_TIES ||
+                find(found, found + nFound, tn) != found + nFound) {
+                continue;
+            }
+            double bn[3];
+            triangleBary(tris[tn], domain, bn);
+            if (min(bn[0], min(bn[1], bn[2])) >= -BARYCENTRIC_EPSILON) {
+                found[nFound++] = tn;
+                lowest = min(lowest, tn);
+            }
+        }
+    }
+    return lowest;
+}
+
+int LayeredMesh::locate(int iLayer, const GCoord &domain, int hint) const {
+    const vector<LayerTriangle> &tris = layers[iLayer].triangles;
+    int t = (hint >= 0 && hint < tris.size()) ? hint : 0;
+    for (int steps = 0; steps < tris.size(); steps++) {
+        const LayerTriangle &tri = tris[t];
+        double b[3];
+        triangleBary(tri, domain, b);
+        int edge = b[0] < b[1] ? 0 : 1;
+        if (b[2] < b[edge]) {
+            edge = 2;
+        }
+        if (b[edge] >= -BARYCENTRIC_EPSILON) {
+            return lowestTriangle(tris, domain, t);
+        }
+        if (tri.n[edge] < 0) {
+            return -1; // outside convex hull
+        }
+        t = tri.n[edge];
+    }
+    return -1;
+}
+
+bool LayeredMesh::interpolate(const GCoord &domain, GCoord &range, int *hints) const {
+    if (layers.size() < 2) {
+        return FALSE;
+    }
+
+    // blend the two layers that bracket domain.z, holding the correction of
+    // the outer layers beyond them
+    int upper = 1;
+    while (upper < layers.size() - 1 && layers[upper].z < domain.z) {
+        upper++;
+    }
+    int lower = upper - 1;
+    GCoord ranges[2];
+    int iLayers[2] = { lower, upper };
+    for (int i = 0; i < 2; i++) {
+        int iLayer = iLayers[i];
+        int t = locate(iLayer, domain, hints[iLayer]);
+        if (t < 0) {
+            return FALSE;
+        }
+        hints[iLayer] = t;
+        const double (*a)[3] = layers[iLayer].triangles[t].affine;
+        ranges[i] = GCoord(
+            a[0][0]*domain.x + a[0][1]*domain.y + a[0][2],
+            a[1][0]*domain.x + a[1][1]*domain.y + a[1][2],
+            a[2][0]*domain.x + a[2][1]*domain.y + a[2][2]);
+    }
+    double t = (domain.z - layers[lower].z) / (layers[upper].z - layers[lower].z);
+    if (t < 0 || t > 1) {
+        int outer = t < 0 ? 0 : 1;
+        range = GCoord(ranges[outer].x, ranges[outer].y, ranges[outer].z + domain.z - layers[iLayers[outer]].z);
+        return TRUE;
+    }
+    range = GCoord(
+        ranges[0].x + t * (ranges[1].x - ranges[0].x),
+        ranges[0].y + t * (ranges[1].y - ranges[0].y),
+        ranges[0].z + t * (ranges[1].z - ranges[0].z));
+    return TRUE;
+}
@@ -13,10 +13,75 @@
 using namespace std;
 using namespace gfilter;
 
-MappedPointFilter::MappedPointFilter(IGFilter &next, json_t *pConfig) : GFilterBase(next) {
-    _name = "MappedPointFilter";
+CalibrationModel::CalibrationModel() {
     domainRadius = 0;
-	domain = GCoord(0,0,0);
+	neighborhoodMode = NEIGHBORHOOD_KDTREE;
+	indexDirty = FALSE;
+	interpolation = INTERPOLATE_NEIGHBORHOOD;
+	field = FIELD_NONE;
+}
+
+CalibrationModel::CalibrationModel(const CalibrationModel &that)
+	: domainRadius(that.domainRadius), mapping(that.mapping), neighborhoodMode(that.neighborhoodMode),
+	  store(that.store), indexDirty(that.indexDirty), interpolation(that.interpolation),
+	  mesh(that.mesh), layers(that.layers), lattice(that.lattice), octree(that.octree), field(that.field) {
+	if (!indexDirty) {
+		index.build(store); // the tree of that indexes the store of that
+	}
+}
+
+void CalibrationModel::stage() {
+	if (mapping.empty()) {
+		for (size_t i = 0; i < store.size(); i++) {
+			mapping[store.domain(i)] = store.at(i);
+		}
+	}
+}
+
+void CalibrationModel::buildIndex() {
+	stage();
+	size_t mapBytes = PointStore::mapBytes(mapping.size());
+	store.build(mapping);
+	map<GCoord, MappedPoint>().swap(mapping);	// the store holds the points from now on
+	index.build(store);
+	if (interpolation == INTERPOLATE_DELAUNAY) {
+		mesh.build(store.points());
+	} else if (interpolation == INTERPOLATE_LAYERED) {
+		if (!layers.build(store.points())) {
+			LOGWARN("CalibrationModel::buildIndex() mapped points are not layered");
+		}
+	}
+	indexDirty = FALSE;
+	LOGINFO3("CalibrationModel::buildIndex() points:%d map bytes:%ld => store bytes:%ld", 
+		(int) store.size(), (long) mapBytes, (long) store.bytes());
+}
+
+static void extendBounds(GCoord &domainMin, GCoord &domainMax, const GCoord &c) {
+	domainMin = GCoord(min(domainMin.x, c.x), min(domainMin.y, c.y), min(domainMin.z, c.z));
+	domainMax = GCoord(max(domainMax.x, c.x), max(domainMax.y, c.y), max(domainMax.z, c.z));
+}
+
+int CalibrationModel::domainBounds(GCoord &domainMin, GCoord &domainMax) const {
+	if (size() == 0) {
+		LOGERROR("CalibrationModel::domainBounds() no mapped points");
+		return -EINVAL;
+	}
+	domainMin = GCoord(DBL_MAX,DBL_MAX,DBL_MAX);
+	domainMax = GCoord(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (map<GCoord,MappedPoint>::const_iterator ipo=mapping.begin(); ipo!=mapping.end(); ipo++) {
+		extendBounds(domainMin, domainMax, ipo->second.domain);
+	}
+	if (mapping.empty()) {
+		for (size_t i = 0; i < store.size(); i++) {
+			extendBounds(domainMin, domainMax, store.domain(i));
+		}
+	}
+	return 0;
+}
+
+MappedPointFilter::MappedPointFilter(IGFilter &next, json_t *pConfig) 
+	: GFilterBase(next), model(new CalibrationModel()), modelShared(FALSE) {
+	init();
 	if (pConfig) {
 		LOGINFO("MappedPointFilter(JSON)");
 		ASSERTZERO(configure(pConfig));
@@ -25,8 +90,115 @@ MappedPointFilter::MappedPointFilter(IGFilter &next, json_t *pConfig) : GFilterB
 	}
 }
 
+MappedPointFilter::MappedPointFilter(IGFilter &next, CalibrationModelPtr pModel, json_t *pConfig) 
+	: GFilterBase(next), model(const_pointer_cast<CalibrationModel>(pModel)), modelShared(TRUE) {
+	init();
+	layerHints.assign(model->layers.size(), -1);
+	LOGINFO1("MappedPointFilter(CalibrationModel) users:%ld", (long) model.use_count());
+	if (pConfig) {
+		ASSERTZERO(configureStream(pConfig));
+	}
+}
+
+void MappedPointFilter::init() {
+    _name = "MappedPointFilter";
+	domain = GCoord(0,0,0);
+	meshHint = -1;
+	cacheCount = 0;
+	cacheSlack = 0;
+	resetCoherence();
+}
+
+MappedPointFilter::~MappedPointFilter() {
+	if (coherence.hits + coherence.misses) {
+		LOGINFO3("~MappedPointFilter() coherence hits:%ld misses:%ld hitRate:%g", 
+			coherence.hits, coherence.misses, coherence.hitRate());
+	}
+	if (cache.isEnabled()) {
+		const CacheStats &stats = cache.getStats();
+		LOGINFO4("~MappedPointFilter() cache hits:%ld misses:%ld evictions:%ld hitRate:%g", 
+			stats.hits, stats.misses, stats.evictions, stats.hitRate());
+	}
+}
+
+void MappedPointFilter::editModel(const char *method) {
+	if (modelShared) {
+		if (model.use_count() > 1) {
+			LOGINFO2("MappedPointFilter::%s() copying shared calibration model users:%ld", 
+				method, (long) model.use_count());
+			model = shared_ptr<CalibrationModel>(new CalibrationModel(*model));
+		}
+		modelShared = FALSE;
+	}
+}
+
+CalibrationModelPtr MappedPointFilter::getModel() {
+	if (model->indexDirty) {
+		buildIndex();
+	}
+	modelShared = TRUE;
+	return model;
+}
+
+void MappedPointFilter::setDomainRadius(double value) {
+	editModel("setDomainRadius");
+	model->domainRadius = value;
+	cacheCount = 0;
+	cache.clear();
+}
+
+void MappedPointFilter::setNeighborhoodMode(NeighborhoodMode value) {
+	editModel("setNeighborhoodMode");
+	model->neighborhoodMode = value;
+	cache.clear();
+}
+
+void MappedPointFilter::setPrecision(PointPrecision value) {
+	editModel("setPrecision");
+	model->store.setPrecision(value);
+	model->indexDirty = TRUE;
+	cache.clear();
+}
+
+void MappedPointFilter::setInterpolation(InterpolationMode value) {
+	editModel("setInterpolation");
+	model->interpolation = value;
+	model->indexDirty = TRUE;
+	cache.clear();
+}
+
 int MappedPointFilter::configure(json_t *pConfig) {
 	LOGINFO("MappedPointFilter::configure()");
+	editModel("configure");
+	string neighborhood = jo_string(pConfig, "neighborhood", "kdtree");
+	if (neighborhood.compare("kdtree") == 0) {
+		model->neighborhoodMode = NEIGHBORHOOD_KDTREE;
+	} else if (neighborhood.compare("scan") == 0) {
+		model->neighborhoodMode = NEIGHBORHOOD_SCAN;
+	} else {
+		LOGERROR1("MappedPointFilter::configure() unknown neighborhood:%s", neighborhood.c_str());
+		return -EINVAL;
+	}
+	string precision = jo_string(pConfig, "precision", "double");
+	if (precision.compare("double") == 0) {
+		model->store.setPrecision(PRECISION_DOUBLE);
+	} else if (precision.compare("float") == 0) {
+		model->store.setPrecision(PRECISION_FLOAT);
+	} else {
+		LOGERROR1("MappedPointFilter::configure() unknown precision:%s", precision.c_str());
+		return -EINVAL;
+	}
+	string interpolationName = jo_string(pConfig, "interpolation", "neighborhood");
+	if (interpolationName.compare("neighborhood") == 0) {
+		model->interpolation = INTERPOLATE_NEIGHBORHOOD;
+	} else if (interpolationName.compare("delaunay") == 0) {
+		model->interpolation = INTERPOLATE_DELAUNAY;
+	} else if (interpolationName.compare("layered") == 0) {
+		model->interpolation = INTERPOLATE_LAYERED;
+	} else {
+		LOGERROR1("MappedPointFilter::configure() unknown interpolation:%s", interpolationName.c_str());
+		return -EINVAL;
+	}
 	json_t * pMapping = json_object_get(pConfig, "map");
 	if (json_is_array(pMapping)) {
 		size_t index;
@@ -53,28 +225,174 @@ int MappedPointFilter::configure(json_t *pConfig) {
 		LOGERROR("MappedPointFilter::configure() expected JSON array for point mapping");
 		return -EINVAL;
 	}
+	buildIndex();
+	if (!json_object_get(pConfig, "interpolation") && model->layers.build(model->store.points())) {
+		// points on a few planes of constant z are best interpolated in 2D
+		LOGINFO1("MappedPointFilter::configure() interpolation:layered planes:%d", (int) model->layers.size());
+		model->interpolation = INTERPOLATE_LAYERED;
+		layerHints.assign(model->layers.size(), -1);
+	}
+
+	json_t *pLattice = json_object_get(pConfig, "lattice");
+	if (json_is_string(pLattice)) {
+		int rc = loadLattice(json_string_value(pLattice));
+		if (rc) {
+			return rc;
+		}
+	} else if (json_is_object(pLattice)) {
+		double resolution = jo_double(pLattice, "resolution", 1);
+		double quantum = jo_double(pLattice, "quantum", 0.001);
+		int rc = bakeLattice(resolution, quantum);
+		if (rc) {
+			return rc;
+		}
+	} else if (pLattice) {
+		LOGERROR("MappedPointFilter::configure() expected lattice file path or JSON object");
+		return -EINVAL;
+	}
+
+	json_t *pOctree = json_object_get(pConfig, "octree");
+	if (json_is_object(pOctree)) {
+		double tolerance = jo_double(pOctree, "tolerance", 0.001);
+		double budget = jo_double(pOctree, "budget", 1<<20);
+		int maxDepth = jo_int(pOctree, "maxDepth", 12);
+		int rc = bakeOctree(tolerance, (size_t) budget, maxDepth);
+		if (rc) {
+			return rc;
+		}
+	} else if (pOctree) {
+		LOGERROR("MappedPointFilter::configure() expected JSON object for octree");
+		return -EINVAL;
+	}
+
+	return configureStream(pConfig);
+}
+
+int MappedPointFilter::configureStream(json_t *pConfig) {
+	json_t *pCache = json_object_get(pConfig, "cache");
+	if (json_is_object(pCache)) {
+		int capacity = jo_int(pCache, "capacity", 4096);
+		double quantum = jo_double(pCache, "quantum", 0.001);
+		if (capacity <= 0 || capacity > CACHE_MAX_CAPACITY) {
+			LOGERROR2("MappedPointFilter::configure() cache capacity:%d expected 1..%d", capacity, CACHE_MAX_CAPACITY);
+			return -EINVAL;
+		}
+		int rc = configureCache(capacity, quantum);
+		if (rc) {
+			return rc;
+		}
+	} else if (pCache) {
+		LOGERROR("MappedPointFilter::configure() expected JSON object for cache");
+		return -EINVAL;
+	}
+
+	json_t *pFormat = json_object_get(pConfig, "format");
+	if (pFormat && matcher.configureFormat(pFormat)) {
+		return -EINVAL;
+	}
 
 	return 0;
 }
 
+int MappedPointFilter::bakeLattice(double resolution, double quantum) {
+	editModel("bakeLattice");
+	GCoord domainMin, domainMax;
+	model->field = FIELD_NONE;
+	int rc = model->domainBounds(domainMin, domainMax);
+	if (rc == 0) {
+		rc = model->lattice.bake(*this, domainMin, domainMax, resolution, quantum);
+	}
+	if (rc == 0) {
+		model->field = FIELD_LATTICE;
+	}
+	cache.clear();
+	return rc;
+}
+
+int MappedPointFilter::loadLattice(const char *path) {
+	editModel("loadLattice");
+	int rc = model->lattice.load(path);
+	model->field = rc == 0 ? FIELD_LATTICE : FIELD_NONE;
+	cache.clear();
+	return rc;
+}
+
+int MappedPointFilter::bakeOctree(double tolerance, size_t budget, int maxDepth) {
+	editModel("bakeOctree");
+	GCoord domainMin, domainMax;
+	model->field = FIELD_NONE;
+	int rc = model->domainBounds(domainMin, domainMax);
+	if (rc == 0) {
+		rc = model->octree.build(*this, domainMin, domainMax, tolerance, budget, maxDepth);
+	}
+	if (rc == 0) {
+		model->field = FIELD_OCTREE;
+	}
+	cache.clear();
+	return rc;
+}
+
 void MappedPointFilter::mapPoint(GCoord domain, GCoord range) {
-    if (domainRadius == 0 || mapping.size() == 0) {
-        domainRadius = sqrt(domain.norm2);
-		LOGINFO1("MappedPointFilter() domainRadius:%g", domainRadius);
+	editModel("mapPoint");
+    if (model->domainRadius == 0 || model->size() == 0) {
+        model->domainRadius = sqrt(domain.norm2);
+		LOGINFO1("MappedPointFilter() domainRadius:%g", model->domainRadius);
     }
 
-    MappedPoint &po = mapping[domain];
+    model->stage();
+    MappedPoint &po = model->mapping[domain];
     po.domain = domain;
     po.range = range;
+	model->indexDirty = TRUE;
+	cache.clear();
+	if (model->field != FIELD_NONE) {
+		LOGWARN("MappedPointFilter::mapPoint() baked correction field no longer used");
+		model->field = FIELD_NONE;
+	}
+}
+
+void MappedPointFilter::buildIndex() {
+	model->buildIndex();
+	layerHints.assign(model->layers.size(), -1);
+	meshHint = -1;
+	cacheCount = 0;
 }
 
 GCoord MappedPointFilter::interpolate(GCoord domain) {
-    switch (mapping.size()) {
+	GCoord range;
+	if (cache.isEnabled()) {
+		if (cache.lookup(domain, range)) {
+			return range;
+		}
+		range = interpolatePoint(domain);
+		cache.insert(domain, range);
+		return range;
+	}
+	return interpolatePoint(domain);
+}
+
+GCoord MappedPointFilter::interpolatePoint(GCoord domain) {
+	if (model->field != FIELD_NONE) {
+		GCoord range;
+		bool inside = model->field == FIELD_LATTICE ? 
+			model->lattice.interpolate(domain, range) : 
+			model->octree.interpolate(domain, range);
+		if (inside) {
+			range.trunc(5);
+			return range;
+		}
+		LOGTRACE1("interpolate(%s) outside correction field", domain.toString().c_str());
+	}
+
+    if (model->indexDirty) {
+		buildIndex();
+    }
+    switch (model->store.size()) {
     case 0: 	// No transformation
 		LOGTRACE("no interpolation mapping");
         return domain;
     case 1: 	// a single mapped point defines a universal translation
-		return domain + mapping.begin()->second.range - mapping.begin()->second.domain;
+		return domain + model->store.range(0) - model->store.domain(0);
     case 2: 
         LOGERROR("2-point mapping is undefined"); // translate and scale?
         assert(FALSE);
@@ -87,21 +405,64 @@ GCoord MappedPointFilter::interpolate(GCoord domain) {
         break;
     }
 
+	if (model->interpolation == INTERPOLATE_DELAUNAY) {
+		if (model->indexDirty) {
+			buildIndex();
+		}
+		// walk from the last tetrahedron, or from one of the nearest mapped point
+		int tet = meshHint < 0 ? -1 : model->mesh.locate(domain, meshHint);
+		if (tet >= 0 && tet == meshHint) {
+			coherence.hits++;
+		} else {
+			coherence.misses++;
+			KdHit hit;
+			if (tet < 0 && model->index.nearest(domain, 1, DBL_MAX, &hit)) {
+				tet = model->mesh.locate(domain, model->mesh.vertexTet(hit.index));
+			}
+		}
+		if (tet >= 0) {
+			meshHint = tet;
+			GCoord range = model->mesh.map(tet, domain);
+			range.trunc(5);
+			LOGTRACE4("interpolate(%s) tetrahedron:%d => (%g,%g)", 
+				domain.toString().c_str(), tet, range.x, range.y);
+			return range;
+		}
+		LOGTRACE1("interpolate(%s) outside Delaunay mesh", domain.toString().c_str());
+	} else if (model->interpolation == INTERPOLATE_LAYERED) {
+		if (model->indexDirty) {
+			buildIndex();
+		}
+		GCoord range;
+		layerHintsPrev = layerHints;
+		if (model->layers.interpolate(domain, range, layerHints.data())) {
+			if (layerHints == layerHintsPrev) {
+				coherence.hits++;
+			} else {
+				coherence.misses++;
+			}
+			range.trunc(5);
+			LOGTRACE3("interpolate(%s) layered => (%g,%g)", 
+				domain.toString().c_str(), range.x, range.y);
+			return range;
+		}
+		LOGTRACE1("interpolate(%s) outside layered mesh", domain.toString().c_str());
+	}
+
     // interpolate point cloud using simplex barycentric interpolation
-    double maxDist2 = domainRadius * domainRadius;
-    vector<MappedPoint> neighborhood = domainNeighborhood(domain, domainRadius);
-	LOGDEBUG2("interpolate(%s) neighborhood:%d", 
-		domain.toString().c_str(), (int) neighborhood.size());
+    double maxDist2 = model->domainRadius * model->domainRadius;
+	MappedPoint neighborhood[4];
+	int n = nearestNeighborhood(domain, neighborhood);
+	LOGDEBUG2("interpolate(%s) neighborhood:%d", domain.toString().c_str(), n);
 
     GCoord range;
-	int n = neighborhood.size();
 	if (logLevel >= FIRELOG_TRACE) {
 		for (int i=0; i < n; i++) {
 			LOGTRACE3("neighborhood[%d]: %s %g", i, neighborhood[i].toString().c_str(), 
 				domain.distance2(neighborhood[i].domain));
 		}
 	}
-    switch (neighborhood.size()) {
+    switch (n) {
     case 0:		// no mapping => no change
 		range = domain;
         break;
@@ -135,7 +496,6 @@ GCoord MappedPointFilter::interpolate(GCoord domain) {
 
 	if (!range.isValid()) {
 		//cout << "weighted average" << endl;
-		int n = min(4l, (long) neighborhood.size());
 		double w[4];
 		double wt = 0;
 		range = GCoord(0,0,0);
@@ -157,82 +517,224 @@ GCoord MappedPointFilter::interpolate(GCoord domain) {
     return range;
 }
 
+void MappedPointFilter::interpolate(const double *xs, const double *ys, const double *zs,
+		double *rangeXs, double *rangeYs, double *rangeZs, size_t count) {
+	if (cache.isEnabled() || model->field != FIELD_NONE || model->size() < 4 || 
+			model->interpolation != INTERPOLATE_NEIGHBORHOOD) {
+		for (size_t i = 0; i < count; i++) {
+			GCoord range = interpolate(GCoord(xs[i], ys[i], zs[i]));
+			rangeXs[i] = range.x;
+			rangeYs[i] = range.y;
+			rangeZs[i] = range.z;
+		}
+		return;
+	}
+	if (model->indexDirty) {
+		buildIndex();
+	}
+
+	// gather the tetrahedra of a block of points, then blend them together
+	double maxDist2 = model->domainRadius * model->domainRadius;
+	SimdTetBlock block;
+	size_t lanePoint[SIMD_LANES];
+	for (size_t i = 0; i < count; ) {
+		int lanes = 0;
+		for (; i < count && lanes < SIMD_LANES; i++) {
+			GCoord domain(xs[i], ys[i], zs[i]);
+			KdHit hits[5];
+			int n = model->neighborhoodMode == NEIGHBORHOOD_KDTREE ?
+				coherentNeighbors(domain, hits) :
+				model->store.nearest(domain, 4, maxDist2, hits);
+			if (n < 4) {
+				GCoord range = interpolatePoint(domain);
+				rangeXs[i] = range.x;
+				rangeYs[i] = range.y;
+				rangeZs[i] = range.z;
+				continue;
+			}
+			block.q[0][lanes] = domain.x;
+			block.q[1][lanes] = domain.y;
+			block.q[2][lanes] = domain.z;
+			for (int v = 0; v < 4; v++) {
+				for (int a = 0; a < 3; a++) {
+					block.d[v][a][lanes] = model->store.coord(a, hits[v].index);
+					block.r[v][a][lanes] = model->store.coord(3+a, hits[v].index);
+				}
+			}
+			lanePoint[lanes++] = i;
+		}
+
+		simdBarycentric(block, lanes);
+		for (int lane = 0; lane < lanes; lane++) {
+			size_t iPoint = lanePoint[lane];
+			GCoord range;
+			if (fabs(block.det[lane]) < 1e-10) { // degenerate tetrahedron
+				range = interpolatePoint(GCoord(xs[iPoint], ys[iPoint], zs[iPoint]));
+			} else {
+				range = GCoord(block.range[0][lane], block.range[1][lane], block.range[2][lane]);
+				range.trunc(5);
+			}
+			rangeXs[iPoint] = range.x;
+			rangeYs[iPoint] = range.y;
+			rangeZs[iPoint] = range.z;
+		}
+	}
+}
+
+void MappedPointFilter::interpolate(const GCoord *domains, GCoord *ranges, size_t count) {
+	double xs[SIMD_LANES], ys[SIMD_LANES], zs[SIMD_LANES];
+	double rxs[SIMD_LANES], rys[SIMD_LANES], rzs[SIMD_LANES];
+	for (size_t base = 0; base < count; base += SIMD_LANES) {
+		int n = (int) min((size_t) SIMD_LANES, count - base);
+		for (int i = 0; i < n; i++) {
+			xs[i] = domains[base+i].x;
+			ys[i] = domains[base+i].y;
+			zs[i] = domains[base+i].z;
+		}
+		interpolate(xs, ys, zs, rxs, rys, rzs, n);
+		for (int i = 0; i < n; i++) {
+			ranges[base+i] = GCoord(rxs[i], rys[i], rzs[i]);
+		}
+	}
+}
+
 vector<MappedPoint> MappedPointFilter::domainNeighborhood(GCoord domain, double radius) {
+	if (model->neighborhoodMode == NEIGHBORHOOD_KDTREE) {
+		return indexNeighborhood(domain, radius);
+	}
+	return scanNeighborhood(domain, radius);
+}
+
+vector<MappedPoint> MappedPointFilter::indexNeighborhood(GCoord domain, double radius, int maxPoints) {
+	if (model->indexDirty) {
+		buildIndex();
+	}
     double maxDist2 = radius*radius;
     vector<MappedPoint> neighborhood;
-	double dist[4];	// sort top 4 for barycentric tetrahedron
-	for (int i=0; i < 4; i++) {
-		dist[i] = DBL_MAX;
-	}
-    for (map<GCoord,MappedPoint>::iterator ipo=mapping.begin(); ipo!=mapping.end(); ipo++) {
-        double dist2 = domain.distance2(ipo->first);
-//		cout << "neighborhood " << dist2 << *ipo << endl;
-        if (dist2 < maxDist2) {
-			bool inserted = FALSE;
-			int n = min(4, (int)neighborhood.size()+1);
-			for (int i=0; i < n; i++) {
-				if (dist2 < dist[i]) { // insert here
-					if (dist[i] < DBL_MAX) {
-						//cout << "insert@" << i<< ":" << ipo->second << " " << dist2 << " < " << dist[i] << " " << neighborhood.at(i) << endl;
-					} else {
-						//cout << "insert@" << i<< ":" << ipo->second << " " << dist2 << " < " << dist[i] << " " << endl;
-					}
-					neighborhood.insert(neighborhood.begin()+i, ipo->second);
-					for (int j=n; --j > i; ) {
-						//cout << "dist[" << j << "] " <<  dist[j] << "=" << dist[j-1] <<endl;
-						dist[j] = dist[j-1];
-					}
-					dist[i] = dist2;
-					inserted = TRUE;
-					break;
-				} else {
-					//cout << "skip@" << i<< ":" << ipo->second << dist2 << " < " << dist[i] << " " << neighborhood.at(i) << endl;
-				}
+	if (maxPoints > 0) {
+		KdHit hits[4];
+		assert(maxPoints <= 4);
+		int n = model->index.nearest(domain, maxPoints, maxDist2, hits);
+		for (int i=0; i < n; i++) {
+			neighborhood.push_back(model->store.at(hits[i].index));
+		}
+	} else {
+		vector<KdHit> hits;
+		model->index.radius(domain, maxDist2, hits);
+		for (int i=0; i < hits.size(); i++) {
+			neighborhood.push_back(model->store.at(hits[i].index));
+		}
+	}
+
+    return neighborhood;
+}
+
+int MappedPointFilter::nearestNeighborhood(GCoord domain, MappedPoint *neighborhood) {
+	KdHit hits[5];
+	int n;
+	if (model->neighborhoodMode == NEIGHBORHOOD_KDTREE) {
+		n = coherentNeighbors(domain, hits);
+	} else {
+		if (model->indexDirty) {
+			buildIndex();
+		}
+		n = model->store.nearest(domain, 4, model->domainRadius * model->domainRadius, hits);
+	}
+	for (int i = 0; i < n; i++) {
+		neighborhood[i] = model->store.at(hits[i].index);
+	}
+	return n;
+}
+
+int MappedPointFilter::coherentNeighbors(GCoord domain, KdHit *hits) {
+	if (model->indexDirty) {
+		buildIndex();
+	}
+	int n = 0;
+	if (cacheCount >= 4 && domain.distance2(cacheDomain) < cacheSlack*cacheSlack) {
+		// the four nearest are unchanged, but their order may not be
+		coherence.hits++;
+		for (int i = 0; i < 4; i++) {
+			KdHit hit = { cacheIndex[i], model->store.distance2(cacheIndex[i], domain) };
+			int j = n++;
+			for (; j > 0 && hit < hits[j-1]; j--) {
+				hits[j] = hits[j-1];
 			}
-            if (!inserted) {
-				neighborhood.push_back(ipo->second);
+			hits[j] = hit;
+		}
+	} else {
+		// the previous neighbors bound the search
+		coherence.misses++;
+		double maxDist2 = model->domainRadius * model->domainRadius;
+		if (cacheCount == 5) {
+			double bound2 = 0;
+			for (int i = 0; i < 5; i++) {
+				bound2 = max(bound2, model->store.distance2(cacheIndex[i], domain));
 			}
-        }
-    }
+			maxDist2 = min(maxDist2, bound2 * (1 + DBL_EPSILON*16) + DBL_MIN);
+		}
+		n = model->index.nearest(domain, 5, maxDist2, hits);
+		for (int i = 0; i < n; i++) {
+			cacheIndex[i] = hits[i].index;
+		}
+		cacheCount = n;
+		cacheDomain = domain;
+		if (n >= 4) {
+			// nearest four cannot change until the fourth and fifth could trade places
+			double d4 = sqrt(hits[3].dist2);
+			double d5 = n == 5 ? sqrt(hits[4].dist2) : model->domainRadius;
+			cacheSlack = (d5 - d4) / 2;
+		}
+		n = min(n, 4);
+	}
+	return n;
+}
+
+vector<MappedPoint> MappedPointFilter::scanNeighborhood(GCoord domain, double radius) {
+	if (model->indexDirty) {
+		buildIndex();
+	}
+    vector<KdHit> hits;
+	model->store.radius(domain, radius*radius, hits);
+    vector<MappedPoint> neighborhood;
+	for (int i=0; i < hits.size(); i++) {
+		neighborhood.push_back(model->store.at(hits[i].index));
+	}
 
     return neighborhood;
 }
 
 int MappedPointFilter::writeln(const char *value) {
-    int chars = matcher.match(value);
-    char buf[255];
+	return writeSpan(value, strlen(value));
+}
 
-    if (chars) {
-		GCoord domainNew  = domain;
-        if (matcher.coord.x != HUGE_VAL) {
-			domainNew.x = matcher.coord.x;
-        }
-        if (matcher.coord.y != HUGE_VAL) {
-			domainNew.y = matcher.coord.y;
-        }
-        if (matcher.coord.z != HUGE_VAL) {
-			domainNew.z = matcher.coord.z;
-        }
-		GCoord range = interpolate(domainNew);
-		char *s = buf;
-		*s++ = 'G';
-		*s++ = matcher.code.c_str()[1];
-		if (matcher.code.c_str()[1] == '2' && matcher.code.c_str()[2] == '8') {
-			*s++ = '8';
-			range = GCoord(0,0,0);
-		}
-		s += sprintf(s, "X%g", range.x);
-		s += sprintf(s, "Y%g", range.y);
-		s += sprintf(s, "Z%g", range.z);
-		s += snprintf(s, sizeof(buf)-(s-buf), "%s", value+chars);
-		*s = 0;
-        _next.writeln(buf);
-		domain = domainNew;
-    } else {
-		LOGTRACE1("MappedPointFilter::writeln(%s) (no change)", value);
-        _next.writeln(value);
-    }
+int MappedPointFilter::writeSpan(const char *text, size_t length) {
+	GBlock block(text, length);
+	return writeBlock(block);
+}
 
-    return 0;
+int MappedPointFilter::writeBlock(GBlock &block) {
+	return writeBatch(&block, 1);
 }
 
+int MappedPointFilter::writeBatch(GBlock *blocks, size_t count) {
+	GCoord position = domain;
+	for (size_t i = 0; i < count; i++) {
+		if (!blocks[i].isMove()) {
+			LOGTRACE2("MappedPointFilter::writeBatch(%.*s) (no change)", (int) blocks[i].length, blocks[i].text);
+		}
+		transform(blocks[i], position);
+	}
+	domain = position;
+
+	return _next.writeBatch(blocks, count);
+}
+
+void MappedPointFilter::reset() {
+	domain = GCoord(0,0,0);
+	layerHints.assign(layerHints.size(), -1);
+	meshHint = -1;
+	cacheCount = 0;
+	cache.clear();
+	GFilterBase::reset();
+}
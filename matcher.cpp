@@ -3,7 +3,13 @@
 #include <fstream>
 #include <sstream>
 #include <math.h>
+#include <errno.h>
 #include <cctype>
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
 #include "FireLog.h"
 #include "gfilter.hpp"
 #include "version.h"
@@ -49,70 +55,210 @@ IGCodeMatcher::matchNumber (const char *text) {
     return isNumber ? s-text-1 : 0;
 }
 
+int
+IGCodeMatcher::matchNumber (const char *text, size_t length) {
+    const char *s;
+    const char *end = text + length;
+    bool isNumber = FALSE;
+
+    for (s = text; s < end; s++) {
+        char c = *s;
+        if (c == ' ' || c == '\t') {
+            continue;
+        }
+        if (('0' <= c && c <= '9') || c == '-' || c == '+' || c == '.') {
+            isNumber = TRUE;
+            continue;
+        }
+        break;
+    }
+
+    return isNumber ? s-text : 0;
+}
+
+// Exact powers of ten for the Clinger fast path
+static const double exactPowers10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * Convert the unsigned decimal of length chars at text exactly
+ */
+static double
+parseDecimalSlow(const char *text, size_t length) {
+    double value = 0;
+#ifdef __cpp_lib_to_chars
+    std::from_chars(text, text + length, value);
+#else
+    char buf[64];
+    length = min(length, sizeof(buf) - 1);
+    memcpy(buf, text, length);
+    buf[length] = 0;
+    value = strtod(buf, NULL);
+#endif
+    return value;
+}
+
+int
+IGCodeMatcher::parseNumber (const char *text, size_t length, double &value) {
+    const char *s = text;
+    const char *end = text + length;
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    bool negative = FALSE;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+
+    const char *start = s;
+    unsigned long long mantissa = 0;
+    int significant = 0;	// digits in mantissa after leading zeros
+    int exponent = 0;		// power of ten of the last mantissa digit
+    bool fraction = FALSE;
+    bool exact = TRUE;
+    int digits = 0;
+    for (; s < end; s++) {
+        char c = *s;
+        if ('0' <= c && c <= '9') {
+            digits++;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (c - '0');
+                significant += mantissa ? 1 : 0;
+                exponent -= fraction ? 1 : 0;
+            } else {
+                exact = FALSE;	// too many digits for mantissa
+            }
+        } else if (c == '.' && !fraction) {
+            fraction = TRUE;
+        } else {
+            break;
+        }
+    }
+    if (digits == 0) {
+        return 0;
+    }
+
+    if (exact && mantissa <= (1ULL << 53) && exponent >= -22) {
+        // mantissa and power are exact, so one division rounds correctly
+        value = (double) mantissa / exactPowers10[-exponent];
+    } else {
+        value = parseDecimalSlow(start, s - start);
+    }
+    if (negative) {
+        value = -value;
+    }
+    return s - text;
+}
+
 int
 GMoveMatcher::match(const char *text) {
-    char *s;
-	char *endPtr;
-	bool loop = TRUE;
+    return match(text, strlen(text));
+}
+
+int
+GMoveMatcher::match(const char *text, size_t length) {
+    const char *s = text;
+    const char *end = text + length;
 
     code.clear ();
 	coord = GCoord();
-    for (s = (char *) text; loop; s++) {
+    while (s < end) {
+        double *pAxis = NULL;
         switch (*s) {
         case ' ':
-            continue;
         case '\t':
+            s++;
             continue;
         case 'x':
-        case 'X': {
-			s++;
-            int digits = IGCodeMatcher::matchNumber (s);
-            if (digits) {
-				endPtr = s+digits-1;
-				coord.x = strtod(s, &endPtr);
-            }
-			s = endPtr-1;
+        case 'X':
+            pAxis = &coord.x;
             break;
-        }
         case 'y':
-        case 'Y': {
-			s++;
-            int digits = IGCodeMatcher::matchNumber (s);
-            if (digits) {
-				endPtr = s+digits-1;
-				coord.y = strtod(s, &endPtr);
-            }
-			s = endPtr-1;
+        case 'Y':
+            pAxis = &coord.y;
             break;
-        }
         case 'z':
-        case 'Z': {
-			s++;
-            int digits = IGCodeMatcher::matchNumber (s);
-            if (digits) {
-				endPtr = s+digits-1;
-				coord.z = strtod(s, &endPtr);
-            }
-			s = endPtr-1;
+        case 'Z':
+            pAxis = &coord.z;
             break;
-        }
         case 'g':
-        case 'G':
-            s++;
-            if ((*s == '0' || *s == '1') && !isdigit(s[1])) {
-                code.append (s-1, 2);
-			} else if (*s == '2' && s[1] == '8' && !isdigit(s[2])) {
-                code.append (s-1, 3);
-				s++;
+        case 'G': {
+            char c1 = s+1 < end ? s[1] : 0;
+            char c2 = s+2 < end ? s[2] : 0;
+            char c3 = s+3 < end ? s[3] : 0;
+            if ((c1 == '0' || c1 == '1') && !isdigit(c2)) {
+                code.append (s, 2);
+                s += 2;
+			} else if (c1 == '2' && c2 == '8' && !isdigit(c3)) {
+                code.append (s, 3);
+                s += 3;
 			} else {
-				s--;
+				s++;
             }
-            break;
+            continue;
+        }
         default:
-            loop = false;
-			break;
+            break;
+        }
+        if (!pAxis) {
+            break;
+        }
+        int chars = IGCodeMatcher::parseNumber(s+1, end-s-1, *pAxis);
+        if (!chars) {
+            break;
         }
+        s += 1 + chars;
     }
 
-    return code.empty() ? 0 : s-text-1;
+    return code.empty() ? 0 : s-text;
+}
+
+int
+GMoveMatcher::format(char *buf, size_t bufSize, GCoord position, const char *rest, size_t restLength) const {
+	char *s = buf;
+	*s++ = 'G';
+	*s++ = code.c_str()[1];
+	if (code.c_str()[1] == '2' && code.c_str()[2] == '8') {
+		*s++ = '8';
+		position = GCoord(0,0,0);
+	}
+	*s++ = 'X';
+	s += formats[0].write(s, position.x);
+	*s++ = 'Y';
+	s += formats[1].write(s, position.y);
+	*s++ = 'Z';
+	s += formats[2].write(s, position.z);
+	size_t n = min(restLength, bufSize-1-(s-buf));
+	memcpy(s, rest, n);
+	s += n;
+	*s = 0;
+	return s - buf;
+}
+
+int
+GMoveMatcher::configureFormat(json_t *pFormat) {
+	if (json_is_string(pFormat)) {
+		CoordFormat format;
+		if (format.parse(json_string_value(pFormat))) {
+			return -EINVAL;
+		}
+		formats[0] = formats[1] = formats[2] = format;
+		return 0;
+	}
+	if (!json_is_object(pFormat)) {
+		LOGERROR("GMoveMatcher::configureFormat() expected format string or object");
+		return -EINVAL;
+	}
+	const char *axes[3] = { "x", "y", "z" };
+	for (int a = 0; a < 3; a++) {
+		json_t *pAxis = json_object_get(pFormat, axes[a]);
+		if (pAxis && (!json_is_string(pAxis) || formats[a].parse(json_string_value(pAxis)))) {
+			LOGERROR1("GMoveMatcher::configureFormat() invalid %s format", axes[a]);
+			return -EINVAL;
+		}
+	}
+	return 0;
 }
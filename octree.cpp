@@ -0,0 +1,224 @@
+#include <string.h>
+#include <iostream>
+#include <queue>
+#include <cfloat>
+#include <math.h>
+#include <errno.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// CorrectionOctree /////////////
+// Corner c of a cell is at (c&1, (c>>1)&1, (c>>2)&1) and child c of a node
+// is the octant that contains that corner.
+
+#define OCTREE_LEAF_FLOATS 24 /* 8 corners x 3 axes */
+
+typedef struct OctreeCell {
+    GCoord lo;
+    GCoord hi;
+    int node;
+    int depth;
+    double error;
+    inline bool friend operator<(const OctreeCell& lhs, const OctreeCell &rhs) {
+        return lhs.error < rhs.error;
+    }
+} OctreeCell;
+
+static inline GCoord midpoint(const GCoord &lo, const GCoord &hi) {
+    return GCoord(0.5*(lo.x+hi.x), 0.5*(lo.y+hi.y), 0.5*(lo.z+hi.z));
+}
+
+static inline double lerp(double a, double b, double t) {
+    return a + t * (b - a);
+}
+
+// Sample offsets on the 3x3x3 grid of a cell, store its corners
+// in pValues and return the largest error of trilinear interpolation
+static double sampleCell(MappedPointFilter &source, const GCoord &lo, const GCoord &hi, float *pValues) {
+    GCoord mid = midpoint(lo, hi);
+    double xs[3] = {lo.x, mid.x, hi.x};
+    double ys[3] = {lo.y, mid.y, hi.y};
+    double zs[3] = {lo.z, mid.z, hi.z};
+    double offsets[3][3][3][3];
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++) {
+                GCoord domain(xs[i], ys[j], zs[k]);
+                GCoord range = source.interpolate(domain);
+                offsets[k][j][i][0] = range.x - domain.x;
+                offsets[k][j][i][1] = range.y - domain.y;
+                offsets[k][j][i][2] = range.z - domain.z;
+            }
+        }
+    }
+    for (int c = 0; c < 8; c++) {
+        double *o = offsets[(c>>2)&1 ? 2 : 0][(c>>1)&1 ? 2 : 0][c&1 ? 2 : 0];
+        for (int a = 0; a < 3; a++) {
+            pValues[c*3+a] = (float) o[a];
+        }
+    }
+
+    double maxError2 = 0;
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++) {
+                double error2 = 0;
+                for (int a = 0; a < 3; a++) {
+                    double x00 = lerp(pValues[0*3+a], pValues[1*3+a], i/2.0);
+                    double x10 = lerp(pValues[2*3+a], pValues[3*3+a], i/2.0);
+                    double x01 = lerp(pValues[4*3+a], pValues[5*3+a], i/2.0);
+                    double x11 = lerp(pValues[6*3+a], pValues[7*3+a], i/2.0);
+                    double value = lerp(lerp(x00, x10, j/2.0), lerp(x01, x11, j/2.0), k/2.0);
+                    double e = value - offsets[k][j][i][a];
+                    error2 += e*e;
+                }
+                maxError2 = max(maxError2, error2);
+            }
+        }
+    }
+    return sqrt(maxError2);
+}
+
+CorrectionOctree::CorrectionOctree() : depth(0), maxError(0) {
+}
+
+void CorrectionOctree::clear() {
+    nodes.clear();
+    values.clear();
+    depth = 0;
+    maxError = 0;
+}
+
+size_t CorrectionOctree::bytes() const {
+    return nodes.size() * sizeof(OctreeNode) + values.size() * sizeof(float);
+}
+
+size_t CorrectionOctree::leafCount() const {
+    return values.size() / OCTREE_LEAF_FLOATS;
+}
+
+int CorrectionOctree::build(MappedPointFilter &source, GCoord domainMin, GCoord domainMax,
+                            double tolerance, size_t budget, int maxDepth) {
+    clear();
+    size_t leafBytes = sizeof(OctreeNode) + OCTREE_LEAF_FLOATS * sizeof(float);
+    size_t splitBytes = 8 * sizeof(OctreeNode) + 7 * OCTREE_LEAF_FLOATS * sizeof(float);
+    if (budget < leafBytes) {
+        LOGERROR1("CorrectionOctree::build() budget:%ld is too small", (long) budget);
+        return -EINVAL;
+    }
+    boxMin = domainMin;
+    boxMax = domainMax;
+
+    OctreeNode root = { -1, 0 };
+    nodes.push_back(root);
+    values.resize(OCTREE_LEAF_FLOATS);
+    OctreeCell cell = { boxMin, boxMax, 0, 0, 0 };
+    cell.error = sampleCell(source, boxMin, boxMax, &values[0]);
+
+    priority_queue<OctreeCell> leaves;
+    leaves.push(cell);
+    bool budgetExceeded = FALSE;
+    while (!leaves.empty()) {
+        OctreeCell parent = leaves.top();
+        if (parent.error <= tolerance) {
+            break;
+        }
+        if (parent.depth >= maxDepth) {
+            // cannot refine further, but other leaves may
+            leaves.pop();
+            maxError = max(maxError, parent.error);
+            continue;
+        }
+        if (bytes() + splitBytes > budget) {
+            budgetExceeded = TRUE;
+            break;
+        }
+        leaves.pop();
+
+        int first = nodes.size();
+        nodes[parent.node].child = first;
+        int parentValues = nodes[parent.node].values;
+        nodes[parent.node].values = -1;
+        GCoord mid = midpoint(parent.lo, parent.hi);
+        for (int c = 0; c < 8; c++) {
+            OctreeNode child = { -1, c == 0 ? parentValues : (int) (values.size() / OCTREE_LEAF_FLOATS) };
+            if (c) {
+                values.resize(values.size() + OCTREE_LEAF_FLOATS);
+            }
+            nodes.push_back(child);
+            OctreeCell childCell;
+            childCell.lo = GCoord(c&1 ? mid.x : parent.lo.x, (c>>1)&1 ? mid.y : parent.lo.y, (c>>2)&1 ? mid.z : parent.lo.z);
+            childCell.hi = GCoord(c&1 ? parent.hi.x : mid.x, (c>>1)&1 ? parent.hi.y : mid.y, (c>>2)&1 ? parent.hi.z : mid.z);
+            childCell.node = first + c;
+            childCell.depth = parent.depth + 1;
+            childCell.error = sampleCell(source, childCell.lo, childCell.hi, &values[child.values * OCTREE_LEAF_FLOATS]);
+            depth = max(depth, childCell.depth);
+            leaves.push(childCell);
+        }
+    }
+    if (!leaves.empty()) {
+        maxError = max(maxError, leaves.top().error);
+    }
+
+    char buf[100];
+    snprintf(buf, sizeof(buf), "nodes:%ld leaves:%ld depth:%d", (long) nodeCount(), (long) leafCount(), depth);
+    LOGINFO3("CorrectionOctree::build() %s bytes:%ld maxError:%g", buf, (long) bytes(), maxError);
+    if (budgetExceeded) {
+        LOGWARN2("CorrectionOctree::build() budget:%ld limits error to %g", (long) budget, maxError);
+    }
+    return 0;
+}
+
+bool CorrectionOctree::interpolate(const GCoord &domain, GCoord &range) const {
+    if (nodes.size() == 0 ||
+            !(boxMin.x <= domain.x && domain.x <= boxMax.x &&
+              boxMin.y <= domain.y && domain.y <= boxMax.y &&
+              boxMin.z <= domain.z && domain.z <= boxMax.z)) {
+        return FALSE;
+    }
+
+    GCoord lo = boxMin;
+    GCoord hi = boxMax;
+    int node = 0;
+    while (nodes[node].child >= 0) {
+        GCoord mid = midpoint(lo, hi);
+        int c = 0;
+        if (domain.x >= mid.x) {
+            c |= 1;
+            lo.x = mid.x;
+        } else {
+            hi.x = mid.x;
+        }
+        if (domain.y >= mid.y) {
+            c |= 2;
+            lo.y = mid.y;
+        } else {
+            hi.y = mid.y;
+        }
+        if (domain.z >= mid.z) {
+            c |= 4;
+            lo.z = mid.z;
+        } else {
+            hi.z = mid.z;
+        }
+        node = nodes[node].child + c;
+    }
+
+    const float *v = &values[nodes[node].values * OCTREE_LEAF_FLOATS];
+    double tx = hi.x > lo.x ? (domain.x - lo.x) / (hi.x - lo.x) : 0;
+    double ty = hi.y > lo.y ? (domain.y - lo.y) / (hi.y - lo.y) : 0;
+    double tz = hi.z > lo.z ? (domain.z - lo.z) / (hi.z - lo.z) : 0;
+    double offset[3];
+    for (int a = 0; a < 3; a++) {
+        double x00 = lerp(v[0*3+a], v[1*3+a], tx);
+        double x10 = lerp(v[2*3+a], v[3*3+a], tx);
+        double x01 = lerp(v[4*3+a], v[5*3+a], tx);
+        double x11 = lerp(v[6*3+a], v[7*3+a], tx);
+        offset[a] = lerp(lerp(x00, x10, ty), lerp(x01, x11, ty), tz);
+    }
+    range = GCoord(domain.x + offset[0], domain.y + offset[1], domain.z + offset[2]);
+    return TRUE;
+}
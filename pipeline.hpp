@@ -0,0 +1,164 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+/*
+ * Filter chains composed at compile time. Each line of a batch passes
+ * through the transform() of every stage with static calls that the
+ * compiler can inline, and the batch is then written to the sink.
+ * Requires C++11.
+ */
+
+#include "gfilter.hpp"
+
+namespace gfilter {
+
+/**
+ * Stage that applies the transform() of a configured filter. The modal
+ * position of the filter is kept in the stage from begin() to end() of a batch.
+ * The next filter given to the filter constructor is only given reset().
+ */
+template <class Filter>
+struct FilterStage {
+    Filter &filter;
+    GCoord position;
+    inline FilterStage(Filter &filter) : filter(filter) {
+    }
+    inline void begin() {
+        position = filter.getPosition();
+    }
+    inline void apply(GBlock &block) {
+        filter.transform(block, position);
+    }
+    inline void end() {
+        filter.setPosition(position);
+    }
+    inline void reset() {
+        filter.reset();
+    }
+};
+
+template <>
+struct FilterStage<DeltaFilter> {
+    DeltaFilter &filter;
+    inline FilterStage(DeltaFilter &filter) : filter(filter) {
+    }
+    inline void begin() {
+    }
+    inline void apply(GBlock &block) {
+        filter.transform(block);
+    }
+    inline void end() {
+    }
+    inline void reset() {
+        filter.reset();
+    }
+};
+
+typedef FilterStage<MappedPointFilter> MappedPointStage;
+typedef FilterStage<AxisTableFilter> AxisTableStage;
+typedef FilterStage<DeltaFilter> DeltaStage;
+
+/**
+ * Stages followed by the sink, which is the last part
+ */
+template <class... Parts>
+class PipelineChain;
+
+template <class Sink>
+class PipelineChain<Sink> {
+    protected:
+        Sink &sink;
+
+    public:
+        inline PipelineChain(Sink &sink) : sink(sink) {
+        }
+        inline void begin() {
+        }
+        inline void apply(GBlock &block) {
+        }
+        inline void end() {
+        }
+        inline int write(GBlock *blocks, size_t count) {
+            return sink.Sink::writeBatch(blocks, count);
+        }
+        inline int flush(InputEvent event) {
+            return sink.Sink::flush(event);
+        }
+        inline void reset() {
+            sink.Sink::reset();
+        }
+};
+
+template <class Stage, class... Rest>
+class PipelineChain<Stage, Rest...> : public PipelineChain<Rest...> {
+    protected:
+        Stage stage;
+
+    public:
+        template <class... Args>
+        inline PipelineChain(Stage stage, Args&... rest) : PipelineChain<Rest...>(rest...), stage(stage) {
+        }
+        inline void begin() {
+            stage.begin();
+            PipelineChain<Rest...>::begin();
+        }
+        inline void apply(GBlock &block) {
+            stage.apply(block);
+            PipelineChain<Rest...>::apply(block);
+        }
+        inline void end() {
+            stage.end();
+            PipelineChain<Rest...>::end();
+        }
+        inline void reset() {
+            stage.reset();
+            PipelineChain<Rest...>::reset();
+        }
+};
+
+/**
+ * Head of a compile time filter chain such as
+ * Pipeline<MappedPointStage, DeltaStage, BufferedSink>. It can be given to
+ * LineReader, which makes one virtual call per batch.
+ */
+template <class... Parts>
+class Pipeline : public IGFilter {
+    private:
+        PipelineChain<Parts...> chain;
+
+    public:
+        template <class... Args>
+        Pipeline(Args&... parts) : chain(parts...) {
+            _name = "Pipeline";
+        }
+        virtual int writeln(const char *value) {
+            return writeSpan(value, strlen(value));
+        }
+        virtual int writeSpan(const char *text, size_t length) {
+            GBlock block(text, length);
+            return writeBatch(&block, 1);
+        }
+        virtual int writeBlock(GBlock &block) {
+            return writeBatch(&block, 1);
+        }
+        virtual int writeBatch(GBlock *blocks, size_t count) {
+            // stage positions of a local chain can live in registers
+            PipelineChain<Parts...> batch(chain);
+            batch.begin();
+            for (size_t i = 0; i < count; i++) {
+                batch.apply(blocks[i]);
+            }
+            batch.end();
+            return batch.write(blocks, count);
+        }
+        virtual int flush(InputEvent event=INPUT_END) {
+            return chain.flush(event);
+        }
+        virtual void reset() {
+            chain.reset();
+        }
+};
+
+} // namespace gfilter
+
+#endif
@@ -0,0 +1,155 @@
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+#include "simd.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// PointStore /////////////
+
+PointStore::PointStore() : precision(PRECISION_DOUBLE), count(0) {
+}
+
+void PointStore::clear() {
+    for (int a = 0; a < 6; a++) {
+        doubles[a].clear();
+        floats[a].clear();
+    }
+    count = 0;
+}
+
+void PointStore::build(const map<GCoord, MappedPoint> &mapping) {
+    clear();
+    count = mapping.size();
+    for (int a = 0; a < 6; a++) {
+        if (precision == PRECISION_FLOAT) {
+            floats[a].reserve(count);
+        } else {
+            doubles[a].reserve(count);
+        }
+    }
+    for (map<GCoord,MappedPoint>::const_iterator ipo=mapping.begin(); ipo!=mapping.end(); ipo++) {
+        const GCoord &d = ipo->second.domain;
+        const GCoord &r = ipo->second.range;
+        double values[6] = { d.x, d.y, d.z, r.x, r.y, r.z };
+        for (int a = 0; a < 6; a++) {
+            if (precision == PRECISION_FLOAT) {
+                floats[a].push_back((float) values[a]);
+            } else {
+                doubles[a].push_back(values[a]);
+            }
+        }
+    }
+}
+
+void PointStore::setPrecision(PointPrecision value) {
+    if (value == precision) {
+        return;
+    }
+    for (int a = 0; a < 6; a++) {
+        if (value == PRECISION_FLOAT) {
+            floats[a].assign(doubles[a].begin(), doubles[a].end());
+            vector<double>().swap(doubles[a]);
+        } else {
+            doubles[a].assign(floats[a].begin(), floats[a].end());
+            vector<float>().swap(floats[a]);
+        }
+    }
+    precision = value;
+}
+
+vector<MappedPoint> PointStore::points() const {
+    vector<MappedPoint> result;
+    result.reserve(count);
+    for (int i = 0; i < count; i++) {
+        result.push_back(at(i));
+    }
+    return result;
+}
+
+#define SCAN_BLOCK 256 /* distances per SIMD call */
+
+static inline void insertHit(KdHit *hits, int &n, int k, const KdHit &hit) {
+    int j = n < k ? n++ : k-1;
+    for (; j > 0 && hit < hits[j-1]; j--) {
+        hits[j] = hits[j-1];
+    }
+    hits[j] = hit;
+}
+
+// Ordinals ascend, so points at equal distances keep their order
+static void selectNearest(const double *dist2, int base, int count, int k, double maxDist2, KdHit *hits, int &n) {
+    for (int i = 0; i < count; i++) {
+        if (dist2[i] < maxDist2 && (n < k || dist2[i] < hits[k-1].dist2)) {
+            KdHit hit = { base + i, dist2[i] };
+            insertHit(hits, n, k, hit);
+        }
+    }
+}
+
+static void selectRadius(const double *dist2, int base, int count, double maxDist2, vector<KdHit> &hits) {
+    for (int i = 0; i < count; i++) {
+        if (dist2[i] < maxDist2) {
+            KdHit hit = { base + i, dist2[i] };
+            hits.push_back(hit);
+        }
+    }
+}
+
+static void floatDistance2(const float *xs, const float *ys, const float *zs, int count, 
+                           const GCoord &c, double *dist2) {
+    for (int i = 0; i < count; i++) {
+        double dx = xs[i] - c.x;
+        double dy = ys[i] - c.y;
+        double dz = zs[i] - c.z;
+        dist2[i] = dx*dx + dy*dy + dz*dz;
+    }
+}
+
+void PointStore::distances(const GCoord &c, int base, int count, double *dist2) const {
+    if (precision == PRECISION_FLOAT) {
+        floatDistance2(&floats[0][base], &floats[1][base], &floats[2][base], count, c, dist2);
+    } else {
+        simdDistance2(&doubles[0][base], &doubles[1][base], &doubles[2][base], count, c.x, c.y, c.z, dist2);
+    }
+}
+
+int PointStore::nearest(const GCoord &c, int k, double maxDist2, KdHit *hits) const {
+    int n = 0;
+    if (k <= 0) {
+        return 0;
+    }
+    double dist2[SCAN_BLOCK];
+    for (int base = 0; base < count; base += SCAN_BLOCK) {
+        int m = min((int) count - base, SCAN_BLOCK);
+        distances(c, base, m, dist2);
+        selectNearest(dist2, base, m, k, maxDist2, hits, n);
+    }
+    return n;
+}
+
+void PointStore::radius(const GCoord &c, double maxDist2, vector<KdHit> &hits) const {
+    hits.clear();
+    double dist2[SCAN_BLOCK];
+    for (int base = 0; base < count; base += SCAN_BLOCK) {
+        int m = min((int) count - base, SCAN_BLOCK);
+        distances(c, base, m, dist2);
+        selectRadius(dist2, base, m, maxDist2, hits);
+    }
+    sort(hits.begin(), hits.end());
+}
+
+size_t PointStore::bytes() const {
+    return count * 6 * (precision == PRECISION_FLOAT ? sizeof(float) : sizeof(double));
+}
+
+size_t PointStore::mapBytes(size_t count) {
+    // red-black tree node: color and three links, then the key and value
+    size_t node = 4 * sizeof(void *) + sizeof(GCoord) + sizeof(MappedPoint);
+    return count * node;
+}
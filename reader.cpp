@@ -0,0 +1,156 @@
+#include <string.h>
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// LineReader /////////////
+// Lines are split with the newline masks of simdScan(), one window of
+// SCAN_WINDOW bytes at a time so that the masks stay on the stack.
+// Lines are parsed into blocks and written LINE_BATCH blocks at a time.
+
+#define SCAN_WINDOW 4096
+
+LineReader::LineReader(IGFilter &filter, size_t blockSize) 
+    : filter(filter), blockSize(blockSize), lines(0), batch(LINE_BATCH) {
+}
+
+int LineReader::writeLines(const char *text, size_t length, bool final, size_t &consumed) {
+    unsigned long long newlines[SCAN_WINDOW / SIMD_SCAN_BYTES];
+    const char *s = text;
+    const char *end = text + length;
+    size_t n = 0;	// lines in batch
+    int rc = 0;
+    for (size_t window = 0; window < length; window += SCAN_WINDOW) {
+        size_t windowLength = min((size_t) SCAN_WINDOW, length - window);
+        simdScan(text + window, windowLength, newlines, NULL, NULL);
+        for (size_t w = 0; w * SIMD_SCAN_BYTES < windowLength; w++) {
+            const char *block = text + window + w * SIMD_SCAN_BYTES;
+            for (unsigned long long mask = newlines[w]; mask; mask &= mask - 1) {
+                const char *eol = block + scanBit(mask);
+                batch[n++].parse(s, eol - s);
+                s = eol + 1;
+                if (n == batch.size()) {
+                    int rcBatch = filter.writeBatch(&batch[0], n);
+                    rc = rc ? rc : rcBatch;
+                    lines += n;
+                    n = 0;
+                }
+            }
+        }
+    }
+    if (final && s < end) {
+        batch[n++].parse(s, end - s);	// last line has no newline
+        s = end;
+    }
+    if (n) {
+        // text may be reused after return
+        int rcBatch = filter.writeBatch(&batch[0], n);
+        rc = rc ? rc : rcBatch;
+        lines += n;
+    }
+    consumed = s - text;
+    return rc;
+}
+
+int LineReader::readFile(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGERROR1("LineReader::readFile(%s) open failed", path);
+        return -errno;
+    }
+#ifdef _MSC_VER
+    int rc = readFd(fd);
+    close(fd);
+    return rc;
+#else
+    struct stat st;
+    if (fstat(fd, &st)) {
+        LOGERROR1("LineReader::readFile(%s) fstat failed", path);
+        close(fd);
+        return -errno;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        // pipes and devices cannot be mapped
+        int rc = readFd(fd);
+        close(fd);
+        return rc;
+    }
+    size_t length = st.st_size;
+    if (length == 0) {
+        close(fd);
+        return 0;
+    }
+    void *pData = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pData == MAP_FAILED) {
+        LOGERROR1("LineReader::readFile(%s) mmap failed", path);
+        return -errno;
+    }
+    madvise(pData, length, MADV_SEQUENTIAL);
+    size_t consumed;
+    int rc = writeLines((const char *) pData, length, TRUE, consumed);
+    munmap(pData, length);
+    int rcFlush = filter.flush(INPUT_END);
+    LOGINFO3("LineReader::readFile(%s) bytes:%ld lines:%ld", path, (long) length, lines);
+    return rc ? rc : rcFlush;
+#endif
+}
+
+int LineReader::readText(const char *text, size_t length) {
+    size_t consumed;
+    return writeLines(text, length, TRUE, consumed);
+}
+
+int LineReader::readFd(int fd) {
+    vector<char> buf(blockSize);
+    size_t used = 0;	// bytes of an unfinished line at the start of buf
+    int rc = 0;
+    for (;;) {
+        if (used == buf.size()) {
+            buf.resize(buf.size() * 2);	// line longer than a block
+        }
+#ifndef _MSC_VER
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) == 0) {
+            rc = filter.flush(INPUT_IDLE);	// read would block
+            if (rc) {
+                break;
+            }
+        }
+#endif
+        ssize_t n = read(fd, &buf[used], buf.size() - used);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGERROR1("LineReader::readFd(%d) read failed", fd);
+            return -errno;
+        }
+        if (n == 0) {
+            size_t consumed;
+            rc = writeLines(&buf[0], used, TRUE, consumed);
+            break;
+        }
+        used += n;
+        size_t consumed;
+        rc = writeLines(&buf[0], used, FALSE, consumed);
+        if (rc) {
+            break;	// output was lost, so the rest is not read
+        }
+        memmove(&buf[0], &buf[consumed], used - consumed);
+        used -= consumed;
+    }
+    int rcFlush = filter.flush(INPUT_END);
+    return rc ? rc : rcFlush;
+}
@@ -0,0 +1,184 @@
+#include <string.h>
+#include <iostream>
+#include <math.h>
+#include "FireLog.h"
+#include "gfilter.hpp"
+#include "simd.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// SIMD dispatch /////////////
+// The scalar kernels evaluate the same expressions in the same order as
+// GCoord::barycentric() and Mat3x3::inverse(), and the vector kernels
+// mirror them lane by lane without fused multiply-add. Batch results
+// therefore match the scalar path exactly unless the compiler contracts
+// the scalar path into fused multiply-adds, which perturbs the last bits.
+
+static SimdLevel supportedLevel() {
+#ifdef GFILTER_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+static SimdLevel activeLevel = supportedLevel();
+
+SimdLevel gfilter::simdLevel() {
+    return activeLevel;
+}
+
+SimdLevel gfilter::setSimdLevel(SimdLevel level) {
+    SimdLevel supported = supportedLevel();
+    activeLevel = level < supported ? level : supported;
+    LOGINFO1("setSimdLevel() %s", simdLevelName(activeLevel));
+    return activeLevel;
+}
+
+const char *gfilter::simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+void gfilter::simdDistance2(const double *xs, const double *ys, const double *zs, int count,
+                            double cx, double cy, double cz, double *dist2) {
+    switch (activeLevel) {
+#ifdef GFILTER_SIMD_X86
+    case SIMD_AVX2:
+        distance2Avx2(xs, ys, zs, 0, count, cx, cy, cz, dist2);
+        break;
+    case SIMD_SSE2:
+        distance2Sse2(xs, ys, zs, 0, count, cx, cy, cz, dist2);
+        break;
+#endif
+    default:
+        distance2Scalar(xs, ys, zs, 0, count, cx, cy, cz, dist2);
+        break;
+    }
+}
+
+void gfilter::simdBarycentric(SimdTetBlock &block, int count) {
+    switch (activeLevel) {
+#ifdef GFILTER_SIMD_X86
+    case SIMD_AVX2:
+        barycentricAvx2(block, 0, count);
+        break;
+    case SIMD_SSE2:
+        barycentricSse2(block, 0, count);
+        break;
+#endif
+    default:
+        barycentricScalar(block, 0, count);
+        break;
+    }
+}
+
+void gfilter::simdScan(const char *text, size_t length,
+                       unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes) {
+    size_t masks = (length + SIMD_SCAN_BYTES - 1) / SIMD_SCAN_BYTES;
+    switch (activeLevel) {
+#ifdef GFILTER_SIMD_X86
+    case SIMD_AVX2:
+        scanAvx2(text, length, 0, masks, newlines, comments, axes);
+        break;
+    case SIMD_SSE2:
+        scanSse2(text, length, 0, masks, newlines, comments, axes);
+        break;
+#endif
+    default:
+        scanScalar(text, length, 0, masks, newlines, comments, axes);
+        break;
+    }
+}
+
+void gfilter::distance2Scalar(const double *xs, const double *ys, const double *zs, int begin, int end,
+                              double cx, double cy, double cz, double *dist2) {
+    for (int i = begin; i < end; i++) {
+        double dx = xs[i] - cx;
+        double dy = ys[i] - cy;
+        double dz = zs[i] - cz;
+        dist2[i] = dx*dx + dy*dy + dz*dz;
+    }
+}
+
+void gfilter::barycentricScalar(SimdTetBlock &b, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        // columns of m are the edges from vertex 3 to vertices 0,1,2
+        double m[3][3];
+        for (int y = 0; y < 3; y++) {
+            for (int x = 0; x < 3; x++) {
+                m[y][x] = b.d[x][y][i] - b.d[3][y][i];
+            }
+        }
+        double det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                     - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                     + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        b.det[i] = det;
+        double rdet = 1.0/det;
+        double inv[3][3];
+        inv[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * rdet;
+        inv[0][1] = -((m[0][1]*m[2][2] - m[0][2]*m[2][1]) * rdet);
+        inv[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * rdet;
+        inv[1][0] = -((m[1][0]*m[2][2] - m[1][2]*m[2][0]) * rdet);
+        inv[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * rdet;
+        inv[1][2] = -((m[0][0]*m[1][2] - m[0][2]*m[1][0]) * rdet);
+        inv[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * rdet;
+        inv[2][1] = -((m[0][0]*m[2][1] - m[0][1]*m[2][0]) * rdet);
+        inv[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * rdet;
+        double p[3];
+        for (int a = 0; a < 3; a++) {
+            p[a] = b.q[a][i] - b.d[3][a][i];
+        }
+        double bc[3];
+        for (int y = 0; y < 3; y++) {
+            bc[y] = inv[y][0]*p[0] + inv[y][1]*p[1] + inv[y][2]*p[2];
+        }
+        double bc3 = 1 - (bc[0]+bc[1]+bc[2]);
+        for (int a = 0; a < 3; a++) {
+            b.range[a][i] = bc[0]*b.r[0][a][i] + bc[1]*b.r[1][a][i] + bc[2]*b.r[2][a][i] + bc3*b.r[3][a][i];
+        }
+    }
+}
+
+void gfilter::scanScalar(const char *text, size_t length, size_t begin, size_t end,
+                         unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes) {
+    for (size_t w = begin; w < end; w++) {
+        unsigned long long newline = 0;
+        unsigned long long comment = 0;
+        unsigned long long axis = 0;
+        size_t first = w * SIMD_SCAN_BYTES;
+        size_t last = first + SIMD_SCAN_BYTES < length ? first + SIMD_SCAN_BYTES : length;
+        for (size_t i = first; i < last; i++) {
+            char c = text[i];
+            unsigned long long bit = 1ULL << (i - first);
+            if (c == '\n') {
+                newline |= bit;
+            } else if (c == ';' || c == '(') {
+                comment |= bit;
+            } else if ((unsigned char) ((c | 0x20) - 'x') < 3) {
+                axis |= bit;
+            }
+        }
+        if (newlines) {
+            newlines[w] = newline;
+        }
+        if (comments) {
+            comments[w] = comment;
+        }
+        if (axes) {
+            axes[w] = axis;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+/*
+ * Batch kernels with runtime instruction set dispatch. The SSE2 and AVX2
+ * kernels are compiled in their own translation units with -msse2 or -mavx2,
+ * so this header must not pull in inline functions from other headers
+ * beyond <stddef.h>.
+ */
+
+#include <stddef.h>
+
+namespace gfilter {
+
+typedef enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+} SimdLevel;
+
+#define SIMD_LANES 64 /* tetrahedra per SimdTetBlock */
+
+/**
+ * Tetrahedra and query points in structure of arrays layout. Lane i
+ * blends the ranges of vertices d[0..3] by the barycentric coordinates of
+ * q[.][i]. Lanes whose |det| is below 1e-10 are degenerate and their range
+ * is undefined.
+ */
+typedef struct SimdTetBlock {
+    double q[3][SIMD_LANES];		// query domain x,y,z
+    double d[4][3][SIMD_LANES];		// vertex domain x,y,z
+    double r[4][3][SIMD_LANES];		// vertex range x,y,z
+    double range[3][SIMD_LANES];	// blended range x,y,z
+    double det[SIMD_LANES];			// determinant of vertex edge matrix
+} SimdTetBlock;
+
+/**
+ * Return the best instruction set supported by this processor,
+ * or the level given to setSimdLevel()
+ */
+SimdLevel simdLevel();
+
+/**
+ * Use level or the best supported level below it
+ * @return level used
+ */
+SimdLevel setSimdLevel(SimdLevel level);
+const char *simdLevelName(SimdLevel level);
+
+/**
+ * Square of distance from (cx,cy,cz) to each of count points
+ */
+void simdDistance2(const double *xs, const double *ys, const double *zs, int count,
+                   double cx, double cy, double cz, double *dist2);
+
+/**
+ * Barycentric blend of the first count lanes of block
+ */
+void simdBarycentric(SimdTetBlock &block, int count);
+
+#define SIMD_SCAN_BYTES 64 /* bytes of text per scan mask */
+
+/**
+ * Classify the length bytes at text in one pass. Bit i of mask[w] is set
+ * if byte SIMD_SCAN_BYTES*w+i is a newline, a comment start (';' or '(')
+ * or an axis letter (XYZxyz). Each mask array must hold
+ * (length+SIMD_SCAN_BYTES-1)/SIMD_SCAN_BYTES masks; bits past length are clear.
+ * Mask arrays that are not needed may be NULL.
+ */
+void simdScan(const char *text, size_t length,
+              unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes);
+
+/**
+ * Return the index of the lowest set bit of a non-zero mask
+ */
+static inline int scanBit(unsigned long long mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int i = 0;
+    for (; !(mask & 1); mask >>= 1) {
+        i++;
+    }
+    return i;
+#endif
+}
+
+// instruction set kernels process lanes [begin,end)
+void distance2Scalar(const double *xs, const double *ys, const double *zs, int begin, int end,
+                     double cx, double cy, double cz, double *dist2);
+void distance2Sse2(const double *xs, const double *ys, const double *zs, int begin, int end,
+                   double cx, double cy, double cz, double *dist2);
+void distance2Avx2(const double *xs, const double *ys, const double *zs, int begin, int end,
+                   double cx, double cy, double cz, double *dist2);
+void barycentricScalar(SimdTetBlock &block, int begin, int end);
+void barycentricSse2(SimdTetBlock &block, int begin, int end);
+void barycentricAvx2(SimdTetBlock &block, int begin, int end);
+
+// scan kernels process masks [begin,end)
+void scanScalar(const char *text, size_t length, size_t begin, size_t end,
+                unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes);
+void scanSse2(const char *text, size_t length, size_t begin, size_t end,
+              unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes);
+void scanAvx2(const char *text, size_t length, size_t begin, size_t end,
+              unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes);
+
+} // namespace gfilter
+
+#endif
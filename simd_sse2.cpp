@@ -0,0 +1,120 @@
+#include <emmintrin.h>
+#include "simd.hpp"
+
+using namespace gfilter;
+
+////////////// Sse2 kernels /////////////
+// Compiled with -msse2. Lane for lane, these evaluate the same
+// expressions as the scalar kernels in simd.cpp.
+
+typedef __m128d vec;
+#define LANES 2
+#define load(p) _mm_loadu_pd(p)
+#define store(p,v) _mm_storeu_pd(p,v)
+#define set1(x) _mm_set1_pd(x)
+#define add(a,b) _mm_add_pd(a,b)
+#define sub(a,b) _mm_sub_pd(a,b)
+#define mul(a,b) _mm_mul_pd(a,b)
+#define div(a,b) _mm_div_pd(a,b)
+#define neg(a) _mm_xor_pd(a, set1(-0.0))
+
+void gfilter::distance2Sse2(const double *xs, const double *ys, const double *zs, int begin, int end,
+                              double cx, double cy, double cz, double *dist2) {
+    vec vcx = set1(cx);
+    vec vcy = set1(cy);
+    vec vcz = set1(cz);
+    int i = begin;
+    for (; i + LANES <= end; i += LANES) {
+        vec dx = sub(load(xs+i), vcx);
+        vec dy = sub(load(ys+i), vcy);
+        vec dz = sub(load(zs+i), vcz);
+        store(dist2+i, add(add(mul(dx,dx), mul(dy,dy)), mul(dz,dz)));
+    }
+    distance2Scalar(xs, ys, zs, i, end, cx, cy, cz, dist2);
+}
+
+void gfilter::barycentricSse2(SimdTetBlock &b, int begin, int end) {
+    int i = begin;
+    for (; i + LANES <= end; i += LANES) {
+        vec m[3][3];
+        for (int y = 0; y < 3; y++) {
+            vec d3 = load(&b.d[3][y][i]);
+            for (int x = 0; x < 3; x++) {
+                m[y][x] = sub(load(&b.d[x][y][i]), d3);
+            }
+        }
+        vec c00 = sub(mul(m[1][1],m[2][2]), mul(m[1][2],m[2][1]));
+        vec c01 = sub(mul(m[1][0],m[2][2]), mul(m[1][2],m[2][0]));
+        vec c02 = sub(mul(m[1][0],m[2][1]), mul(m[1][1],m[2][0]));
+        vec det = add(sub(mul(m[0][0],c00), mul(m[0][1],c01)), mul(m[0][2],c02));
+        store(&b.det[i], det);
+        vec rdet = div(set1(1.0), det);
+        vec inv[3][3];
+        inv[0][0] = mul(c00, rdet);
+        inv[0][1] = neg(mul(sub(mul(m[0][1],m[2][2]), mul(m[0][2],m[2][1])), rdet));
+        inv[0][2] = mul(sub(mul(m[0][1],m[1][2]), mul(m[0][2],m[1][1])), rdet);
+        inv[1][0] = neg(mul(c01, rdet));
+        inv[1][1] = mul(sub(mul(m[0][0],m[2][2]), mul(m[0][2],m[2][0])), rdet);
+        inv[1][2] = neg(mul(sub(mul(m[0][0],m[1][2]), mul(m[0][2],m[1][0])), rdet));
+        inv[2][0] = mul(c02, rdet);
+        inv[2][1] = neg(mul(sub(mul(m[0][0],m[2][1]), mul(m[0][1],m[2][0])), rdet));
+        inv[2][2] = mul(sub(mul(m[0][0],m[1][1]), mul(m[0][1],m[1][0])), rdet);
+        vec p[3];
+        for (int a = 0; a < 3; a++) {
+            p[a] = sub(load(&b.q[a][i]), load(&b.d[3][a][i]));
+        }
+        vec bc[3];
+        for (int y = 0; y < 3; y++) {
+            bc[y] = add(add(mul(inv[y][0],p[0]), mul(inv[y][1],p[1])), mul(inv[y][2],p[2]));
+        }
+        vec bc3 = sub(set1(1.0), add(add(bc[0],bc[1]),bc[2]));
+        for (int a = 0; a < 3; a++) {
+            vec range = add(add(add(
+                mul(bc[0], load(&b.r[0][a][i])),
+                mul(bc[1], load(&b.r[1][a][i]))),
+                mul(bc[2], load(&b.r[2][a][i]))),
+                mul(bc3, load(&b.r[3][a][i])));
+            store(&b.range[a][i], range);
+        }
+    }
+    barycentricScalar(b, i, end);
+}
+
+void gfilter::scanSse2(const char *text, size_t length, size_t begin, size_t end,
+                       unsigned long long *newlines, unsigned long long *comments, unsigned long long *axes) {
+    const __m128i vnewline = _mm_set1_epi8('\n');
+    const __m128i vsemicolon = _mm_set1_epi8(';');
+    const __m128i vparen = _mm_set1_epi8('(');
+    const __m128i vcase = _mm_set1_epi8(0x20);
+    const __m128i vx = _mm_set1_epi8('x');
+    const __m128i vy = _mm_set1_epi8('y');
+    const __m128i vz = _mm_set1_epi8('z');
+    size_t w = begin;
+    for (; w < end && (w + 1) * SIMD_SCAN_BYTES <= length; w++) {
+        const char *block = text + w * SIMD_SCAN_BYTES;
+        unsigned long long newline = 0;
+        unsigned long long comment = 0;
+        unsigned long long axis = 0;
+        for (int k = 0; k < SIMD_SCAN_BYTES; k += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (block + k));
+            __m128i lower = _mm_or_si128(bytes, vcase);
+            __m128i isNewline = _mm_cmpeq_epi8(bytes, vnewline);
+            __m128i isComment = _mm_or_si128(_mm_cmpeq_epi8(bytes, vsemicolon), _mm_cmpeq_epi8(bytes, vparen));
+            __m128i isAxis = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, vx), _mm_cmpeq_epi8(lower, vy)),
+                                        _mm_cmpeq_epi8(lower, vz));
+            newline |= (unsigned long long) (unsigned) _mm_movemask_epi8(isNewline) << k;
+            comment |= (unsigned long long) (unsigned) _mm_movemask_epi8(isComment) << k;
+            axis |= (unsigned long long) (unsigned) _mm_movemask_epi8(isAxis) << k;
+        }
+        if (newlines) {
+            newlines[w] = newline;
+        }
+        if (comments) {
+            comments[w] = comment;
+        }
+        if (axes) {
+            axes[w] = axis;
+        }
+    }
+    scanScalar(text, length, w, end, newlines, comments, axes);
+}
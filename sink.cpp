@@ -0,0 +1,174 @@
+#include <string.h>
+#include <iostream>
+#include <errno.h>
+#include <time.h>
+#ifndef _MSC_VER
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// BufferedSink /////////////
+// Lines that do not fit are written together with the buffer by one
+// writev(), so a full buffer never costs more than one system call.
+
+static double millis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+BufferedSink::BufferedSink(int fd, size_t bufferSize, FlushPolicy policy) 
+    : fd(fd), used(0), policy(policy), latencyMs(50), firstTime(0), firstWrite(0), writes(0), sendFlags(0) {
+    _name = "BufferedSink";
+    setBufferSize(bufferSize);
+}
+
+BufferedSink::~BufferedSink() {
+    flush(INPUT_END);
+}
+
+void BufferedSink::setBufferSize(size_t bytes) {
+    flush(INPUT_END);
+    buffer.resize(max(bytes, (size_t) 1));
+}
+
+int BufferedSink::setFd(int fd) {
+    int rc = flush(INPUT_END);
+    this->fd = fd;
+    firstWrite = 0;
+    return rc;
+}
+
+int BufferedSink::writeAll(const char *text, size_t length, const char *text2, size_t length2) {
+    while (length + length2 > 0) {
+        ssize_t n;
+#ifdef _MSC_VER
+        n = write(fd, length ? text : text2, length ? length : length2);
+#else
+        struct iovec iov[2] = {
+            { (void *) text, length },
+            { (void *) text2, length2 },
+        };
+        if (sendFlags) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            n = sendmsg(fd, &msg, sendFlags);
+        } else {
+            n = length ? writev(fd, iov, 2) : write(fd, text2, length2);
+        }
+#endif
+        writes++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGERROR1("BufferedSink::writeAll() fd:%d write failed", fd);
+            return -errno;
+        }
+        if (firstWrite == 0) {
+            firstWrite = millis();
+        }
+        size_t first = min((size_t) n, length);
+        text += first;
+        length -= first;
+        text2 += n - first;
+        length2 -= n - first;
+    }
+    return 0;
+}
+
+int BufferedSink::writeln(const char *value) {
+    return writeSpan(value, strlen(value));
+}
+
+int BufferedSink::writeSpan(const char *text, size_t length) {
+    int rc = append(text, length);
+    int rcPolicy = applyPolicy();
+    return rc ? rc : rcPolicy;
+}
+
+int BufferedSink::writeBatch(GBlock *blocks, size_t count) {
+    int rc = 0;
+    for (size_t i = 0; i < count; i++) {
+        GBlock &block = blocks[i];
+        int rcBlock;
+        if (!block.modified) {
+            rcBlock = append(block.text, block.length);
+        } else if (buffer.size() - used > 255) {
+            // format in place
+            used += block.format(&buffer[used], 255);
+            buffer[used++] = '\n';
+            rcBlock = 0;
+        } else {
+            char buf[255];
+            int n = block.format(buf, sizeof(buf));
+            rcBlock = append(buf, n);
+        }
+        if (policy == FLUSH_LINE) {
+            int rcFlush = flush(INPUT_END);
+            rcBlock = rcBlock ? rcBlock : rcFlush;
+        }
+        rc = rc ? rc : rcBlock;
+    }
+    int rcPolicy = applyPolicy();
+    return rc ? rc : rcPolicy;
+}
+
+/**
+ * Copy a line into the buffer, writing the buffer first if it is full
+ */
+int BufferedSink::append(const char *text, size_t length) {
+    int rc = 0;
+    if (used + length + 1 > buffer.size()) {
+        if (length + 1 <= buffer.size()) {
+            rc = writeAll(&buffer[0], used);
+            used = 0;
+        } else {
+            // line is larger than the buffer, so write it with the buffer
+            rc = writeAll(&buffer[0], used, text, length);
+            used = 0;
+            length = 0;
+        }
+        firstTime = 0;
+    }
+    memcpy(&buffer[used], text, length);
+    used += length;
+    buffer[used++] = '\n';
+    return rc;
+}
+
+/**
+ * Write the buffer if the flush policy says so
+ */
+int BufferedSink::applyPolicy() {
+    if (policy == FLUSH_LINE) {
+        return flush(INPUT_END);
+    }
+    if (policy == FLUSH_INTERACTIVE && used) {
+        double now = millis();
+        if (firstTime == 0) {
+            firstTime = now;
+        } else if (now - firstTime >= latencyMs) {
+            return flush(INPUT_END);
+        }
+    }
+    return 0;
+}
+
+int BufferedSink::flush(InputEvent event) {
+    if (used == 0 || (event == INPUT_IDLE && policy == FLUSH_THROUGHPUT)) {
+        return 0;
+    }
+    int rc = writeAll(&buffer[0], used);
+    used = 0;
+    firstTime = 0;
+    return rc;
+}
@@ -0,0 +1,280 @@
+#include "../gfilter.hpp"
+#include "../pipeline.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace gfilter;
+
+// Benchmarks for the output path. Run target/bench after a release build.
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed, int count, long bytes) {
+	printf("%-24s %8.1fns/line %6.1fMB/s\n", name, elapsed * 1e9 / count, bytes / elapsed / 1e6);
+}
+
+void benchFormat() {
+	const int count = 1000000;
+	vector<GCoord> positions(count);
+	srand(1);
+	for (int i = 0; i < count; i++) {
+		positions[i] = GCoord(rand() % 200000 / 1000.0 - 100, rand() % 200000 / 997.0 - 100, rand() % 10000 / 1013.0);
+	}
+	const char *rest = "F3000";
+	char buf[255];
+	long bytes = 0;
+
+	// previous path
+	double start = seconds();
+	for (int i = 0; i < count; i++) {
+		char *s = buf;
+		*s++ = 'G';
+		*s++ = '1';
+		s += sprintf(s, "X%g", positions[i].x);
+		s += sprintf(s, "Y%g", positions[i].y);
+		s += sprintf(s, "Z%g", positions[i].z);
+		s += snprintf(s, sizeof(buf)-(s-buf), "%s", rest);
+		bytes += s - buf;
+	}
+	report("sprintf(%g)", seconds() - start, count, bytes);
+
+	GMoveMatcher matcher;
+	matcher.match("G1");
+	const char *specs[4] = { "general", "shortest", "fixed3", "fixed6" };
+	for (int f = 0; f < 4; f++) {
+		CoordFormat format;
+		format.parse(specs[f]);
+		matcher.formats[0] = matcher.formats[1] = matcher.formats[2] = format;
+		bytes = 0;
+		start = seconds();
+		for (int i = 0; i < count; i++) {
+			bytes += matcher.format(buf, sizeof(buf), positions[i], rest, 5);
+		}
+		report(specs[f], seconds() - start, count, bytes);
+	}
+}
+
+void benchParse() {
+	const int count = 1000000;
+	vector<string> lines(count);
+	srand(2);
+	for (int i = 0; i < count; i++) {
+		char buf[100];
+		snprintf(buf, sizeof(buf), "G1X%.3fY%.3fZ%.4f E%.5f F3000",
+			rand() % 200000 / 1000.0 - 100, rand() % 200000 / 1000.0 - 100, rand() % 10000 / 1000.0, rand() % 100000 / 1000.0);
+		lines[i] = buf;
+	}
+	GMoveMatcher matcher;
+	double start = seconds();
+	long bytes = 0;
+	for (int i = 0; i < count; i++) {
+		bytes += matcher.match(lines[i].c_str(), lines[i].size());
+	}
+	report("GMoveMatcher::match()", seconds() - start, count, bytes);
+
+	// previous path
+	start = seconds();
+	bytes = 0;
+	for (int i = 0; i < count; i++) {
+		const char *s = lines[i].c_str() + 2;
+		for (int a = 0; a < 3; a++) {
+			int chars = IGCodeMatcher::matchNumber(s + 1);
+			char buf[32];
+			memcpy(buf, s + 1, chars);
+			buf[chars] = 0;
+			char *endPtr;
+			strtod(buf, &endPtr);
+			s += 1 + (endPtr - buf);
+		}
+		bytes += s - lines[i].c_str();
+	}
+	report("matchNumber()+strtod()", seconds() - start, count, bytes);
+}
+
+// Counts lines without storing them
+typedef class CountSink:public GCodeSink {
+    public:
+        long lines;
+        CountSink() : lines(0) {}
+        virtual int writeln(const char *value) {
+            lines++;
+            return 0;
+        }
+        virtual int writeSpan(const char *text, size_t length) {
+            lines++;
+            return 0;
+        }
+} CountSink;
+
+void benchScan() {
+	string text;
+	srand(3);
+	while (text.size() < (64 << 20)) {
+		char buf[100];
+		snprintf(buf, sizeof(buf), rand() % 10 ? "G1X%.3fY%.3fE%.5f\n" : ";LAYER:%.0f %.0f %.0f\n",
+			rand() % 200000 / 1000.0 - 100, rand() % 200000 / 1000.0 - 100, rand() % 100000 / 1000.0);
+		text += buf;
+	}
+	vector<unsigned long long> newlines(text.size() / SIMD_SCAN_BYTES + 1);
+	vector<unsigned long long> comments(newlines.size());
+	vector<unsigned long long> axes(newlines.size());
+	SimdLevel best = simdLevel();
+	for (int level = SIMD_SCALAR; level <= best; level++) {
+		setSimdLevel((SimdLevel) level);
+		char name[40];
+		double start = seconds();
+		simdScan(text.c_str(), text.size(), &newlines[0], &comments[0], &axes[0]);
+		double elapsed = seconds() - start;
+		snprintf(name, sizeof(name), "simdScan(%s)", simdLevelName((SimdLevel) level));
+		printf("%-24s %8.1fMB/s\n", name, text.size() / elapsed / 1e6);
+
+		CountSink sink;
+		LineReader reader(sink);
+		snprintf(name, sizeof(name), "LineReader(%s)", simdLevelName((SimdLevel) level));
+		string path = "target/bench_scan.gcode";
+		FILE *file = fopen(path.c_str(), "wb");
+		fwrite(text.c_str(), 1, text.size(), file);
+		fclose(file);
+		start = seconds();
+		reader.readFile(path.c_str());
+		elapsed = seconds() - start;
+		printf("%-24s %8.1fMB/s\n", name, text.size() / elapsed / 1e6);
+	}
+	setSimdLevel(best);
+
+	// memchr() line splitting
+	double start = seconds();
+	long lines = 0;
+	const char *end = text.c_str() + text.size();
+	for (const char *s = text.c_str(); s < end; lines++) {
+		const char *eol = (const char *) memchr(s, '\n', end - s);
+		s = eol ? eol + 1 : end;
+	}
+	double elapsed = seconds() - start;
+	printf("%-24s %8.1fMB/s lines:%ld\n", "memchr()", text.size() / elapsed / 1e6, lines);
+}
+
+// MappedPointFilter followed by AxisTableFilter
+typedef class BenchChainFactory:public IChainFactory {
+    public:
+        json_t *config;
+        json_t *axisConfig;
+        virtual IGFilter *createChain(IGFilter &next, vector<IGFilterPtr> &filters) {
+            AxisTableFilterPtr pAxis = new AxisTableFilter(next, axisConfig);
+            filters.push_back(pAxis);
+            MappedPointFilterPtr pPof = new MappedPointFilter(*pAxis, config);
+            filters.push_back(pPof);
+            return pPof;
+        }
+} BenchChainFactory;
+
+void benchPipeline() {
+	const char *path = "target/bench_pipeline.gcode";
+	FILE *file = fopen(path, "wb");
+	srand(4);
+	long bytes = 0;
+	int count = 2000000;
+	for (int i = 0; i < count; i++) {
+		bytes += fprintf(file, i % 8 ? "G1X%.3fY%.3fZ%.2f E%.4f\n" : "; %.0f %.0f %.0f %.0f\n",
+			rand() % 200000 / 1000.0 - 100, rand() % 200000 / 1000.0 - 100, rand() % 1000 / 100.0, rand() % 1000 / 100.0);
+	}
+	fclose(file);
+	const char *json = "{\"map\":[{\"domain\":[0,0,0], \"range\":[1,2,3]}, " \
+		"{\"domain\":[100,0,0], \"range\":[101,2,3.5]}, {\"domain\":[0,100,0], \"range\":[1,102,3]}, " \
+		"{\"domain\":[0,0,100], \"range\":[1,2,103]}]}";
+	const char *axisJson = "{\"z\":{\"position\":[0,10],\"offset\":[0.5,-0.5]}}";
+	json_error_t jerr;
+	json_t *config = json_loads(json, 0, &jerr);
+	json_t *axisConfig = json_loads(axisJson, 0, &jerr);
+	int fd = open("/dev/null", O_WRONLY);
+
+	// runtime chain as built by parseArgs, line at a time
+	{
+		BufferedSink sink(fd, 1<<16, FLUSH_THROUGHPUT);
+		MappedPointFilter pof(sink, config);
+		AxisTableFilter axis(pof, axisConfig);
+		IGFilter &head = axis;
+		file = fopen(path, "rb");
+		char line[255];
+		vector<string> lines;
+		while (fgets(line, sizeof(line), file)) {
+			line[strlen(line)-1] = 0;
+			lines.push_back(line);
+		}
+		fclose(file);
+		double start = seconds();
+		for (size_t i = 0; i < lines.size(); i++) {
+			head.writeSpan(lines[i].c_str(), lines[i].size());
+		}
+		sink.flush();
+		report("chain writeSpan()", seconds() - start, count, bytes);
+	}
+
+	// runtime chain in batches
+	{
+		BufferedSink sink(fd, 1<<16, FLUSH_THROUGHPUT);
+		MappedPointFilter pof(sink, config);
+		AxisTableFilter axis(pof, axisConfig);
+		LineReader reader(axis);
+		double start = seconds();
+		reader.readFile(path);
+		report("chain writeBatch()", seconds() - start, count, bytes);
+	}
+
+	// runtime chain with the sink and each filter on its own thread
+	{
+		BufferedSink sink(fd, 1<<16, FLUSH_THROUGHPUT);
+		ThreadStage sinkStage(sink);
+		MappedPointFilter pof(sinkStage, config);
+		ThreadStage pofStage(pof);
+		AxisTableFilter axis(pofStage, axisConfig);
+		LineReader reader(axis);
+		double start = seconds();
+		reader.readFile(path);
+		report("chain ThreadStage", seconds() - start, count, bytes);
+	}
+
+	// compile time chain
+	{
+		BufferedSink sink(fd, 1<<16, FLUSH_THROUGHPUT);
+		MappedPointFilter pof(sink, config);
+		AxisTableFilter axis(sink, axisConfig);
+		Pipeline<AxisTableStage, MappedPointStage, BufferedSink> pipeline(axis, pof, sink);
+		LineReader reader(pipeline);
+		double start = seconds();
+		reader.readFile(path);
+		report("Pipeline<>", seconds() - start, count, bytes);
+	}
+	// chunks on one thread per processor
+	{
+		BufferedSink sink(fd, 1<<16, FLUSH_THROUGHPUT);
+		BenchChainFactory factory;
+		factory.config = config;
+		factory.axisConfig = axisConfig;
+		ChunkReader reader(factory, sink);
+		char name[40];
+		snprintf(name, sizeof(name), "ChunkReader(%ld)", (long) reader.getThreads());
+		double start = seconds();
+		reader.readFile(path);
+		report(name, seconds() - start, count, bytes);
+	}
+	close(fd);
+	json_decref(config);
+	json_decref(axisConfig);
+}
+
+int main() {
+	firelog_init("target/bench.log", FIRELOG_WARN);
+
+	benchFormat();
+	benchParse();
+	benchScan();
+	benchPipeline();
+}
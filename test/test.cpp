@@ -1,8 +1,34 @@
+#include <atomic>
+#include <thread>
 #include "../gfilter.hpp"
+#include "../pipeline.hpp"
 #include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <new>
 
 using namespace gfilter;
 
+// count heap allocations of the whole process, including stage threads
+static std::atomic<long> allocations(0);
+
+void *operator new(size_t size) {
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) throw() {
+	free(p);
+}
+
 void testJSONConfig() {
     const char *json =
         "{ \"map\":[ " \
@@ -58,6 +84,64 @@ void testMatchNumber() {
     cout << "testMatchNumber() PASS" << endl;
 }
 
+// matchNumber() followed by strtod() is the reference for parseNumber()
+static int strtodNumber(const char *text, size_t length, double &value) {
+	int chars = IGCodeMatcher::matchNumber(text, length);
+	string number(text, chars);
+	char *endPtr;
+	value = strtod(number.c_str(), &endPtr);
+	return endPtr - number.c_str();
+}
+
+void testParseNumber() {
+	cout << "testParseNumber() BEGIN -------" << endl;
+	double value;
+	ASSERTEQUAL(0, IGCodeMatcher::parseNumber("abc", 3, value));
+	ASSERTEQUAL(0, IGCodeMatcher::parseNumber("-.", 2, value));
+	ASSERTEQUAL(7, IGCodeMatcher::parseNumber(" \t-12.3F", 9, value));
+	ASSERTEQUAL(-12.3, value);
+	ASSERTEQUAL(3, IGCodeMatcher::parseNumber("1.2.3", 5, value));
+	ASSERTEQUAL(1.2, value);
+	ASSERTEQUAL(2, IGCodeMatcher::parseNumber("123", 2, value));
+	ASSERTEQUAL(12, value);
+	ASSERTEQUAL(3, IGCodeMatcher::parseNumber("+.5", 3, value));
+	ASSERTEQUAL(0.5, value);
+
+	// fuzz against strtod
+	const char alphabet[] = " \t0123456789..--+eX";
+	srand(2);
+	for (int i = 0; i < 100000; i++) {
+		char text[32];
+		int length = rand() % sizeof(text);
+		for (int j = 0; j < length; j++) {
+			text[j] = alphabet[rand() % (sizeof(alphabet)-1)];
+		}
+		double expected = 0;
+		value = 0;
+		int chars = IGCodeMatcher::parseNumber(text, length, value);
+		ASSERTEQUAL(strtodNumber(text, length, expected), chars);
+		if (chars) {
+			ASSERT((value == expected));
+		}
+	}
+
+	// round trip of CAM output and of long numbers
+	for (int i = 0; i < 100000; i++) {
+		char text[64];
+		double number = (rand() - RAND_MAX/2.0) / (rand() % 1000 + 1);
+		int length = i % 2 ? snprintf(text, sizeof(text), "%.*f", i % 10, number)
+			: snprintf(text, sizeof(text), "%.17f", number * (1 << (i % 40)));
+		ASSERTEQUAL(length, IGCodeMatcher::parseNumber(text, length, value));
+		ASSERT((value == strtod(text, NULL)));
+	}
+	ASSERTEQUAL(25, IGCodeMatcher::parseNumber("0.00000000000000000000001", 25, value));
+	ASSERT((value == 1e-23));
+	ASSERTEQUAL(20, IGCodeMatcher::parseNumber("12345678901234567890", 20, value));
+	ASSERT((value == 12345678901234567890.0));
+
+	cout << "testParseNumber() PASS" << endl;
+}
+
 void testGMoveMatcher() {
     GMoveMatcher matcher;
 
@@ -212,7 +296,7 @@ string loadFile(const char *path) {
     size_t length = ftell(file);
     fseek(file, 0, SEEK_SET);
 	char * pData = (char *) malloc(length+1);
-    assert(pData);
+    assert(pData != NULL);
     LOGINFO2("loadFile(%s) fread(%ld)", path, (long)length);
     size_t bytesRead = fread(pData, 1, length, file);
     if (bytesRead != length) {
@@ -235,6 +319,8 @@ void testCenter() {
     json_t *config = json_loads(json.c_str(), 0, &jerr);
     StringSink sink;
     MappedPointFilter pof(sink, config);
+	ASSERTEQUAL(INTERPOLATE_LAYERED, pof.getInterpolation());
+	pof.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
 	pof.setDomainRadius(24);// depends on grid sampling distance and pixels/mm	
 
 	int line=0;
@@ -279,6 +365,1732 @@ void testCenter() {
 	cout << "testCenter() PASS" << endl;
 }
 
+void testNeighborhoodIndex() {
+	cout << "testNeighborhoodIndex() BEGIN -------" << endl;
+
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    StringSink sink;
+    MappedPointFilter scan(sink, config);
+    MappedPointFilter kdtree(sink, config);
+	scan.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
+	kdtree.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
+	scan.setNeighborhoodMode(NEIGHBORHOOD_SCAN);
+	ASSERTEQUAL(NEIGHBORHOOD_KDTREE, kdtree.getNeighborhoodMode());
+	scan.setDomainRadius(24);
+	kdtree.setDomainRadius(24);
+
+	for (double x = -120; x <= 120; x += 7.5) {
+		for (double y = -180; y <= 100; y += 7.5) {
+			for (double z = -1.5; z <= 1.5; z += 0.5) {
+				GCoord domain(x,y,z);
+				vector<MappedPoint> expected = scan.domainNeighborhood(domain, 24);
+				vector<MappedPoint> actual = kdtree.domainNeighborhood(domain, 24);
+				ASSERTEQUAL(expected.size(), actual.size());
+				for (int i = 0; i < 4 && i < expected.size(); i++) {
+					assert(expected[i] == actual[i]);
+				}
+				assert(scan.interpolate(domain) == kdtree.interpolate(domain));
+			}
+		}
+	}
+
+	cout << "testNeighborhoodIndex() PASS" << endl;
+}
+
+void testDelaunay() {
+	cout << "testDelaunay() BEGIN -------" << endl;
+    StringSink sink;
+    MappedPointFilter xyz(sink);
+	xyz.setInterpolation(INTERPOLATE_DELAUNAY);
+	ASSERTEQUAL(INTERPOLATE_DELAUNAY, xyz.getInterpolation());
+    xyz.mapPoint(GCoord(1,1,1), GCoord(.1,.01,.001));
+    xyz.mapPoint(GCoord(1,1,2), GCoord(.1,.01,.002));
+    xyz.mapPoint(GCoord(1,2,1), GCoord(.1,.02,.001));
+    xyz.mapPoint(GCoord(1,2,2), GCoord(.1,.02,.002));
+    xyz.mapPoint(GCoord(2,1,1), GCoord(.2,.01,.001));
+    xyz.mapPoint(GCoord(2,1,2), GCoord(.2,.01,.002));
+    xyz.mapPoint(GCoord(2,2,1), GCoord(.2,.02,.001));
+    xyz.mapPoint(GCoord(2,2,2), GCoord(.2,.02,.002));
+
+	// tetrahedra fill the unit cube
+	const DelaunayMesh &mesh = xyz.getMesh();
+	assert(mesh.size() >= 5);
+	double volume = 0;
+	for (int i = 0; i < mesh.size(); i++) {
+		const DelaunayTet &t = mesh.at(i);
+		double det = 0;
+		for (int j = 0; j < 3; j++) {
+			// determinant of the barycentric transform is the reciprocal of 6*volume
+			det += t.bary[0][j] * (t.bary[1][(j+1)%3]*t.bary[2][(j+2)%3] - t.bary[1][(j+2)%3]*t.bary[2][(j+1)%3]);
+		}
+		volume += 1/(6*fabs(det));
+		for (int f = 0; f < 4; f++) {
+			assert(t.n[f] < 0 || t.n[f] < mesh.size());
+		}
+	}
+	ASSERTEQUALT(1, volume, 1e-9);
+
+	// a linear mapping is reproduced exactly and continuously
+    ASSERTGCOORD(GCoord(0.15,0.015,0.0015), xyz.interpolate(GCoord(1.5,1.5,1.5)));
+    ASSERTGCOORD(GCoord(0.1,0.01,0.0015), xyz.interpolate(GCoord(1,1,1.5)));
+    ASSERTGCOORD(GCoord(.2,0.01,.002), xyz.interpolate(GCoord(2,1,2)));
+	for (double z = 1; z <= 2; z += 0.05) {
+		ASSERTGCOORD(GCoord(0.19,0.019,z/1000), xyz.interpolate(GCoord(1.9,1.9,z)));
+		ASSERTGCOORD(GCoord(0.11,0.017,z/1000), xyz.interpolate(GCoord(1.1,1.7,z)));
+	}
+
+	// points outside the mesh use the neighborhood interpolation
+	MappedPointFilter nbr(sink);
+    nbr.mapPoint(GCoord(1,1,1), GCoord(.1,.01,.001));
+    nbr.mapPoint(GCoord(1,1,2), GCoord(.1,.01,.002));
+    nbr.mapPoint(GCoord(1,2,1), GCoord(.1,.02,.001));
+    nbr.mapPoint(GCoord(1,2,2), GCoord(.1,.02,.002));
+    nbr.mapPoint(GCoord(2,1,1), GCoord(.2,.01,.001));
+    nbr.mapPoint(GCoord(2,1,2), GCoord(.2,.01,.002));
+    nbr.mapPoint(GCoord(2,2,1), GCoord(.2,.02,.001));
+    nbr.mapPoint(GCoord(2,2,2), GCoord(.2,.02,.002));
+	ASSERTGCOORD(nbr.interpolate(GCoord(1.9,1.9,2.4)), xyz.interpolate(GCoord(1.9,1.9,2.4)));
+	ASSERTGCOORD(nbr.interpolate(GCoord(-20,-20,-20)), xyz.interpolate(GCoord(-20,-20,-20)));
+
+	// every mapped point of a measured calibration maps to its range
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    MappedPointFilter pof(sink, config);
+	pof.setInterpolation(INTERPOLATE_DELAUNAY);
+	pof.setDomainRadius(24);
+	vector<MappedPoint> points = pof.domainNeighborhood(ORIGIN, 1000);
+	assert(pof.getMesh().size() > points.size());
+	for (int i = 0; i < points.size(); i++) {
+		ASSERTGCOORD(points[i].range, pof.interpolate(points[i].domain));
+	}
+
+	cout << "testDelaunay() PASS" << endl;
+}
+
+void testLattice() {
+	cout << "testLattice() BEGIN -------" << endl;
+    StringSink sink;
+    MappedPointFilter xyz(sink);
+	assert(!xyz.getLattice().isValid());
+    xyz.mapPoint(GCoord(1,1,1), GCoord(.1,.01,.001));
+    xyz.mapPoint(GCoord(1,1,2), GCoord(.1,.01,.002));
+    xyz.mapPoint(GCoord(1,2,1), GCoord(.1,.02,.001));
+    xyz.mapPoint(GCoord(1,2,2), GCoord(.1,.02,.002));
+    xyz.mapPoint(GCoord(2,1,1), GCoord(.2,.01,.001));
+    xyz.mapPoint(GCoord(2,1,2), GCoord(.2,.01,.002));
+    xyz.mapPoint(GCoord(2,2,1), GCoord(.2,.02,.001));
+    xyz.mapPoint(GCoord(2,2,2), GCoord(.2,.02,.002));
+	xyz.setInterpolation(INTERPOLATE_DELAUNAY);
+	ASSERTZERO(xyz.bakeLattice(0.25, 0.0001));
+	const LatticeHeader &header = xyz.getLattice().getHeader();
+	ASSERTEQUAL(5, header.nx);
+	ASSERTEQUAL(5, header.ny);
+	ASSERTEQUAL(5, header.nz);
+	ASSERTEQUAL(0.0001, header.quantum);
+	ASSERTEQUAL(sizeof(LatticeHeader) + 5*5*5*3*2, xyz.getLattice().bytes());
+
+	// trilinear interpolation of a linear mapping is exact within one quantum
+	for (double x = 1; x <= 2; x += 0.1) {
+		for (double z = 1; z <= 2; z += 0.07) {
+			GCoord domain(x, 1.3, z);
+			GCoord expected(x/10, 0.013, z/1000);
+			assert(expected.distance2(xyz.interpolate(domain)) < 3e-8);
+		}
+	}
+	// outside the lattice falls back to neighborhood interpolation
+    ASSERTGCOORD(GCoord(0.2,0.02,0.002), xyz.interpolate(GCoord(2.9,2.9,2.9)));
+
+	// a saved lattice file can be mapped by another filter
+	ASSERTZERO(xyz.getLattice().save("target/test.gfl"));
+    json_error_t jerr;
+    json_t *config = json_loads("{\"lattice\":\"target/test.gfl\"}", 0, &jerr);
+    MappedPointFilter mapped(sink, config);
+	assert(mapped.getLattice().isValid());
+	ASSERTEQUAL(xyz.getLattice().bytes(), mapped.getLattice().bytes());
+	for (double x = 1; x <= 2; x += 0.1) {
+		GCoord domain(x, 1.9, 1.2);
+		assert(xyz.interpolate(domain) == mapped.interpolate(domain));
+	}
+	mapped.writeln("G0X1.5Y1.5Z1.5");
+	ASSERTEQUALS("G0X0.15Y0.015Z0.0015", sink.strings.back().c_str());
+	assert(mapped.loadLattice("test/fiducial.json") != 0);
+	assert(!mapped.getLattice().isValid());
+
+	// lattice files with a spacing that is not positive are rejected
+	vector<char> gfl(xyz.getLattice().bytes());
+	FILE *file = fopen("target/test.gfl", "rb");
+	ASSERTEQUAL(gfl.size(), fread(&gfl[0], 1, gfl.size(), file));
+	fclose(file);
+	((LatticeHeader *) &gfl[0])->spacing[1] = 0;
+	file = fopen("target/test_zero.gfl", "wb");
+	fwrite(&gfl[0], 1, gfl.size(), file);
+	fclose(file);
+	ASSERTEQUAL(-EINVAL, mapped.loadLattice("target/test_zero.gfl"));
+	assert(!mapped.getLattice().isValid());
+
+	// measured calibration with large offsets enlarges the quantum to fit
+	string json = loadFile("test/fiducial.json");
+    config = json_loads(json.c_str(), 0, &jerr);
+    MappedPointFilter pof(sink, config);
+	pof.setDomainRadius(24);
+	GCoord expected = pof.interpolate(GCoord(0,0,0));
+	ASSERTZERO(pof.bakeLattice(1));
+	assert(pof.getLattice().getHeader().quantum > 0.001);
+	double tolerance = 2 * pof.getLattice().getHeader().quantum;
+	ASSERTEQUALT(expected.x, pof.interpolate(GCoord(0,0,0)).x, tolerance);
+	ASSERTEQUALT(expected.y, pof.interpolate(GCoord(0,0,0)).y, tolerance);
+
+	cout << "testLattice() PASS" << endl;
+}
+
+void testOctree() {
+	cout << "testOctree() BEGIN -------" << endl;
+    StringSink sink;
+    MappedPointFilter xyz(sink);
+    xyz.mapPoint(GCoord(1,1,1), GCoord(.1,.01,.001));
+    xyz.mapPoint(GCoord(1,1,2), GCoord(.1,.01,.002));
+    xyz.mapPoint(GCoord(1,2,1), GCoord(.1,.02,.001));
+    xyz.mapPoint(GCoord(1,2,2), GCoord(.1,.02,.002));
+    xyz.mapPoint(GCoord(2,1,1), GCoord(.2,.01,.001));
+    xyz.mapPoint(GCoord(2,1,2), GCoord(.2,.01,.002));
+    xyz.mapPoint(GCoord(2,2,1), GCoord(.2,.02,.001));
+    xyz.mapPoint(GCoord(2,2,2), GCoord(.2,.02,.002));
+	xyz.setInterpolation(INTERPOLATE_DELAUNAY);
+
+	// a linear mapping needs no refinement
+	ASSERTZERO(xyz.bakeOctree(1e-6, 1000));
+	ASSERTEQUAL(FIELD_OCTREE, xyz.getField());
+	ASSERTEQUAL(1, xyz.getOctree().nodeCount());
+	ASSERTEQUAL(1, xyz.getOctree().leafCount());
+	ASSERTEQUAL(sizeof(OctreeNode) + 24*sizeof(float), xyz.getOctree().bytes());
+    ASSERTGCOORD(GCoord(0.15,0.015,0.0015), xyz.interpolate(GCoord(1.5,1.5,1.5)));
+    ASSERTGCOORD(GCoord(0.13,0.017,0.0012), xyz.interpolate(GCoord(1.3,1.7,1.2)));
+	assert(xyz.bakeOctree(1e-6, 10) != 0);
+	ASSERTEQUAL(FIELD_NONE, xyz.getField());
+
+	// a curved mapping refines until within tolerance
+	MappedPointFilter curved(sink);
+	curved.setInterpolation(INTERPOLATE_DELAUNAY);
+	for (int x = 0; x <= 40; x += 10) {
+		for (int y = 0; y <= 40; y += 10) {
+			for (int z = 0; z <= 40; z += 10) {
+				curved.mapPoint(GCoord(x,y,z), GCoord(x + 0.001*x*x, y + 0.0005*y*z, z));
+			}
+		}
+	}
+	ASSERTZERO(curved.bakeOctree(0.01, 1024*1024));
+	const CorrectionOctree &octree = curved.getOctree();
+	assert(octree.nodeCount() > 1);
+	assert(octree.getMaxError() <= 0.01);
+	ASSERTEQUAL(octree.nodeCount()*sizeof(OctreeNode) + octree.leafCount()*24*sizeof(float), octree.bytes());
+	size_t fineBytes = octree.bytes();
+	ASSERTGCOORD(GCoord(20.4,20.2,20), curved.interpolate(GCoord(20,20,20)));
+
+	// a smaller budget trades accuracy for memory
+	ASSERTZERO(curved.bakeOctree(0.01, fineBytes/4));
+	assert(octree.bytes() <= fineBytes/4);
+	assert(octree.getMaxError() > 0.01);
+	ASSERTEQUAL(FIELD_OCTREE, curved.getField());
+	cout << "testOctree() PASS" << endl;
+}
+
+void testLayered() {
+	cout << "testLayered() BEGIN -------" << endl;
+    StringSink sink;
+    json_error_t jerr;
+
+	// a linear mapping on two planes is reproduced exactly between them
+	json_t *config = json_loads("{\"map\":[]}", 0, &jerr);
+	MappedPointFilter planes(sink, config);
+	ASSERTEQUAL(INTERPOLATE_NEIGHBORHOOD, planes.getInterpolation());
+	planes.setInterpolation(INTERPOLATE_LAYERED);
+	for (int x = 0; x <= 20; x += 5) {
+		for (int y = 0; y <= 20; y += 5) {
+			for (int z = 0; z <= 10; z += 10) {
+				planes.mapPoint(GCoord(x,y,z), GCoord(x + 0.01*y, y - 0.02*z, z + 0.001*x));
+			}
+		}
+	}
+	ASSERTEQUAL(2, planes.getLayers().size());
+	ASSERTEQUAL(32, planes.getLayers().at(0).triangles.size());
+	for (double z = 0; z <= 10; z += 2.5) {
+		ASSERTGCOORD(GCoord(3.2 + 0.01*7.1, 7.1 - 0.02*z, z + 0.001*3.2), planes.interpolate(GCoord(3.2,7.1,z)));
+	}
+
+	// the correction of the outer planes holds beyond them
+	ASSERTGCOORD(GCoord(3.2 + 0.01*7.1, 7.1, -5 + 0.001*3.2), planes.interpolate(GCoord(3.2,7.1,-5)));
+	ASSERTGCOORD(GCoord(3.2 + 0.01*7.1, 7.1 - 0.2, 15 + 0.001*3.2), planes.interpolate(GCoord(3.2,7.1,15)));
+
+	// measured calibration on three planes is detected when configured
+	string json = loadFile("test/fiducial.json");
+    config = json_loads(json.c_str(), 0, &jerr);
+    MappedPointFilter pof(sink, config);
+	ASSERTEQUAL(INTERPOLATE_LAYERED, pof.getInterpolation());
+	const LayeredMesh &layers = pof.getLayers();
+	ASSERTEQUAL(3, layers.size());
+	ASSERTEQUAL(-1, layers.at(0).z);
+	ASSERTEQUAL(0, layers.at(1).z);
+	ASSERTEQUAL(1, layers.at(2).z);
+	vector<MappedPoint> points = pof.domainNeighborhood(ORIGIN, 1000);
+	for (int i = 0; i < points.size(); i++) {
+		ASSERTGCOORD(points[i].range, pof.interpolate(points[i].domain));
+	}
+	GCoord r0 = pof.interpolate(GCoord(5,-20,0));
+	GCoord r1 = pof.interpolate(GCoord(5,-20,1));
+	ASSERTGCOORD(0.5*(r0 + r1), pof.interpolate(GCoord(5,-20,0.5)));
+	GCoord top = pof.interpolate(GCoord(10,-20,1));
+	for (double z = 1.5; z <= 100; z *= 2) {
+		ASSERTGCOORD(top + GCoord(0,0,z-1), pof.interpolate(GCoord(10,-20,z)));
+	}
+
+	// an explicit interpolation disables detection
+    json_decref(config);
+	json_t *explicitConfig = json_loads("{\"interpolation\":\"delaunay\"}", 0, &jerr);
+    MappedPointFilter delaunay(sink, explicitConfig);
+	ASSERTEQUAL(INTERPOLATE_DELAUNAY, delaunay.getInterpolation());
+
+	cout << "testLayered() PASS" << endl;
+}
+
+void testAxisTable() {
+	cout << "testAxisTable() BEGIN -------" << endl;
+    StringSink sink;
+    json_error_t jerr;
+
+	json_t *config = json_loads(
+		"{\"x\":{\"position\":[0,10,20,30],\"offset\":[0,0.1,0.1,-0.2]},"
+		"\"y\":{\"position\":[-10,0,5,50],\"offset\":[0.2,0,0.05,0.5]}}", 0, &jerr);
+	AxisTableFilter atf(sink, config);
+	json_decref(config);
+	ASSERTEQUAL(4, atf.getTable(0).size());
+	ASSERTEQUAL(0, atf.getTable(2).size());
+
+	// uniform x table
+	ASSERTEQUALT(0.05, atf.getTable(0).offset(5), 1e-6);
+	ASSERTEQUALT(0.1, atf.getTable(0).offset(15), 1e-6);
+	ASSERTEQUALT(-0.05, atf.getTable(0).offset(25), 1e-6);
+	ASSERTEQUALT(-0.2, atf.getTable(0).offset(30), 1e-6);
+	ASSERTEQUALT(-0.2, atf.getTable(0).offset(100), 1e-6);
+	ASSERTEQUALT(0, atf.getTable(0).offset(-1), 1e-6);
+
+	// non-uniform y table
+	ASSERTEQUALT(0.1, atf.getTable(1).offset(-5), 1e-6);
+	ASSERTEQUALT(0.025, atf.getTable(1).offset(2.5), 1e-6);
+	ASSERTEQUALT(0.05, atf.getTable(1).offset(5), 1e-6);
+	ASSERTEQUALT(0.1, atf.getTable(1).offset(10), 1e-6);
+	ASSERTEQUALT(0.5, atf.getTable(1).offset(60), 1e-6);
+
+	// modal position
+	atf.writeln("G0X5Y5Z1");
+	atf.writeln("G1X25F100");
+	atf.writeln("M3");
+	atf.writeln("G28");
+	ASSERTEQUALS("G0X5.05Y5.05Z1", sink[0].c_str());
+	ASSERTEQUALS("G1X24.95Y5.05Z1F100", sink[1].c_str());
+	ASSERTEQUALS("M3", sink[2].c_str());
+	ASSERTEQUALS("G28X0Y0Z0", sink[3].c_str());
+
+	// mismatched table
+	json_t *badConfig = json_loads("{\"z\":{\"position\":[0,1],\"offset\":[0]}}", 0, &jerr);
+	AxisTableFilter bad(sink);
+	ASSERT(bad.configure(badConfig) != 0);
+	json_decref(badConfig);
+
+	cout << "testAxisTable() PASS" << endl;
+}
+
+void testCoherence() {
+	cout << "testCoherence() BEGIN -------" << endl;
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    StringSink sink;
+	InterpolationMode modes[3] = {INTERPOLATE_NEIGHBORHOOD, INTERPOLATE_DELAUNAY, INTERPOLATE_LAYERED};
+	for (int m = 0; m < 3; m++) {
+		MappedPointFilter scan(sink, config);
+		MappedPointFilter pof(sink, config);
+		scan.setNeighborhoodMode(NEIGHBORHOOD_SCAN);
+		scan.setInterpolation(modes[m]);
+		pof.setInterpolation(modes[m]);
+
+		// a toolpath of short moves mostly reuses the previous neighborhood
+		for (double t = 0; t < 400; t += 0.25) {
+			GCoord domain(60*sin(t/40), -40 + 60*cos(t/50), 0.2*sin(t/10));
+			GCoord expected = scan.interpolate(domain);
+			GCoord actual = pof.interpolate(domain);
+			if (modes[m] == INTERPOLATE_NEIGHBORHOOD) {
+				assert(expected == actual);
+			} else {
+				ASSERTEQUALT(0, actual.distance2(expected), 1e-16);
+			}
+		}
+		const CoherenceStats &stats = pof.getCoherence();
+		cout << "mode:" << m << " hits:" << stats.hits << " misses:" << stats.misses << endl;
+		ASSERT((stats.hits + stats.misses >= 1600));
+		ASSERT((stats.hitRate() > 0.5));
+		pof.resetCoherence();
+		ASSERTEQUAL(0, pof.getCoherence().hitRate());
+	}
+    json_decref(config);
+	cout << "testCoherence() PASS" << endl;
+}
+
+void testInterpolationCache() {
+	cout << "testInterpolationCache() BEGIN -------" << endl;
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    StringSink sink;
+    MappedPointFilter pof(sink, config);
+    MappedPointFilter cached(sink, config);
+	json_decref(config);
+	ASSERT(!cached.getCache().isEnabled());
+	ASSERTZERO(cached.configureCache(100, 0.001));
+	ASSERTEQUAL(128, cached.getCache().capacity());
+
+	// repeated visits are answered from the cache
+	for (int pass = 0; pass < 3; pass++) {
+		for (int i = 0; i < 20; i++) {
+			GCoord domain(-50 + 5*i, 20 - 3*i, 0.5);
+			assert(pof.interpolate(domain) == cached.interpolate(domain));
+		}
+	}
+	const CacheStats &stats = cached.getCache().getStats();
+	ASSERTEQUAL(40, stats.hits);
+	ASSERTEQUAL(20, stats.misses);
+	ASSERTEQUAL(0, stats.evictions);
+
+	// nearby domains share a key and are translated
+	GCoord range = cached.interpolate(GCoord(-50.0002, 20, 0.5));
+	ASSERTEQUAL(41, stats.hits);
+	ASSERTGCOORD(pof.interpolate(GCoord(-50,20,0.5)) - GCoord(0.0002,0,0), range);
+
+	// calibration changes invalidate the cache
+	GCoord domain(-50, 20, 0.5);
+	cached.mapPoint(domain, GCoord(-49, 20, 0.5));
+	pof.mapPoint(domain, GCoord(-49, 20, 0.5));
+	ASSERTGCOORD(GCoord(-49, 20, 0.5), cached.interpolate(domain));
+	ASSERTEQUAL(41, stats.hits);
+
+	// a full cache evicts the least recently used
+	ASSERTZERO(cached.configureCache(4, 1));
+	for (int i = 0; i < 100; i++) {
+		GCoord domain(-50 + i, -20, 0);
+		assert(pof.interpolate(domain) == cached.interpolate(domain));
+	}
+	ASSERTEQUAL(0, stats.hits);
+	ASSERTEQUAL(96, stats.evictions);
+	ASSERT(cached.configureCache(4, 0) != 0);
+	ASSERTEQUAL(-EINVAL, cached.configureCache((size_t) -1));
+
+	// a configured capacity must be positive
+	config = json_loads("{\"cache\":{\"capacity\":-1}}", 0, &jerr);
+	ASSERTEQUAL(-EINVAL, cached.configure(config));
+	json_decref(config);
+
+	cout << "testInterpolationCache() PASS" << endl;
+}
+
+void testPointStore() {
+	cout << "testPointStore() BEGIN -------" << endl;
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    StringSink sink;
+    MappedPointFilter pof(sink, config);
+    MappedPointFilter pof32(sink, config);
+	json_decref(config);
+	pof.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
+	pof32.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
+	ASSERTEQUAL(PRECISION_DOUBLE, pof.getPrecision());
+	pof32.setPrecision(PRECISION_FLOAT);
+
+	const PointStore &store = pof.getStore();
+	const PointStore &store32 = pof32.getStore();
+	size_t n = store.size();
+	ASSERTEQUAL(n, store32.size());
+	ASSERTEQUAL(n*48, store.bytes());
+	ASSERTEQUAL(n*24, store32.bytes());
+	ASSERT((PointStore::mapBytes(n) > 2*store.bytes()));
+
+	// streaming scan agrees with the k-d tree
+	for (double x = -100; x <= 100; x += 12.5) {
+		for (double y = -150; y <= 100; y += 12.5) {
+			GCoord domain(x, y, 0.3);
+			KdHit hits[4];
+			int count = store.nearest(domain, 4, 24*24, hits);
+			vector<MappedPoint> neighborhood = pof.domainNeighborhood(domain, 24);
+			ASSERTEQUAL(min((size_t) 4, neighborhood.size()), count);
+			for (int i = 0; i < count; i++) {
+				assert(store.at(hits[i].index) == neighborhood[i]);
+			}
+			ASSERTEQUALT(0, pof.interpolate(domain).distance2(pof32.interpolate(domain)), 1e-8);
+		}
+	}
+
+	// the store replaces the map once built, and points can still be added
+	GCoord domainMin, domainMax;
+	ASSERTZERO(pof.getModel()->domainBounds(domainMin, domainMax));
+	ASSERTEQUAL(0, pof.getModel()->mapping.size());
+	pof32.mapPoint(GCoord(500,500,0), GCoord(501,502,0));
+	ASSERTEQUAL(n + 1, pof32.getStore().size());
+	ASSERTEQUAL(PRECISION_FLOAT, pof32.getStore().getPrecision());
+	vector<MappedPoint> added = pof32.domainNeighborhood(GCoord(500,500,0), 1);
+	ASSERTEQUAL(1, added.size());
+	ASSERTGCOORD(GCoord(501,502,0), added[0].range);
+	GCoord domainMin32, domainMax32;
+	ASSERTZERO(pof32.getModel()->domainBounds(domainMin32, domainMax32));
+	ASSERTGCOORD(domainMin, domainMin32);
+	ASSERTGCOORD(GCoord(500,500,domainMax.z), domainMax32);
+
+	cout << "testPointStore() PASS" << endl;
+}
+
+void testBatchInterpolate() {
+	cout << "testBatchInterpolate() BEGIN -------" << endl;
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+    StringSink sink;
+    MappedPointFilter pof(sink, config);
+	json_decref(config);
+	pof.setInterpolation(INTERPOLATE_NEIGHBORHOOD);
+
+	vector<GCoord> domains;
+	for (double x = -110; x <= 110; x += 3.7) {
+		for (double y = -170; y <= 100; y += 4.1) {
+			domains.push_back(GCoord(x, y, -1 + fmod(x*y, 2.0)));
+		}
+	}
+	vector<GCoord> ranges(domains.size());
+	SimdLevel best = simdLevel();
+	cout << "simdLevel:" << simdLevelName(best) << endl;
+	for (int level = SIMD_SCALAR; level <= best; level++) {
+		ASSERTEQUAL(level, setSimdLevel((SimdLevel) level));
+		for (int mode = 0; mode < 3; mode++) {
+			pof.setNeighborhoodMode(mode == 1 ? NEIGHBORHOOD_SCAN : NEIGHBORHOOD_KDTREE);
+			pof.setPrecision(mode == 2 ? PRECISION_FLOAT : PRECISION_DOUBLE);
+			pof.interpolate(&domains[0], &ranges[0], domains.size());
+			for (size_t i = 0; i < domains.size(); i++) {
+				GCoord expected = pof.interpolate(domains[i]);
+				ASSERTEQUALT(0, expected.distance2(ranges[i]), 1e-18);
+			}
+		}
+	}
+
+	// arrays of coordinates
+	double xs[3] = {1, 2, 3}, ys[3] = {-50, -60, -70}, zs[3] = {0, 0.5, 1};
+	double rxs[3], rys[3], rzs[3];
+	pof.interpolate(xs, ys, zs, rxs, rys, rzs, 3);
+	for (int i = 0; i < 3; i++) {
+		ASSERTGCOORD(pof.interpolate(GCoord(xs[i], ys[i], zs[i])), GCoord(rxs[i], rys[i], rzs[i]));
+	}
+
+	cout << "testBatchInterpolate() PASS" << endl;
+}
+
+// Discards lines without allocating
+typedef class NullSink:public GCodeSink {
+    public:
+        long lines;
+        NullSink() : lines(0) {}
+        virtual int writeln(const char *value) {
+            lines++;
+            return 0;
+        }
+        virtual int writeSpan(const char *text, size_t length) {
+            lines++;
+            return 0;
+        }
+} NullSink;
+
+void testAllocationFree() {
+	cout << "testAllocationFree() BEGIN -------" << endl;
+	string json = loadFile("test/fiducial.json");
+    json_error_t jerr;
+    json_t *config = json_loads(json.c_str(), 0, &jerr);
+	json_t *axisConfig = json_loads("{\"x\":{\"position\":[0,10,30],\"offset\":[0,0.1,-0.2]}}", 0, &jerr);
+	char lines[1000][40];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(lines[i], sizeof(lines[i]), "G%dX%.3fY%.3fZ%.2f F3000", 
+			i%2, 60*sin(i/40.0), -40 + 60*cos(i/50.0), 0.2*sin(i/10.0));
+	}
+
+	long hooked = allocations;
+	vector<MappedPoint> probe(10);
+	ASSERTEQUAL(hooked + 1, allocations);
+
+	// tracing formats diagnostics, so measure at a production log level
+	int level = logLevel;
+	firelog_level(FIRELOG_INFO);
+	InterpolationMode modes[3] = {INTERPOLATE_NEIGHBORHOOD, INTERPOLATE_DELAUNAY, INTERPOLATE_LAYERED};
+	for (int m = 0; m < 4; m++) {
+		NullSink sink;
+		MappedPointFilter pof(sink, config);
+		AxisTableFilter axes(pof, axisConfig);
+		if (m < 3) {
+			pof.setInterpolation(modes[m]);
+		} else {
+			pof.setInterpolation(INTERPOLATE_NEIGHBORHOOD);	// not the layered default of fiducial.json
+			pof.setNeighborhoodMode(NEIGHBORHOOD_SCAN);
+		}
+		axes.writeln("G0X0Y0Z0");
+		axes.writeln("M3");
+		long before = allocations;
+		for (int i = 0; i < 1000; i++) {
+			axes.writeln(lines[i]);
+		}
+		cout << "mode:" << m << " allocations:" << allocations - before << endl;
+		ASSERTEQUAL(0, allocations - before);
+		ASSERTEQUAL(1002, sink.lines);
+		if (m == 3) {
+			// scanned neighborhoods are not coherent
+			ASSERTEQUAL(0, pof.getCoherence().hits + pof.getCoherence().misses);
+		}
+	}
+	firelog_level(level);
+	json_decref(config);
+	json_decref(axisConfig);
+
+	cout << "testAllocationFree() PASS" << endl;
+}
+
+// Remembers where each line came from
+typedef class SpanSink:public GCodeSink {
+    public:
+        vector<const char *> texts;
+        vector<string> strings;
+        virtual int writeln(const char *value) {
+            return writeSpan(value, strlen(value));
+        }
+        virtual int writeSpan(const char *text, size_t length) {
+            texts.push_back(text);
+            strings.push_back(string(text, length));
+            return 0;
+        }
+} SpanSink;
+
+// Filter that only implements writeln()
+typedef class LowerFilter:public GFilterBase {
+    public:
+        LowerFilter(IGFilter &next) : GFilterBase(next) {}
+        virtual int writeln(const char *value) {
+            string lower(value);
+            for (size_t i = 0; i < lower.size(); i++) {
+                lower[i] = tolower(lower[i]);
+            }
+            return _next.writeln(lower.c_str());
+        }
+} LowerFilter;
+
+void testWriteSpan() {
+	cout << "testWriteSpan() BEGIN -------" << endl;
+	const char *json = "{\"map\":[{\"domain\":[0,0,0], \"range\":[1,2,3]}]}";
+    json_error_t jerr;
+    json_t *config = json_loads(json, 0, &jerr);
+	json_t *axisConfig = json_loads("{\"x\":{\"position\":[0,10],\"offset\":[0,1]}}", 0, &jerr);
+	SpanSink sink;
+	MappedPointFilter pof(sink, config);
+	AxisTableFilter axes(pof, axisConfig);
+	DeltaFilter delta(axes);
+	json_decref(config);
+	json_decref(axisConfig);
+
+	// lines are not NUL terminated
+	const char *input = "M3 S1000;G1X5Y6 F300;(comment);G0X10Z1;G92X0";
+	const char *lines[5] = { input, input+9, input+21, input+31, input+39 };
+	int lengths[5] = { 8, 11, 9, 7, 5 };
+	for (int i = 0; i < 4; i++) {
+		axes.writeSpan(lines[i], lengths[i]);
+	}
+	ASSERTEQUAL(4, sink.strings.size());
+	ASSERTEQUALS("M3 S1000", sink.strings[0].c_str());
+	ASSERTEQUALS("G1X6.5Y8Z3F300", sink.strings[1].c_str());
+	ASSERTEQUALS("(comment)", sink.strings[2].c_str());
+	ASSERTEQUALS("G0X12Y8Z4", sink.strings[3].c_str());
+
+	// unchanged lines pass by reference through every filter
+	assert(sink.texts[0] == lines[0]);
+	assert(sink.texts[2] == lines[2]);
+	delta.writeSpan(lines[4], lengths[4]);
+	assert(sink.texts[4] == lines[4]);
+	ASSERTEQUALS("G92X0", sink.strings[4].c_str());
+
+	// writeln is a shim for writeSpan
+	axes.writeln("G1X0");
+	ASSERTEQUALS("G1X1Y8Z4", sink.strings[5].c_str());
+
+	// the default writeSpan gives writeln a NUL terminated copy
+	StringSink strings;
+	LowerFilter lower(strings);
+	IGFilter &base = lower;
+	base.writeSpan(lines[1], lengths[1]);
+	base.writeSpan(input, 2);
+	ASSERTEQUAL(2, strings.strings.size());
+	ASSERTEQUALS("g1x5y6 f300", strings[0].c_str());
+	ASSERTEQUALS("m3", strings[1].c_str());
+
+	cout << "testWriteSpan() PASS" << endl;
+}
+
+// Sink whose writes fail once it holds limit lines
+typedef class FailingSink:public StringSink {
+    public:
+        size_t limit;
+        int flushRc;
+        FailingSink(size_t limit) : limit(limit), flushRc(0) {}
+        virtual int writeBatch(GBlock *blocks, size_t count) {
+            if (strings.size() >= limit) {
+                return -EIO;
+            }
+            return StringSink::writeBatch(blocks, count);
+        }
+        virtual int flush(InputEvent event=INPUT_END) {
+            return flushRc;
+        }
+} FailingSink;
+
+void testLineReader() {
+	cout << "testLineReader() BEGIN -------" << endl;
+	const char *text = "G0X1\n\n; comment\r\nG1X2Y3 F100\nM3";
+	FILE *file = fopen("target/test_reader.gcode", "wb");
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	const char *expected[5] = { "G0X1", "", "; comment\r", "G1X2Y3 F100", "M3" };
+
+	// mapped file
+	StringSink sink;
+	LineReader reader(sink);
+	ASSERTZERO(reader.readFile("target/test_reader.gcode"));
+	ASSERTEQUAL(5, reader.getLines());
+	for (int i = 0; i < 5; i++) {
+		ASSERTEQUALS(expected[i], sink[i].c_str());
+	}
+
+	// blocks shorter than a line
+	for (size_t blockSize = 1; blockSize < 40; blockSize += 3) {
+		StringSink blockSink;
+		LineReader blockReader(blockSink, blockSize);
+		int fd = open("target/test_reader.gcode", O_RDONLY);
+		ASSERTZERO(blockReader.readFd(fd));
+		close(fd);
+		ASSERTEQUAL(5, blockSink.strings.size());
+		for (int i = 0; i < 5; i++) {
+			ASSERTEQUALS(expected[i], blockSink[i].c_str());
+		}
+	}
+
+	// a final newline does not add an empty line
+	file = fopen("target/test_reader.gcode", "wb");
+	fclose(file);
+	StringSink emptySink;
+	LineReader emptyReader(emptySink);
+	ASSERTZERO(emptyReader.readFile("target/test_reader.gcode"));
+	ASSERTEQUAL(0, emptySink.strings.size());
+	file = fopen("target/test_reader.gcode", "wb");
+	fputs("G0X1\n", file);
+	fclose(file);
+	ASSERTZERO(emptyReader.readFile("target/test_reader.gcode"));
+	ASSERTEQUAL(1, emptySink.strings.size());
+	ASSERT(emptyReader.readFile("target/no-such-file.gcode") < 0);
+
+	// the first error of the filter stops reading
+	file = fopen("target/test_reader.gcode", "wb");
+	for (int i = 0; i < 3000; i++) {
+		fprintf(file, "G0X%d\n", i);
+	}
+	fclose(file);
+	FailingSink failingSink(10);
+	LineReader failingReader(failingSink, 64);
+	int fd = open("target/test_reader.gcode", O_RDONLY);
+	ASSERTEQUAL(-EIO, failingReader.readFd(fd));
+	close(fd);
+	ASSERT((failingReader.getLines() < 100));
+	FailingSink flushSink(1<<30);
+	flushSink.flushRc = -EIO;
+	LineReader flushReader(flushSink);
+	ASSERTEQUAL(-EIO, flushReader.readFile("target/test_reader.gcode"));
+	fd = open("target/test_reader.gcode", O_RDONLY);
+	ASSERTEQUAL(-EIO, flushReader.readFd(fd));
+	close(fd);
+	ASSERTEQUAL(6000, flushSink.strings.size());
+
+	cout << "testLineReader() PASS" << endl;
+}
+
+void testGBlock() {
+	cout << "testGBlock() BEGIN -------" << endl;
+	const char *line = "G1X1 y2 E3.5F300 (note) M3 ; comment";
+	GBlock block(line, strlen(line));
+	ASSERT(block.isMove());
+	ASSERTEQUAL(8, block.moveLength);
+	ASSERTEQUAL(6, block.wordCount);
+	ASSERTEQUAL(1, block.word('G')->value);
+	ASSERTEQUAL(1, block.word('X')->value);
+	ASSERTEQUAL(2, block.word('Y')->value);
+	ASSERTEQUAL(3.5, block.word('E')->value);
+	ASSERTEQUAL(300, block.word('F')->value);
+	ASSERTEQUAL(3, block.word('M')->value);
+	ASSERT(!block.word('Z'));
+	assert(block.comment == line + 17);
+	ASSERTEQUAL(6, block.commentLength);
+	ASSERT(!block.modified);
+
+	char buf[255];
+	ASSERTEQUAL(strlen(line), block.format(buf, sizeof(buf)));
+	ASSERTEQUALS(line, buf);
+	CoordFormat formats[3] = { CoordFormat(NOTATION_FIXED, 2), CoordFormat(), CoordFormat() };
+	block.moveTo(GCoord(1.234, 2, 3), formats);
+	ASSERT(block.modified);
+	ASSERTEQUAL(3, block.word('Z')->value);
+	ASSERTEQUAL(1.234, block.word('X')->value);
+	block.format(buf, sizeof(buf));
+	ASSERTEQUALS("G1X1.23Y2Z3E3.5F300 (note) M3 ; comment", buf);
+
+	line = "M117 X is 1";
+	block.parse(line, strlen(line));
+	ASSERT(!block.isMove());
+	ASSERTEQUAL(1, block.wordCount);
+	ASSERT(!block.comment);
+	line = "G28";
+	block.parse(line, strlen(line));
+	block.moveTo(GCoord(1, 2, 3), formats);
+	block.format(buf, sizeof(buf));
+	ASSERTEQUALS("G28X0Y0Z0", buf);
+
+	// chained filters pass coordinates without rounding them to text
+	const char *json = "{ \"x\":{\"position\":[0,10],\"offset\":[0,0.000008]} }";
+	json_error_t jerr;
+	json_t *config = json_loads(json, 0, &jerr);
+	StringSink sink;
+	AxisTableFilter second(sink, config);
+	AxisTableFilter first(second, config);
+	json_decref(config);
+	first.writeln("G1X5 F100");
+	first.writeln("M3");
+	ASSERTEQUALS("G1X5.00001Y0Z0F100", sink[0].c_str());
+	ASSERTEQUALS("M3", sink[1].c_str());
+	const char *pass = "; unchanged";
+	SpanSink spans;
+	DeltaFilter delta(spans);
+	MappedPointFilter pof(delta);
+	pof.writeSpan(pass, strlen(pass));
+	assert(spans.texts[0] == pass);
+	pof.writeln("G0X1");
+	ASSERTEQUALS("DELTAG0G1-goes-here", spans.strings[1].c_str());
+
+	cout << "testGBlock() PASS" << endl;
+}
+
+// Records the size of each batch
+typedef class BatchSink:public StringSink {
+    public:
+        vector<size_t> batches;
+        virtual int writeBatch(GBlock *blocks, size_t count) {
+            batches.push_back(count);
+            return StringSink::writeBatch(blocks, count);
+        }
+} BatchSink;
+
+void testWriteBatch() {
+	cout << "testWriteBatch() BEGIN -------" << endl;
+	const char *json = "{\"map\":[{\"domain\":[0,0,0], \"range\":[1,2,3]}]}";
+	json_error_t jerr;
+	json_t *config = json_loads(json, 0, &jerr);
+	FILE *file = fopen("target/test_batch.gcode", "wb");
+	for (int i = 0; i < 10000; i++) {
+		fprintf(file, i % 3 ? "G1X%dY%d E1\n" : "M%d ; %d\n", i, i % 100);
+	}
+	fclose(file);
+
+	BatchSink batchSink;
+	MappedPointFilter batchFilter(batchSink, config);
+	LineReader reader(batchFilter);
+	ASSERTZERO(reader.readFile("target/test_batch.gcode"));
+	ASSERTEQUAL(3, batchSink.batches.size());
+	ASSERTEQUAL(LINE_BATCH, batchSink.batches[0]);
+	ASSERTEQUAL(10000 - 2*LINE_BATCH, batchSink.batches[2]);
+
+	// same as line at a time
+	StringSink lineSink;
+	MappedPointFilter lineFilter(lineSink, config);
+	file = fopen("target/test_batch.gcode", "rb");
+	char line[100];
+	while (fgets(line, sizeof(line), file)) {
+		line[strlen(line)-1] = 0;
+		lineFilter.writeln(line);
+	}
+	fclose(file);
+	ASSERTEQUAL(10000, lineSink.strings.size());
+	ASSERTEQUAL(10000, batchSink.strings.size());
+	for (int i = 0; i < 10000; i++) {
+		ASSERTEQUALS(lineSink[i].c_str(), batchSink[i].c_str());
+	}
+
+	// filters without writeBatch() still see every line
+	StringSink lowerSink;
+	MappedPointFilter after(lowerSink, config);
+	LowerFilter lower(after);
+	MappedPointFilter before(lower, config);
+	GBlock blocks[2];
+	blocks[0].parse("G1X1", 4);
+	blocks[1].parse("M3", 2);
+	before.writeBatch(blocks, 2);
+	ASSERTEQUALS("G1X3Y4Z6", lowerSink[0].c_str());
+	ASSERTEQUALS("m3", lowerSink[1].c_str());
+	json_decref(config);
+
+	cout << "testWriteBatch() PASS" << endl;
+}
+
+// MappedPointFilter followed by AxisTableFilter unless axisConfig is NULL
+typedef class TestChainFactory:public IChainFactory {
+    public:
+        json_t *config;
+        json_t *axisConfig;
+        virtual IGFilter *createChain(IGFilter &next, vector<IGFilterPtr> &filters) {
+            IGFilter *pNext = &next;
+            if (axisConfig) {
+                AxisTableFilterPtr pAxis = new AxisTableFilter(next, axisConfig);
+                filters.push_back(pAxis);
+                pNext = pAxis;
+            }
+            MappedPointFilterPtr pPof = new MappedPointFilter(*pNext, config);
+            filters.push_back(pPof);
+            return pPof;
+        }
+} TestChainFactory;
+
+/**
+ * Load the four point map and z axis table of the chain tests
+ */
+static void loadChainConfig(json_t *&config, json_t *&axisConfig) {
+	json_error_t jerr;
+	config = json_loads("{\"map\":[{\"domain\":[0,0,0], \"range\":[1,2,3]}, " \
+		"{\"domain\":[10,0,0], \"range\":[11,2,3.5]}, {\"domain\":[0,10,0], \"range\":[1,12,3]}, " \
+		"{\"domain\":[0,0,10], \"range\":[1,2,13]}]}", 0, &jerr);
+	axisConfig = json_loads("{\"z\":{\"position\":[0,10],\"offset\":[0.5,-0.5]}}", 0, &jerr);
+}
+
+void testPipeline() {
+	cout << "testPipeline() BEGIN -------" << endl;
+	json_t *config;
+	json_t *axisConfig;
+	loadChainConfig(config, axisConfig);
+	const char *lines[6] = { "G0X1Y2Z3", "M3 ; spindle", "G1X5 F300", "g28", "G1Z7.5", "(end)" };
+
+	// runtime chain
+	StringSink chainSink;
+	MappedPointFilter chainPof(chainSink, config);
+	AxisTableFilter chainAxis(chainPof, axisConfig);
+	for (int i = 0; i < 6; i++) {
+		chainAxis.writeln(lines[i]);
+	}
+
+	StringSink sink;
+	MappedPointFilter pof(sink, config);
+	AxisTableFilter axis(sink, axisConfig);
+	Pipeline<AxisTableStage, MappedPointStage, StringSink> pipeline(axis, pof, sink);
+	for (int i = 0; i < 6; i++) {
+		pipeline.writeln(lines[i]);
+	}
+	ASSERTEQUAL(6, sink.strings.size());
+	for (int i = 0; i < 6; i++) {
+		ASSERTEQUALS(chainSink[i].c_str(), sink[i].c_str());
+	}
+	ASSERTEQUALS("M3 ; spindle", sink[1].c_str());
+
+	// batches from LineReader
+	FILE *file = fopen("target/test_pipeline.gcode", "wb");
+	for (int i = 0; i < 6; i++) {
+		fprintf(file, "%s\n", lines[i]);
+	}
+	fclose(file);
+	StringSink deltaSink;
+	DeltaFilter delta(deltaSink);
+	Pipeline<DeltaStage, StringSink> deltaPipeline(delta, deltaSink);
+	LineReader reader(deltaPipeline);
+	ASSERTZERO(reader.readFile("target/test_pipeline.gcode"));
+	ASSERTEQUAL(6, deltaSink.strings.size());
+	ASSERTEQUALS("DELTAG0G1-goes-here", deltaSink[0].c_str());
+	ASSERTEQUALS("(end)", deltaSink[5].c_str());
+	json_decref(config);
+	json_decref(axisConfig);
+
+	cout << "testPipeline() PASS" << endl;
+}
+
+void testThreadStage() {
+	cout << "testThreadStage() BEGIN -------" << endl;
+	json_t *config;
+	json_t *axisConfig;
+	loadChainConfig(config, axisConfig);
+	const char *path = "target/test_threadstage.gcode";
+	FILE *file = fopen(path, "wb");
+	int count = 20000;
+	for (int i = 0; i < count; i++) {
+		fprintf(file, i % 5 ? "G1X%dY%d.5Z%g ; move %d\n" : "M117 line %d\n", i % 97, i % 31, i % 7 / 4.0, i);
+	}
+	fclose(file);
+
+	StringSink expected;
+	MappedPointFilter pof(expected, config);
+	LineReader reader(pof);
+	ASSERTZERO(reader.readFile(path));
+	ASSERTEQUAL(count, expected.strings.size());
+
+	// sink and filter each on their own thread
+	{
+		BatchSink sink;
+		ThreadStage sinkStage(sink);
+		MappedPointFilter threadPof(sinkStage, config);
+		ThreadStage pofStage(threadPof, 2);
+		LineReader threadReader(pofStage);
+		ASSERTZERO(threadReader.readFile(path));
+		ASSERTEQUAL(count, sink.strings.size());
+		for (int i = 0; i < count; i++) {
+			ASSERTEQUALS(expected[i].c_str(), sink[i].c_str());
+		}
+		const StageStats &stats = pofStage.getStats();
+		ASSERTEQUAL(count, stats.lines);
+		ASSERT((stats.batches >= count / LINE_BATCH));
+		ASSERT((stats.maxDepth <= 2));
+		ASSERT((sink.batches.size() >= 1));
+	}
+
+	// single lines through a ring of two slots
+	{
+		StringSink sink;
+		ThreadStage stage(sink, 2);
+		for (int i = 0; i < 1000; i++) {
+			char line[40];
+			snprintf(line, sizeof(line), "G0X%d", i);
+			stage.writeln(line);
+		}
+		ASSERTZERO(stage.flush());
+		ASSERTEQUAL(1000, sink.strings.size());
+		ASSERTEQUALS("G0X0", sink[0].c_str());
+		ASSERTEQUALS("G0X999", sink[999].c_str());
+		ASSERTEQUAL(1000, stage.getStats().batches);
+	}
+	json_decref(config);
+	json_decref(axisConfig);
+
+	cout << "testThreadStage() PASS" << endl;
+}
+
+static void appendMove(string &text, const GCoord &domain) {
+	char line[100];
+	snprintf(line, sizeof(line), "G1X%.17gY%.17gZ%.17g\n", domain.x, domain.y, domain.z);
+	text += line;
+}
+
+/**
+ * Random moves onto the vertices and edge midpoints of the mesh of config
+ */
+static string meshMoves(json_t *config) {
+	StringSink sink;
+	MappedPointFilter pof(sink, config);
+	CalibrationModelPtr model = pof.getModel();
+	const PointStore &store = model->store;
+	vector<GCoord> edges;
+	for (size_t t = 0; t < model->mesh.size(); t++) {
+		const DelaunayTet &tet = model->mesh.at(t);
+		for (int i = 0; i < 4; i++) {
+			edges.push_back(store.domain(tet.v[i]));
+			edges.push_back(store.domain(tet.v[(i + 1) % 4]));
+		}
+	}
+	for (size_t l = 0; l < model->layers.size(); l++) {
+		const MeshLayer &layer = model->layers.at(l);
+		for (size_t t = 0; t < layer.triangles.size(); t++) {
+			for (int i = 0; i < 3; i++) {
+				edges.push_back(store.domain(layer.ordinals[layer.triangles[t].v[i]]));
+				edges.push_back(store.domain(layer.ordinals[layer.triangles[t].v[(i + 1) % 3]]));
+			}
+		}
+	}
+	ASSERT((edges.size() > 0));
+	string text;
+	srand(7);
+	for (int i = 0; i < 3000; i++) {
+		size_t e = (rand() % (edges.size() / 2)) * 2;
+		GCoord a = edges[e];
+		GCoord b = edges[e + 1];
+		switch (rand() % 3) {
+		case 0:
+			appendMove(text, a);
+			break;
+		case 1:
+			appendMove(text, GCoord((a.x + b.x) / 2, (a.y + b.y) / 2, (a.z + b.z) / 2));
+			break;
+		default:
+			appendMove(text, GCoord((a.x + b.x) / 2, (a.y + b.y) / 2, a.z + (rand() % 100) / 100.0));
+			break;
+		}
+	}
+	return text;
+}
+
+void testChunkReader() {
+	cout << "testChunkReader() BEGIN -------" << endl;
+	TestChainFactory factory;
+	loadChainConfig(factory.config, factory.axisConfig);
+	json_error_t jerr;
+	json_array_append_new(json_object_get(factory.config, "map"),
+		json_loads("{\"domain\":[10,10,10], \"range\":[10.5,11.5,9]}", 0, &jerr));
+	string text = "; no moves yet\nM104 S200\n\n";
+	srand(5);
+	for (int i = 0; i < 3000; i++) {
+		char line[100];
+		switch (rand() % 8) {
+		case 0:
+			snprintf(line, sizeof(line), "G1Z%.2f\n", rand() % 1000 / 100.0);
+			break;
+		case 1:
+			snprintf(line, sizeof(line), "G28\n");
+			break;
+		case 2:
+			snprintf(line, sizeof(line), "M117 line %d\n", i);
+			break;
+		case 3:
+			snprintf(line, sizeof(line), "G0Y%.3f ; travel\n", rand() % 10000 / 1000.0);
+			break;
+		default:
+			snprintf(line, sizeof(line), "G1X%.3f E%.4f\n", rand() % 10000 / 1000.0, rand() % 10000 / 1000.0);
+			break;
+		}
+		text += line;
+	}
+	text += "G1X1Y1Z1";	// no newline
+
+	StringSink expected;
+	vector<IGFilterPtr> filters;
+	LineReader reader(*factory.createChain(expected, filters));
+	ASSERTZERO(reader.readText(text.c_str(), text.size()));
+	for (size_t i = filters.size(); i-- > 0;) {
+		delete filters[i];
+	}
+	ASSERTEQUAL(3004, expected.strings.size());
+
+	size_t chunkBytes[4] = { 1, 64, 1000, 1<<20 };
+	for (int c = 0; c < 4; c++) {
+		StringSink sink;
+		ChunkReader chunkReader(factory, sink, 3, chunkBytes[c]);
+		ASSERTZERO(chunkReader.readText(text.c_str(), text.size()));
+		ASSERTEQUAL(expected.strings.size(), sink.strings.size());
+		ASSERTEQUAL(3004, chunkReader.getLines());
+		for (size_t i = 0; i < sink.strings.size(); i++) {
+			ASSERTEQUALS(expected[i].c_str(), sink[i].c_str());
+		}
+	}
+	ChunkReader defaultReader(factory, expected);
+	ASSERT((defaultReader.getThreads() >= 1));
+	json_decref(factory.config);
+	json_decref(factory.axisConfig);
+
+	// chunks start with other search hints, yet mesh interpolation of moves
+	// onto shared edges and vertices prints the same shortest digits
+	const char *interpolations[2] = { "layered", "delaunay" };
+	for (int m = 0; m < 2; m++) {
+		string json = loadFile("test/fiducial.json");
+		TestChainFactory meshFactory;
+		meshFactory.config = json_loads(json.c_str(), 0, &jerr);
+		meshFactory.axisConfig = NULL;
+		json_object_set_new(meshFactory.config, "interpolation", json_string(interpolations[m]));
+		json_object_set_new(meshFactory.config, "format", 
+			json_loads("{\"x\":\"shortest\",\"y\":\"shortest\",\"z\":\"shortest\"}", 0, &jerr));
+		string meshText = meshMoves(meshFactory.config);
+
+		StringSink meshExpected;
+		vector<IGFilterPtr> meshFilters;
+		LineReader meshReader(*meshFactory.createChain(meshExpected, meshFilters));
+		ASSERTZERO(meshReader.readText(meshText.c_str(), meshText.size()));
+		for (size_t i = meshFilters.size(); i-- > 0;) {
+			delete meshFilters[i];
+		}
+		for (int c = 0; c < 3; c++) {
+			StringSink sink;
+			ChunkReader chunkReader(meshFactory, sink, 3, chunkBytes[c]);
+			ASSERTZERO(chunkReader.readText(meshText.c_str(), meshText.size()));
+			ASSERTEQUAL(meshExpected.strings.size(), sink.strings.size());
+			for (size_t i = 0; i < sink.strings.size(); i++) {
+				ASSERTEQUALS(meshExpected[i].c_str(), sink[i].c_str());
+			}
+		}
+		json_decref(meshFactory.config);
+	}
+
+	cout << "testChunkReader() PASS" << endl;
+}
+
+static string readText(const char *path) {
+	string text;
+	FILE *file = fopen(path, "rb");
+	char buf[4096];
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0;) {
+		text.append(buf, n);
+	}
+	fclose(file);
+	return text;
+}
+
+void testBatchReader() {
+	cout << "testBatchReader() BEGIN -------" << endl;
+	TestChainFactory factory;
+	loadChainConfig(factory.config, factory.axisConfig);
+	vector<string> inputs;
+	vector<string> outputs;
+	vector<string> expected;
+	srand(6);
+	for (int f = 0; f < 7; f++) {
+		char path[100];
+		snprintf(path, sizeof(path), "target/test_batch%d.gcode", f);
+		inputs.push_back(path);
+		snprintf(path, sizeof(path), "target/test_batch%d.out", f);
+		outputs.push_back(path);
+		FILE *file = fopen(inputs[f].c_str(), "wb");
+		for (int i = 0; i < f * 300; i++) {
+			fprintf(file, i % 3 ? "G1X%.3f\n" : "G0Y%.3fZ%.1f\n", rand() % 10000 / 1000.0, rand() % 100 / 10.0);
+		}
+		fprintf(file, "G1Z1\n");	// modal X and Y of this file only
+		fclose(file);
+
+		// one chain per file
+		StringSink sink;
+		vector<IGFilterPtr> filters;
+		LineReader reader(*factory.createChain(sink, filters));
+		ASSERTZERO(reader.readFile(inputs[f].c_str()));
+		for (size_t i = filters.size(); i-- > 0;) {
+			delete filters[i];
+		}
+		string text;
+		for (size_t i = 0; i < sink.strings.size(); i++) {
+			text += sink[i] + "\n";
+		}
+		expected.push_back(text);
+	}
+
+	BatchReader batch(factory, 3);
+	ASSERTZERO(batch.readFiles(inputs, outputs));
+	ASSERTEQUAL(7, batch.getFiles());
+	for (int f = 0; f < 7; f++) {
+		ASSERTEQUALS(expected[f].c_str(), readText(outputs[f].c_str()).c_str());
+	}
+	vector<string> missing(1, "target/test_batch_missing.gcode");
+	vector<string> missingOut(1, "target/test_batch_missing.out");
+	unlink(missingOut[0].c_str());
+	ASSERT((batch.readFiles(missing, missingOut) < 0));
+	ASSERT((access(missingOut[0].c_str(), F_OK) != 0));
+	ASSERTEQUAL(-EINVAL, batch.readFiles(inputs, missingOut));
+
+	// outputs that are inputs or repeat other outputs are rejected before any are written
+	vector<string> self(1, outputs[1]);
+	self.push_back("target/./test_batch2.gcode");
+	vector<string> selfIn(1, inputs[1]);
+	selfIn.push_back(inputs[2]);
+	ASSERTEQUAL(-EINVAL, batch.readFiles(selfIn, self));
+	vector<string> twice(2, outputs[1]);
+	ASSERTEQUAL(-EINVAL, batch.readFiles(selfIn, twice));
+	twice[1] = "target/../target/test_batch1.out";
+	ASSERTEQUAL(-EINVAL, batch.readFiles(selfIn, twice));
+	ASSERTEQUALS(expected[1].c_str(), readText(outputs[1].c_str()).c_str());
+	ASSERT((readText(inputs[1].c_str()).size() > 0));
+	json_decref(factory.config);
+	json_decref(factory.axisConfig);
+
+	cout << "testBatchReader() PASS" << endl;
+}
+
+static void interpolateAll(MappedPointFilter *pFilter, const vector<GCoord> *pDomains, vector<GCoord> *pRanges) {
+	for (size_t i = 0; i < pDomains->size(); i++) {
+		(*pRanges)[i] = pFilter->interpolate((*pDomains)[i]);
+	}
+}
+
+void testCalibrationModel() {
+	cout << "testCalibrationModel() BEGIN -------" << endl;
+	StringSink sink;
+	MappedPointFilter owner(sink);
+	for (int x = 0; x <= 40; x += 10) {
+		for (int y = 0; y <= 40; y += 10) {
+			for (int z = 0; z <= 40; z += 10) {
+				owner.mapPoint(GCoord(x,y,z), GCoord(x + 0.001*x*x, y + 0.0005*y*z, z + 0.01*x));
+			}
+		}
+	}
+	vector<GCoord> domains;
+	vector<GCoord> expected;
+	srand(6);
+	for (int i = 0; i < 2000; i++) {
+		domains.push_back(GCoord(rand() % 40000 / 1000.0, rand() % 40000 / 1000.0, rand() % 40000 / 1000.0));
+		expected.push_back(owner.interpolate(domains.back()));
+	}
+	assert(!owner.isModelShared());
+	CalibrationModelPtr model = owner.getModel();
+	assert(owner.isModelShared());
+	ASSERTEQUAL(2, model.use_count());
+
+	// the owner edits a copy of a shared model
+	owner.mapPoint(GCoord(50,50,50), GCoord(0,0,0));
+	assert(!owner.isModelShared());
+	ASSERTEQUAL(1, model.use_count());
+	ASSERTEQUAL(125, model->size());
+	ASSERTEQUAL(0, model->mapping.size());
+	ASSERTEQUALT(0, GCoord(0,0,0).distance2(owner.interpolate(GCoord(50,50,50))), 1e-12);
+	ASSERTZERO(owner.bakeLattice(10));
+	ASSERTEQUAL(FIELD_NONE, model->field);
+	owner.setInterpolation(INTERPOLATE_DELAUNAY);
+	ASSERTEQUAL(INTERPOLATE_DELAUNAY, owner.getInterpolation());
+	ASSERTEQUAL(INTERPOLATE_NEIGHBORHOOD, model->interpolation);
+	json_error_t jerr;
+	json_t *config = json_loads("{\"neighborhood\":\"scan\"}", 0, &jerr);
+	ASSERTZERO(owner.configure(config));
+	json_decref(config);
+	ASSERTEQUAL(NEIGHBORHOOD_KDTREE, model->neighborhoodMode);
+
+	// a copy keeps the baked lattice and interpolates like the shared model
+	ASSERTZERO(owner.bakeLattice(10));
+	CalibrationModelPtr baked = owner.getModel();
+	ASSERTEQUAL(FIELD_LATTICE, baked->field);
+	owner.setDomainRadius(baked->domainRadius);
+	assert(owner.getModel() != baked);
+	ASSERTEQUAL(1, baked.use_count());
+	MappedPointFilter bakedFilter(sink, baked);
+	for (size_t i = 0; i < 100; i++) {
+		ASSERTGCOORD(bakedFilter.interpolate(domains[i]), owner.interpolate(domains[i]));
+	}
+
+	// filters with their own stream state interpolate one model at once
+	const int threads = 4;
+	vector<MappedPointFilterPtr> filters;
+	for (int t = 0; t < threads; t++) {
+		filters.push_back(new MappedPointFilter(sink, model));
+	}
+	ASSERTEQUAL(1 + threads, model.use_count());
+	vector<vector<GCoord> > ranges(threads, vector<GCoord>(domains.size()));
+	vector<std::thread> pool;
+	for (int t = 0; t < threads; t++) {
+		pool.push_back(std::thread(interpolateAll, filters[t], &domains, &ranges[t]));
+	}
+	for (int t = 0; t < threads; t++) {
+		pool[t].join();
+		const CoherenceStats &coherence = filters[t]->getCoherence();
+		ASSERTEQUAL(domains.size(), coherence.hits + coherence.misses);
+		for (size_t i = 0; i < domains.size(); i++) {
+			assert(expected[i] == ranges[t][i]);
+		}
+		delete filters[t];
+	}
+	ASSERTEQUAL(1, model.use_count());
+
+	// only the stream configuration applies to a shared model
+	config = json_loads("{\"cache\":{\"capacity\":64}, \"format\":{\"x\":\"fixed0\"}}", 0, &jerr);
+	MappedPointFilter cached(sink, model, config);
+	json_decref(config);
+	assert(cached.getCache().isEnabled());
+	ASSERTGCOORD(expected[0], cached.interpolate(domains[0]));
+	cached.writeln("G1X10Y20Z30");
+	ASSERTEQUALS("G1X10Y20.3Z30.1", sink.strings.back().c_str());
+
+	cout << "testCalibrationModel() PASS" << endl;
+}
+
+static void serveDaemon(GFilterDaemon *pDaemon, int *pRc) {
+	*pRc = pDaemon->serve();
+}
+
+static void sendJob(const char *socketPath, string input, string output, int *pRc) {
+	int inFd = open(input.c_str(), O_RDONLY);
+	int outFd = open(output.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	*pRc = daemonClient(socketPath, inFd, outFd);
+	close(inFd);
+	close(outFd);
+}
+
+static void pipeJob(const char *socketPath, int inFd, int outFd, int *pRc) {
+	*pRc = daemonClient(socketPath, inFd, outFd);
+}
+
+static void daemonAddress(const char *socketPath, struct sockaddr_un &addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+}
+
+static int connectDaemon(const char *socketPath) {
+	struct sockaddr_un addr;
+	daemonAddress(socketPath, addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERTZERO(connect(fd, (struct sockaddr *) &addr, sizeof(addr)));
+	return fd;
+}
+
+void testDaemon() {
+	cout << "testDaemon() BEGIN -------" << endl;
+	const char *socketPath = "target/test_daemon.sock";
+	TestChainFactory factory;
+	loadChainConfig(factory.config, factory.axisConfig);
+
+	// a file in the way is not replaced
+	unlink(socketPath);
+	FILE *file = fopen(socketPath, "wb");
+	fclose(file);
+	{
+		GFilterDaemon daemon(factory, socketPath);
+		ASSERTEQUAL(-EADDRINUSE, daemon.listen());
+	}
+	unlink(socketPath);
+
+	// a socket left by a daemon that is gone is replaced
+	struct sockaddr_un addr;
+	daemonAddress(socketPath, addr);
+	int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERTZERO(bind(stale, (struct sockaddr *) &addr, sizeof(addr)));
+	close(stale);
+	{
+		GFilterDaemon daemon(factory, socketPath);
+		ASSERTZERO(daemon.listen());
+	}
+	string longPath(200, 'x');
+	GFilterDaemon misnamed(factory, longPath.c_str());
+	ASSERTEQUAL(-ENAMETOOLONG, misnamed.listen());
+	assert(daemonClient(socketPath, 0, 1) < 0);
+
+	// the jobs of testBatchReader, several at a time
+	GFilterDaemon daemon(factory, socketPath, 3);
+	ASSERTZERO(daemon.listen());
+	int rcServe = -1;
+	std::thread server(serveDaemon, &daemon, &rcServe);
+	const int jobs = 6;
+	vector<std::thread> clients;
+	vector<int> rcs(jobs, -1);
+	for (int f = 0; f < jobs; f++) {
+		char input[100], output[100];
+		snprintf(input, sizeof(input), "target/test_batch%d.gcode", f + 1);
+		snprintf(output, sizeof(output), "target/test_daemon%d.out", f + 1);
+		clients.push_back(std::thread(sendJob, socketPath, string(input), string(output), &rcs[f]));
+	}
+	for (int f = 0; f < jobs; f++) {
+		clients[f].join();
+		ASSERTZERO(rcs[f]);
+		char expected[100], output[100];
+		snprintf(expected, sizeof(expected), "target/test_batch%d.out", f + 1);
+		snprintf(output, sizeof(output), "target/test_daemon%d.out", f + 1);
+		ASSERTEQUALS(readText(expected).c_str(), readText(output).c_str());
+	}
+	daemon.stop();
+	server.join();
+	ASSERTZERO(rcServe);
+	DaemonStats stats = daemon.getStats();
+	ASSERTEQUAL(jobs, stats.jobs);
+	ASSERTEQUAL(jobs, stats.latencyJobs);
+	ASSERTEQUAL(21 * 300 + jobs, stats.lines);	// f * 300 moves and G1Z1 per file
+	ASSERT((stats.latencyMax >= stats.meanLatency()));
+	ASSERT((stats.meanLatency() > 0));
+
+	// a client that hangs up before its output is written fails only its job
+	{
+		GFilterDaemon daemon(factory, socketPath, 1);
+		BufferedSink options(-1, 1<<20, FLUSH_THROUGHPUT);
+		daemon.setSinkOptions(options);
+		ASSERTZERO(daemon.listen());
+		std::thread server(serveDaemon, &daemon, &rcServe);
+		int fd = connectDaemon(socketPath);
+		string text = readText("target/test_batch6.gcode");
+		ASSERTEQUAL(text.size(), send(fd, text.c_str(), text.size(), MSG_NOSIGNAL));
+		close(fd);
+
+		// a live daemon keeps its socket, though its probe is an empty job
+		GFilterDaemon rival(factory, socketPath);
+		ASSERTEQUAL(-EADDRINUSE, rival.listen());
+
+		int rc = -1;
+		sendJob(socketPath, "target/test_batch1.gcode", "target/test_daemon1.out", &rc);
+		ASSERTZERO(rc);
+		ASSERTEQUALS(readText("target/test_batch1.out").c_str(), readText("target/test_daemon1.out").c_str());
+		daemon.stop();
+		server.join();
+		ASSERTZERO(rcServe);
+		ASSERTEQUAL(3, daemon.getStats().jobs);
+		ASSERTEQUAL(1, daemon.getStats().errors);
+	}
+
+	// a job whose output stops being read fails, and its input stops being read
+	{
+		GFilterDaemon daemon(factory, socketPath, 1);
+		daemon.setIdleTimeout(100);
+		ASSERTZERO(daemon.listen());
+		std::thread server(serveDaemon, &daemon, &rcServe);
+		int fd = connectDaemon(socketPath);
+		string text = readText("target/test_batch6.gcode");
+		struct pollfd pfd = { fd, POLLOUT, 0 };
+		while (poll(&pfd, 1, 1000) > 0 && send(fd, text.c_str(), text.size(), MSG_NOSIGNAL|MSG_DONTWAIT) >= 0) {
+		}
+		for (int i = 0; i < 5000 && daemon.getStats().errors == 0; i++) {
+			usleep(1000);
+		}
+		ASSERTEQUAL(1, daemon.getStats().errors);
+		string output;
+		char buf[1<<16];
+		ssize_t n;
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			output.append(buf, n);
+		}
+		close(fd);
+		ASSERT((output.size() > 0));
+		ASSERT((output.find(string(1, '\0') + DAEMON_STATUS "0") == string::npos));
+		daemon.stop();
+		server.join();
+		ASSERTZERO(rcServe);
+		ASSERTEQUAL(1, daemon.getStats().jobs);
+	}
+
+	// a job that waits for input fails with a status after its output
+	{
+		GFilterDaemon daemon(factory, socketPath, 2);
+		daemon.setIdleTimeout(100);
+		ASSERTZERO(daemon.listen());
+		std::thread server(serveDaemon, &daemon, &rcServe);
+		int fd = connectDaemon(socketPath);
+		const char *line = "G0X1\n";
+		ASSERTEQUAL(strlen(line), send(fd, line, strlen(line), MSG_NOSIGNAL));
+		string text;
+		char buf[100];
+		ssize_t n;
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			text.append(buf, n);
+		}
+		close(fd);
+		size_t end = text.find('\0');
+		ASSERT((end != string::npos));
+		ASSERTEQUALS("G0", text.substr(0, 2).c_str());
+		ASSERTEQUAL('\n', text[end - 1]);
+		char status[40];
+		snprintf(status, sizeof(status), DAEMON_STATUS "%d\n", -ETIMEDOUT);
+		ASSERTEQUALS(status, text.substr(end + 1).c_str());
+		daemon.stop();
+		server.join();
+		ASSERTZERO(rcServe);
+		ASSERTEQUAL(1, daemon.getStats().errors);
+	}
+
+	// stop() ends a job that is still reading, which fails its client
+	{
+		GFilterDaemon daemon(factory, socketPath, 2);
+		daemon.setIdleTimeout(0);
+		ASSERTZERO(daemon.listen());
+		std::thread server(serveDaemon, &daemon, &rcServe);
+		int inFds[2], outFds[2];
+		ASSERTZERO(pipe(inFds));
+		ASSERTZERO(pipe(outFds));
+		int rc = 0;
+		std::thread client(pipeJob, socketPath, inFds[0], outFds[1], &rc);
+		ASSERTEQUAL(5, write(inFds[1], "G0X1\n", 5));
+		char buf[100];
+		ASSERT((read(outFds[0], buf, sizeof(buf)) > 0));	// the job has started
+		daemon.stop();
+		server.join();
+		ASSERTZERO(rcServe);
+		close(inFds[1]);	// ends the input of the client
+		client.join();
+		ASSERT((rc < 0));
+		ASSERTEQUAL(1, daemon.getStats().errors);
+		close(inFds[0]);
+		close(outFds[0]);
+		close(outFds[1]);
+	}
+	json_decref(factory.config);
+	json_decref(factory.axisConfig);
+
+	cout << "testDaemon() PASS" << endl;
+}
+
+void testBufferedSink() {
+	cout << "testBufferedSink() BEGIN -------" << endl;
+	const char *path = "target/test_sink.gcode";
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	ASSERT((fd >= 0));
+	string expected;
+	char line[200];
+
+	// throughput writes only full buffers
+	{
+		BufferedSink sink(fd, 64, FLUSH_THROUGHPUT);
+		for (int i = 0; i < 20; i++) {
+			sprintf(line, "G0X%d", i % 10);
+			sink.writeSpan(line, strlen(line));
+			expected += line;
+			expected += "\n";
+			ASSERTEQUAL(i < 12 ? 0 : 1, sink.getWrites());
+		}
+		sink.flush(INPUT_IDLE);
+		ASSERTEQUAL(1, sink.getWrites());
+		sink.flush(INPUT_END);
+		ASSERTEQUAL(2, sink.getWrites());
+		sink.flush(INPUT_END);
+		ASSERTEQUAL(2, sink.getWrites());
+
+		// a line longer than the buffer is written with it
+		sink.writeln("M3");
+		memset(line, 'X', 100);
+		line[100] = 0;
+		sink.writeln(line);
+		ASSERTEQUAL(3, sink.getWrites());
+		expected += "M3\n";
+		expected += line;
+		expected += "\n";
+	}
+
+	// line writes every line
+	{
+		BufferedSink sink(fd, 64, FLUSH_LINE);
+		for (int i = 0; i < 5; i++) {
+			sink.writeln("G1Y2");
+			expected += "G1Y2\n";
+		}
+		ASSERTEQUAL(5, sink.getWrites());
+	}
+
+	// interactive writes when input is idle
+	{
+		BufferedSink sink(fd, 1024, FLUSH_INTERACTIVE);
+		sink.setLatency(60000);
+		for (int i = 0; i < 5; i++) {
+			sink.writeln("G1Z3");
+			expected += "G1Z3\n";
+		}
+		ASSERTEQUAL(0, sink.getWrites());
+		sink.flush(INPUT_IDLE);
+		ASSERTEQUAL(1, sink.getWrites());
+		sink.setLatency(0);
+		sink.writeln("M2");
+		sink.writeln("M2");
+		expected += "M2\nM2\n";
+		ASSERTEQUAL(2, sink.getWrites());
+	}
+	close(fd);
+
+	FILE *file = fopen(path, "rb");
+	vector<char> actual(expected.size() + 10);
+	size_t n = fread(&actual[0], 1, actual.size(), file);
+	fclose(file);
+	ASSERTEQUAL(expected.size(), n);
+	ASSERTZERO(memcmp(expected.c_str(), &actual[0], n));
+
+	cout << "testBufferedSink() PASS" << endl;
+}
+
+void testSimdScan() {
+	cout << "testSimdScan() BEGIN -------" << endl;
+	const char alphabet[] = "G1X2.5 y-3Z;(comment)\n\r\tM\xd8\xf8xyzXYZ";
+	char text[400];
+	srand(3);
+	for (size_t i = 0; i < sizeof(text); i++) {
+		text[i] = alphabet[rand() % (sizeof(alphabet)-1)];
+	}
+	SimdLevel best = simdLevel();
+	for (int level = SIMD_SCALAR; level <= best; level++) {
+		ASSERTEQUAL(level, setSimdLevel((SimdLevel) level));
+		for (size_t offset = 0; offset < 8; offset++) {
+			for (size_t length = 0; length + offset <= sizeof(text); length += 13) {
+				const char *s = text + offset;
+				unsigned long long newlines[7], comments[7], axes[7];
+				simdScan(s, length, newlines, comments, axes);
+				for (size_t i = 0; i < length; i++) {
+					int w = i / SIMD_SCAN_BYTES;
+					int bit = i % SIMD_SCAN_BYTES;
+					char c = s[i];
+					ASSERTEQUAL((c == '\n'), ((newlines[w] >> bit) & 1));
+					ASSERTEQUAL((c == ';' || c == '('), ((comments[w] >> bit) & 1));
+					ASSERTEQUAL((strchr("xyzXYZ", c) && c), ((axes[w] >> bit) & 1));
+				}
+				if (length % SIMD_SCAN_BYTES) {
+					ASSERTZERO(newlines[length / SIMD_SCAN_BYTES] >> (length % SIMD_SCAN_BYTES));
+				}
+			}
+		}
+		unsigned long long axes[1];
+		simdScan("G1 X1", 5, NULL, NULL, axes);
+		ASSERTEQUAL(8, axes[0]);
+		ASSERTEQUAL(3, scanBit(axes[0]));
+	}
+	setSimdLevel(best);
+
+	cout << "testSimdScan() PASS" << endl;
+}
+
+void testCoordFormat() {
+	cout << "testCoordFormat() BEGIN -------" << endl;
+	char buf[COORD_CHARS+1];
+	char expected[COORD_CHARS+1];
+
+	// general is printf("%g")
+	CoordFormat general;
+	srand(1);
+	for (int i = 0; i < 10000; i++) {
+		double value = (rand() - RAND_MAX/2.0) / (1 << (rand() % 30));
+		buf[general.write(buf, value)] = 0;
+		sprintf(expected, "%g", value);
+		ASSERTEQUALS(expected, buf);
+	}
+	buf[general.write(buf, -0.0)] = 0;
+	ASSERTEQUALS("-0", buf);	// as printf("%g")
+
+	// shortest reads back exactly without an exponent
+	CoordFormat shortest(NOTATION_SHORTEST);
+	for (int i = 0; i < 10000; i++) {
+		double value = (rand() - RAND_MAX/2.0) / (rand() % 100000 + 1);
+		buf[shortest.write(buf, value)] = 0;
+		ASSERT((strtod(buf, NULL) == value));
+		ASSERT(!strchr(buf, 'e'));
+	}
+	buf[shortest.write(buf, 1234.5678901)] = 0;
+	ASSERTEQUALS("1234.5678901", buf);
+	buf[shortest.write(buf, 0.1)] = 0;
+	ASSERTEQUALS("0.1", buf);
+	buf[shortest.write(buf, -0.000001)] = 0;
+	ASSERTEQUALS("0", buf);
+	buf[shortest.write(buf, -0.0)] = 0;
+	ASSERTEQUALS("0", buf);
+
+	// fixed rounds and drops trailing zeros
+	CoordFormat fixed3(NOTATION_FIXED, 3);
+	const double values[8] = { 1.23456, 2.5, -0.0004, 10, -1.05, 0.0999, -123.0001, 0.0625 };
+	const char *texts[8] = { "1.235", "2.5", "0", "10", "-1.05", "0.1", "-123", "0.063" };
+	for (int i = 0; i < 8; i++) {
+		buf[fixed3.write(buf, values[i])] = 0;
+		ASSERTEQUALS(texts[i], buf);
+	}
+
+	ASSERTZERO(fixed3.parse("fixed4"));
+	ASSERTEQUAL(NOTATION_FIXED, fixed3.notation);
+	ASSERTEQUAL(4, fixed3.digits);
+	ASSERTEQUAL(-EINVAL, fixed3.parse("fixed"));
+	ASSERTEQUAL(-EINVAL, fixed3.parse("%g"));
+
+	// per axis output format
+	const char *json =
+		"{ \"format\":{\"x\":\"fixed2\",\"z\":\"shortest\"}, \"map\":[ " \
+		"{\"domain\":[0,0,0], \"range\":[0,0,0]}, " \
+		"{\"domain\":[0,0,1], \"range\":[0,0,1]}," \
+		"{\"domain\":[0,1,0], \"range\":[0,1,0]}," \
+		"{\"domain\":[1,0,0], \"range\":[1,0,0]} " \
+		"]}";
+	json_error_t jerr;
+	json_t *config = json_loads(json, 0, &jerr);
+	StringSink sink;
+	MappedPointFilter pof(sink, config);
+	json_decref(config);
+	pof.writeln("G1X1.23456Y1.23456789Z0.123456789 F100");
+	ASSERTEQUALS("G1X1.23Y1.23457Z0.123456789F100", sink[0].c_str());
+
+	cout << "testCoordFormat() PASS" << endl;
+}
+
 int main() {
     firelog_init("target/test.log", FIRELOG_TRACE);
 
@@ -286,9 +2098,34 @@ int main() {
     testMat3x3();
     testGCoord();
     testMatchNumber();
+	testParseNumber();
     testGMoveMatcher();
     testMappedPointFilter();
 	testCenter();
+	testNeighborhoodIndex();
+	testDelaunay();
+	testLattice();
+	testOctree();
+	testLayered();
+	testAxisTable();
+	testCoherence();
+	testInterpolationCache();
+	testPointStore();
+	testBatchInterpolate();
+	testAllocationFree();
+	testWriteSpan();
+	testLineReader();
+	testBufferedSink();
+	testGBlock();
+	testWriteBatch();
+	testPipeline();
+	testThreadStage();
+	testChunkReader();
+	testBatchReader();
+	testCalibrationModel();
+	testDaemon();
+	testCoordFormat();
+	testSimdScan();
 
     cout << "ALL TESTS PASS" << endl;
 }
@@ -0,0 +1,199 @@
+#include <string.h>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "FireLog.h"
+#include "gfilter.hpp"
+
+using namespace std;
+using namespace gfilter;
+
+////////////// ThreadStage /////////////
+// The writer owns tail and the stage thread owns head. A slot belongs to
+// the writer from head+slots to tail and to the stage thread from head
+// to tail, so slots are handed over with atomic stores of the
+// indices and never locked. Slot vectors keep their capacity, so a warm
+// ring does not allocate. A side that finds nothing to do after a brief
+// spin sleeps on a condition variable until the other side moves an index.
+
+#define SLOT_BATCH -1	/* slot holds lines */
+#define SLOT_STOP -2	/* stage thread exits */
+#define SLOT_RESET -3	/* next filter is reset() */
+
+typedef struct StageSlot {
+    vector<GBlock> blocks;
+    vector<char> text;
+    size_t count;
+    int event;	// InputEvent or SLOT_*
+} StageSlot;
+
+struct gfilter::StageRing {
+    vector<StageSlot> slots;
+    atomic<size_t> head;	// next slot to be read
+    atomic<size_t> tail;	// next slot to be written
+    atomic<size_t> done;	// slots processed by the stage thread
+    atomic<int> rc;			// first error of the next filter
+    atomic<long> emptyWaits;
+    atomic<int> sleepers;	// threads waiting on changed
+    mutex lock;
+    condition_variable changed;
+    thread worker;
+    StageRing(size_t n) : slots(n), head(0), tail(0), done(0), rc(0), emptyWaits(0), sleepers(0) {
+    }
+};
+
+// Index stores and the sleepers check are sequentially consistent, so
+// either the sleeper sees the new index or the waker sees the sleeper.
+static inline void wake(StageRing &ring) {
+    if (ring.sleepers.load()) {
+        lock_guard<mutex> guard(ring.lock);
+        ring.changed.notify_all();
+    }
+}
+
+// spin briefly, then sleep until ready()
+template <class Ready>
+static void waitUntil(StageRing &ring, Ready ready) {
+    for (int spins = 0; spins < 64; spins++) {
+        if (ready()) {
+            return;
+        }
+        this_thread::yield();
+    }
+    unique_lock<mutex> guard(ring.lock);
+    ring.sleepers++;
+    while (!ready()) {
+        ring.changed.wait(guard);
+    }
+    ring.sleepers--;
+}
+
+static void runStage(StageRing *pRing, IGFilter *pNext) {
+    StageRing &ring = *pRing;
+    size_t n = ring.slots.size();
+    for (;;) {
+        size_t head = ring.head.load(memory_order_relaxed);
+        if (ring.tail.load(memory_order_acquire) == head) {
+            ring.emptyWaits.fetch_add(1, memory_order_relaxed);
+            waitUntil(ring, [&ring, head] { return ring.tail.load() != head; });
+        }
+        StageSlot &slot = ring.slots[head % n];
+        int rc = 0;
+        bool stop = slot.event == SLOT_STOP;
+        if (slot.event == SLOT_BATCH) {
+            rc = pNext->writeBatch(&slot.blocks[0], slot.count);
+        } else if (slot.event == SLOT_RESET) {
+            pNext->reset();
+        } else if (!stop) {
+            rc = pNext->flush((InputEvent) slot.event);
+        }
+        if (rc) {
+            int ok = 0;
+            ring.rc.compare_exchange_strong(ok, rc);
+        }
+        ring.head.store(head + 1);
+        ring.done.store(head + 1);
+        wake(ring);
+        if (stop) {
+            return;
+        }
+    }
+}
+
+ThreadStage::ThreadStage(IGFilter &next, size_t slots) : GFilterBase(next) {
+    _name = "ThreadStage";
+    pRing = new StageRing(max(slots, (size_t) 2));
+    pRing->worker = thread(runStage, pRing, &next);
+}
+
+ThreadStage::~ThreadStage() {
+    push(NULL, 0, SLOT_STOP);
+    pRing->worker.join();
+    getStats();
+    LOGINFO3("~ThreadStage() batches:%ld lines:%ld fullWaits:%ld", stats.batches, stats.lines, stats.fullWaits);
+    LOGINFO3("~ThreadStage() emptyWaits:%ld maxDepth:%ld meanDepth:%g",
+             stats.emptyWaits, (long) stats.maxDepth, stats.meanDepth());
+    delete pRing;
+}
+
+int ThreadStage::push(GBlock *blocks, size_t count, int event) {
+    StageRing &ring = *pRing;
+    size_t n = ring.slots.size();
+    size_t tail = ring.tail.load(memory_order_relaxed);
+    size_t depth = tail - ring.head.load(memory_order_acquire);
+    if (depth >= n) {
+        stats.fullWaits++;
+        waitUntil(ring, [&ring, tail, n] { return tail - ring.head.load() < n; });
+    }
+    if (event == SLOT_BATCH) {
+        stats.batches++;
+        stats.lines += count;
+        stats.maxDepth = max(stats.maxDepth, depth);
+        stats.depthSum += depth;
+    }
+
+    StageSlot &slot = ring.slots[tail % n];
+    slot.event = event;
+    slot.count = count;
+    if (count) {
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            bytes += blocks[i].length;
+        }
+        if (slot.blocks.size() < count) {
+            slot.blocks.resize(count);
+        }
+        if (slot.text.size() < bytes + 1) {
+            slot.text.resize(bytes + 1);
+        }
+        char *s = &slot.text[0];
+        for (size_t i = 0; i < count; i++) {
+            GBlock &block = slot.blocks[i];
+            block = blocks[i];
+            memcpy(s, block.text, block.length);
+            block.rebase(s);
+            s += block.length;
+        }
+    }
+    ring.tail.store(tail + 1);
+    wake(ring);
+    return ring.rc.load(memory_order_relaxed);
+}
+
+int ThreadStage::writeln(const char *value) {
+    return writeSpan(value, strlen(value));
+}
+
+int ThreadStage::writeSpan(const char *text, size_t length) {
+    GBlock block(text, length);
+    return writeBatch(&block, 1);
+}
+
+int ThreadStage::writeBlock(GBlock &block) {
+    return writeBatch(&block, 1);
+}
+
+int ThreadStage::writeBatch(GBlock *blocks, size_t count) {
+    return count ? push(blocks, count, SLOT_BATCH) : 0;
+}
+
+int ThreadStage::flush(InputEvent event) {
+    StageRing &ring = *pRing;
+    push(NULL, 0, event);
+    if (event == INPUT_END) {
+        size_t tail = ring.tail.load(memory_order_relaxed);
+        waitUntil(ring, [&ring, tail] { return ring.done.load() == tail; });
+    }
+    return ring.rc.load(memory_order_relaxed);
+}
+
+void ThreadStage::reset() {
+    push(NULL, 0, SLOT_RESET);
+}
+
+const StageStats &ThreadStage::getStats() {
+    stats.emptyWaits = pRing->emptyWaits.load(memory_order_relaxed);
+    return stats;
+}